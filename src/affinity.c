@@ -0,0 +1,99 @@
+#define _GNU_SOURCE // cpu_set_t
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+
+#include "librop.h"
+
+#include "affinity.h"
+#include "sysfs.h"
+
+static bool numa_local;
+static bool have_exclude;
+static cpu_set_t exclude;
+
+// Parses a kernel CPU list such as "0-15,32-47"
+static bool parse_cpulist(const char* list, cpu_set_t* cpus)
+{
+	CPU_ZERO(cpus);
+	const char* p = list;
+	while (*p != '\0') {
+		char* end;
+		long first = strtol(p, &end, 10);
+		long last = first;
+		if (end == p || first < 0) {
+			return false;
+		}
+		if (*end == '-') {
+			p = end + 1;
+			last = strtol(p, &end, 10);
+			if (end == p || last < first) {
+				return false;
+			}
+		}
+		for (long cpu = first; cpu <= last && cpu < CPU_SETSIZE; ++cpu) {
+			CPU_SET((int)cpu, cpus);
+		}
+		if (*end == ',') {
+			end++;
+		}
+		else if (*end != '\0') {
+			return false;
+		}
+		p = end;
+	}
+	return true;
+}
+
+bool rop_probe_set_affinity(bool local, const char* exclude_cpus)
+{
+	if (exclude_cpus != NULL && !parse_cpulist(exclude_cpus, &exclude)) {
+		fprintf(stderr, "Invalid CPU list: %s\n", exclude_cpus);
+		return false;
+	}
+	have_exclude = exclude_cpus != NULL;
+	numa_local = local;
+	return true;
+}
+
+void affinity_pin(const struct rop_device* device, struct affinity_saved* saved)
+{
+	cpu_set_t cpus;
+	saved->pinned = false;
+	if (!numa_local && !have_exclude) {
+		return;
+	}
+	if (sched_getaffinity(0, sizeof(saved->cpus), &saved->cpus) != 0) {
+		return;
+	}
+
+	// Start from what the thread may use at all, e.g. a cgroup's cpuset
+	cpus = saved->cpus;
+	if (have_exclude) {
+		CPU_XOR(&cpus, &cpus, &exclude);
+		CPU_AND(&cpus, &cpus, &saved->cpus);
+	}
+	// Narrow down to the GPU's node, unless none of its CPUs are left to us
+	char list[1024];
+	cpu_set_t local;
+	if (numa_local && rop_device_numa_node(device) >= 0 &&
+	    sysfs_read_pci_attribute(device, "local_cpulist", list, sizeof(list)) && parse_cpulist(list, &local)) {
+		CPU_AND(&local, &local, &cpus);
+		if (CPU_COUNT(&local) > 0) {
+			cpus = local;
+		}
+	}
+	if (CPU_COUNT(&cpus) == 0 || CPU_EQUAL(&cpus, &saved->cpus)) {
+		return;
+	}
+	saved->pinned = sched_setaffinity(0, sizeof(cpus), &cpus) == 0;
+}
+
+void affinity_restore(const struct affinity_saved* saved)
+{
+	if (saved->pinned) {
+		sched_setaffinity(0, sizeof(saved->cpus), &saved->cpus);
+	}
+}
@@ -0,0 +1,22 @@
+#ifndef AFFINITY_H
+#define AFFINITY_H
+
+#include <stdbool.h>
+#include <sched.h>
+
+#include "librop.h"
+
+// Internal to librop: placement of probe threads, configured with
+// rop_probe_set_affinity. Needs _GNU_SOURCE for cpu_set_t.
+
+struct affinity_saved
+{
+	cpu_set_t cpus;
+	bool pinned;
+};
+
+// Pins the calling thread for probing `device`, remembering its old mask
+void affinity_pin(const struct rop_device* device, struct affinity_saved* saved);
+void affinity_restore(const struct affinity_saved* saved);
+
+#endif
@@ -0,0 +1,124 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "librop.h"
+
+// A writer update is a copy of a few KB, so a reader that keeps seeing it in
+// progress after this many attempts is looking at a writer that died mid-update
+#define ROP_BOARD_READ_ATTEMPTS 100000
+
+struct rop_board* rop_board_create(const char* name)
+{
+	int fd = shm_open(name, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (fd == -1) {
+		fprintf(stderr, "Failed to open shared memory %s: %s\n", name, strerror(errno));
+		return NULL;
+	}
+	// Readers keep their mapping across writer restarts, so the size never changes
+	if (ftruncate(fd, sizeof(struct rop_board)) != 0) {
+		fprintf(stderr, "Failed to size shared memory %s: %s\n", name, strerror(errno));
+		close(fd);
+		return NULL;
+	}
+	struct rop_board* board = mmap(NULL, sizeof(*board), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (board == MAP_FAILED) {
+		fprintf(stderr, "Failed to map shared memory %s: %s\n", name, strerror(errno));
+		return NULL;
+	}
+
+	// A fresh segment is all zero; an old one is taken over with an update
+	// so that readers mapped to it never see a torn header
+	uint32_t sequence = __atomic_load_n(&board->sequence, __ATOMIC_RELAXED) | 1;
+	__atomic_store_n(&board->sequence, sequence, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	board->magic = ROP_BOARD_MAGIC;
+	board->version = ROP_BOARD_VERSION;
+	board->writer_pid = (uint32_t)getpid();
+	board->device_count = 0;
+	memset(board->entries, 0, sizeof(board->entries));
+	__atomic_store_n(&board->sequence, sequence + 1, __ATOMIC_RELEASE);
+	return board;
+}
+
+void rop_board_publish(struct rop_board* board, const struct rop_board_entry* entries, int count)
+{
+	if (count > ROP_MAX_GPUS) {
+		count = ROP_MAX_GPUS;
+	}
+	uint32_t sequence = board->sequence; // only this writer changes it
+	__atomic_store_n(&board->sequence, sequence + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	memcpy(board->entries, entries, (size_t)count * sizeof(*entries));
+	board->device_count = (uint32_t)count;
+	__atomic_store_n(&board->sequence, sequence + 2, __ATOMIC_RELEASE);
+}
+
+void rop_board_destroy(struct rop_board* board, const char* name)
+{
+	uint32_t sequence = board->sequence;
+	__atomic_store_n(&board->sequence, sequence + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	board->writer_pid = 0;
+	__atomic_store_n(&board->sequence, sequence + 2, __ATOMIC_RELEASE);
+	munmap(board, sizeof(*board));
+	shm_unlink(name);
+}
+
+const struct rop_board* rop_board_open(const char* name)
+{
+	int fd = shm_open(name, O_RDONLY | O_CLOEXEC, 0);
+	if (fd == -1) {
+		fprintf(stderr, "Failed to open shared memory %s: %s\n", name, strerror(errno));
+		return NULL;
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size != (off_t)sizeof(struct rop_board)) {
+		fprintf(stderr, "%s is not a ROP board of this version\n", name);
+		close(fd);
+		return NULL;
+	}
+	const struct rop_board* board = mmap(NULL, sizeof(*board), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (board == MAP_FAILED) {
+		fprintf(stderr, "Failed to map shared memory %s: %s\n", name, strerror(errno));
+		return NULL;
+	}
+	if (board->magic != ROP_BOARD_MAGIC || board->version != ROP_BOARD_VERSION) {
+		fprintf(stderr, "%s is not a ROP board of this version\n", name);
+		munmap((void*)board, sizeof(*board));
+		return NULL;
+	}
+	return board;
+}
+
+bool rop_board_read(const struct rop_board* board, struct rop_board* snapshot)
+{
+	for (int attempt = 0; attempt < ROP_BOARD_READ_ATTEMPTS; ++attempt) {
+		uint32_t before = __atomic_load_n(&board->sequence, __ATOMIC_ACQUIRE);
+		if (before & 1) {
+			continue;
+		}
+		memcpy(snapshot, board, sizeof(*snapshot));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&board->sequence, __ATOMIC_RELAXED) == before) {
+			snapshot->sequence = before;
+			if (snapshot->device_count > ROP_MAX_GPUS) {
+				snapshot->device_count = ROP_MAX_GPUS;
+			}
+			return true;
+		}
+	}
+	return false;
+}
+
+void rop_board_close(const struct rop_board* board)
+{
+	munmap((void*)board, sizeof(*board));
+}
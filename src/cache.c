@@ -0,0 +1,227 @@
+#define _GNU_SOURCE // O_CLOEXEC for mkostemp
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "librop.h"
+
+#define ROP_CACHE_MAGIC 0x43504f52 // "ROPC"
+#define ROP_CACHE_VERSION 1
+#define ROP_CACHE_KEY_SIZE 2048
+#define ROP_CACHE_FILE "results.cache"
+#define ROP_CACHE_VALID 0x80000000 // set in cache_file.flags of every cached GPU
+
+// Everything the probe learned, valid while the key matches. The layout is
+// only ever read back by the same build, a size or version change is a miss.
+struct cache_file
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t size;
+	char key[ROP_CACHE_KEY_SIZE];
+	int device_count;
+	struct rop_device devices[ROP_MAX_GPUS];
+	unsigned flags[ROP_MAX_GPUS]; // ROP_PROBE_* fields present per GPU, 0 if not cached
+	struct rop_result results[ROP_MAX_GPUS];
+};
+
+static const char* cache_dir(void)
+{
+	const char* dir = getenv("ROP_CACHE_DIR");
+	return dir != NULL && dir[0] != '\0' ? dir : ROP_CACHE_DEFAULT_DIR;
+}
+
+static bool append_file(char* key, size_t* length, const char* path, bool first_line_only)
+{
+	FILE* file = fopen(path, "re");
+	if (file == NULL) {
+		return false;
+	}
+	size_t space = ROP_CACHE_KEY_SIZE - *length;
+	size_t read = fread(key + *length, 1, space - 1, file);
+	fclose(file);
+	key[*length + read] = '\0';
+	if (first_line_only) {
+		char* newline = strchr(key + *length, '\n');
+		if (newline != NULL) {
+			read = (size_t)(newline - (key + *length)) + 1;
+			key[*length + read] = '\0';
+		}
+	}
+	*length += read;
+	return read > 0;
+}
+
+static int compare_names(const void* a, const void* b)
+{
+	return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+// Identifies the running system without touching the driver: the boot, the
+// kernel module version and the PCI bus ID of every GPU it drives. Under the
+// fake RM the spec replaces the driver part.
+static bool build_key(char* key)
+{
+	size_t length = 0;
+	key[0] = '\0';
+	if (!append_file(key, &length, "/proc/sys/kernel/random/boot_id", false)) {
+		return false;
+	}
+
+	const char* fake_spec = getenv("ROP_FAKE_RM");
+	if (fake_spec != NULL) {
+		return snprintf(key + length, ROP_CACHE_KEY_SIZE - length, "fake:%s\n", fake_spec) < (int)(ROP_CACHE_KEY_SIZE - length);
+	}
+
+	if (!append_file(key, &length, "/proc/driver/nvidia/version", true)) {
+		return false;
+	}
+	DIR* dir = opendir("/proc/driver/nvidia/gpus");
+	if (dir == NULL) {
+		return false;
+	}
+	char names[ROP_MAX_GPUS][NAME_MAX + 1];
+	char* sorted[ROP_MAX_GPUS];
+	int count = 0;
+	for (struct dirent* entry = readdir(dir); entry != NULL && count < ROP_MAX_GPUS; entry = readdir(dir)) {
+		if (entry->d_name[0] != '.') {
+			snprintf(names[count], sizeof(names[count]), "%s", entry->d_name);
+			sorted[count] = names[count];
+			count++;
+		}
+	}
+	closedir(dir);
+	qsort(sorted, (size_t)count, sizeof(sorted[0]), compare_names);
+	for (int i = 0; i < count; ++i) {
+		int written = snprintf(key + length, ROP_CACHE_KEY_SIZE - length, "%s\n", sorted[i]);
+		if (written < 0 || (size_t)written >= ROP_CACHE_KEY_SIZE - length) {
+			return false;
+		}
+		length += (size_t)written;
+	}
+	return true;
+}
+
+// Reads the cache file if it belongs to the running system
+static bool read_cache(struct cache_file* cache, const char* key)
+{
+	char path[4096];
+	snprintf(path, sizeof(path), "%s/%s", cache_dir(), ROP_CACHE_FILE);
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1) {
+		return false;
+	}
+	ssize_t length = read(fd, cache, sizeof(*cache));
+	close(fd);
+	return length == (ssize_t)sizeof(*cache) &&
+	       cache->magic == ROP_CACHE_MAGIC && cache->version == ROP_CACHE_VERSION &&
+	       cache->size == sizeof(*cache) && strncmp(cache->key, key, sizeof(cache->key)) == 0 &&
+	       cache->device_count >= 0 && cache->device_count <= ROP_MAX_GPUS;
+}
+
+uint32_t rop_cache_load(struct rop_session* session, unsigned flags, struct rop_result* results)
+{
+	struct cache_file cache;
+	char key[ROP_CACHE_KEY_SIZE];
+
+	// Overrides keyed by subsystem need a live BUS_GET_PCI_INFO to judge
+	if ((flags & ROP_PROBE_VERDICT) && rop_expected_uses_subsystem()) {
+		return 0;
+	}
+	if (!build_key(key) || !read_cache(&cache, key)) {
+		return 0;
+	}
+
+	memset(session, 0, sizeof(*session));
+	session->nvidiactl_fd = -1;
+	for (int i = 0; i < ROP_MAX_GPUS; ++i) {
+		session->gpus[i].device_index = i;
+		session->gpus[i].nvidia_fd = -1;
+	}
+	session->device_count = cache.device_count;
+	memcpy(session->devices, cache.devices, sizeof(session->devices));
+
+	uint32_t hits = 0;
+	for (int i = 0; i < cache.device_count; ++i) {
+		if (cache.flags[i] == 0 || (cache.flags[i] & flags) != flags) {
+			continue;
+		}
+		results[i] = cache.results[i];
+		// The override file may differ from the run that filled the cache
+		if (flags & ROP_PROBE_VERDICT) {
+			const struct rop_device* device = &session->devices[i];
+			results[i].expectedCount = rop_expected_count(device->vendorId, device->pciDeviceId, 0);
+			results[i].verdict = rop_verdict_for(results[i].expectedCount, results[i].rop.ropOperationsCount);
+		}
+		hits |= 1u << i;
+	}
+	return hits;
+}
+
+void rop_cache_store(const struct rop_session* session, unsigned flags, const struct rop_result* results, int count)
+{
+	struct cache_file cache;
+	char key[ROP_CACHE_KEY_SIZE];
+	char path[4096];
+	char temp_path[4096];
+
+	if (!build_key(key)) {
+		return;
+	}
+	// Merge with what an earlier run cached for the same system and GPU table
+	if (!read_cache(&cache, key) || cache.device_count != session->device_count ||
+	    memcmp(cache.devices, session->devices, sizeof(cache.devices)) != 0) {
+		memset(&cache, 0, sizeof(cache));
+		cache.magic = ROP_CACHE_MAGIC;
+		cache.version = ROP_CACHE_VERSION;
+		cache.size = sizeof(cache);
+		memcpy(cache.key, key, sizeof(cache.key));
+		cache.device_count = session->device_count;
+		memcpy(cache.devices, session->devices, sizeof(cache.devices));
+	}
+	// Failures are not cached, the next run retries them live
+	for (int i = 0; i < count; ++i) {
+		int device_index = results[i].device_index;
+		if (results[i].status != ROP_OK || device_index < 0 || device_index >= cache.device_count) {
+			continue;
+		}
+		// Keep fields an earlier run fetched and this one did not, so tools
+		// asking for different fields don't keep evicting each other
+		struct rop_result* entry = &cache.results[device_index];
+		unsigned kept = cache.flags[device_index] & ~flags & ~ROP_CACHE_VALID;
+		struct rop_result previous = *entry;
+		*entry = results[i];
+		if (kept & ROP_PROBE_GR_INFO) {
+			entry->gr = previous.gr;
+		}
+		if (kept & ROP_PROBE_NAME) {
+			memcpy(entry->name, previous.name, sizeof(entry->name));
+		}
+		cache.flags[device_index] = flags | kept | ROP_CACHE_VALID;
+	}
+
+	// Write a private temporary file and rename it over the old one, so
+	// readers see either the old or the new cache, never a partial one
+	const char* dir = cache_dir();
+	if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+		return;
+	}
+	snprintf(path, sizeof(path), "%s/%s", dir, ROP_CACHE_FILE);
+	snprintf(temp_path, sizeof(temp_path), "%s/.%s.XXXXXX", dir, ROP_CACHE_FILE);
+	int fd = mkostemp(temp_path, O_CLOEXEC);
+	if (fd == -1) {
+		return;
+	}
+	bool written = fchmod(fd, 0644) == 0 && write(fd, &cache, sizeof(cache)) == (ssize_t)sizeof(cache);
+	close(fd);
+	if (!written || rename(temp_path, path) != 0) {
+		unlink(temp_path);
+	}
+}
@@ -0,0 +1,165 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "librop.h"
+
+#define ROP_EXPECTED_MAX_OVERRIDES 64
+
+struct expected_entry
+{
+	uint64_t key; // vendor << 48 | device << 32 | subsystem
+	NvU32 ropOperationsCount;
+};
+
+#define EXPECTED_KEY(vendor, device, subsystem) \
+	((uint64_t)(vendor) << 48 | (uint64_t)(device) << 32 | (uint64_t)(subsystem))
+
+// Full-die ROP counts from the Blackwell architecture whitepaper. Keep sorted
+// by key, lookups are a binary search.
+static const struct expected_entry builtin_table[] = {
+	{ EXPECTED_KEY(0x10de, 0x2b85, 0), 176 }, // GeForce RTX 5090
+	{ EXPECTED_KEY(0x10de, 0x2c02, 0), 112 }, // GeForce RTX 5080
+	{ EXPECTED_KEY(0x10de, 0x2c05, 0), 96 },  // GeForce RTX 5070 Ti
+	{ EXPECTED_KEY(0x10de, 0x2f04, 0), 80 },  // GeForce RTX 5070
+};
+
+static struct expected_entry overrides[ROP_EXPECTED_MAX_OVERRIDES];
+static int override_count;
+
+static int compare_entries(const void* a, const void* b)
+{
+	uint64_t key_a = ((const struct expected_entry*)a)->key;
+	uint64_t key_b = ((const struct expected_entry*)b)->key;
+	return key_a < key_b ? -1 : key_a > key_b;
+}
+
+static const struct expected_entry* find(const struct expected_entry* table, int count, uint64_t key)
+{
+	struct expected_entry probe = { .key = key };
+	return bsearch(&probe, table, (size_t)count, sizeof(*table), compare_entries);
+}
+
+static bool has_subsystem_entry(const struct expected_entry* table, int count)
+{
+	for (int i = 0; i < count; ++i) {
+		if ((NvU32)table[i].key != 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+bool rop_expected_load(const char* path)
+{
+	FILE* file = fopen(path, "re");
+	if (file == NULL) {
+		perror(path);
+		return false;
+	}
+
+	char line[256];
+	int line_number = 0;
+	bool ok = true;
+	while (ok && fgets(line, sizeof(line), file) != NULL) {
+		unsigned vendor, device, subsystem = 0, count;
+		char trailing;
+		line_number++;
+
+		char* comment = strchr(line, '#');
+		if (comment != NULL) {
+			*comment = '\0';
+		}
+		if (strspn(line, " \t\r\n") == strlen(line)) {
+			continue;
+		}
+		if (sscanf(line, "%x:%x:%x %u %c", &vendor, &device, &subsystem, &count, &trailing) != 4 &&
+		    (subsystem = 0, sscanf(line, "%x:%x %u %c", &vendor, &device, &count, &trailing) != 3)) {
+			fprintf(stderr, "%s:%d: expected \"vendor:device[:subsystem] count\"\n", path, line_number);
+			ok = false;
+		}
+		else if (vendor > 0xFFFF || device > 0xFFFF) {
+			fprintf(stderr, "%s:%d: PCI IDs are 16 bits\n", path, line_number);
+			ok = false;
+		}
+		else if (override_count == ROP_EXPECTED_MAX_OVERRIDES) {
+			fprintf(stderr, "%s: at most %d entries\n", path, ROP_EXPECTED_MAX_OVERRIDES);
+			ok = false;
+		}
+		else {
+			overrides[override_count++] = (struct expected_entry) {
+				.key = EXPECTED_KEY(vendor, device, subsystem),
+				.ropOperationsCount = count
+			};
+		}
+	}
+	fclose(file);
+
+	// A later line for the same key wins: sort stably by key, then keep the last
+	for (int i = 1; i < override_count; ++i) {
+		struct expected_entry entry = overrides[i];
+		int j = i;
+		for (; j > 0 && overrides[j - 1].key > entry.key; --j) {
+			overrides[j] = overrides[j - 1];
+		}
+		overrides[j] = entry;
+	}
+	int unique = 0;
+	for (int i = 0; i < override_count; ++i) {
+		if (unique > 0 && overrides[unique - 1].key == overrides[i].key) {
+			overrides[unique - 1] = overrides[i];
+		}
+		else {
+			overrides[unique++] = overrides[i];
+		}
+	}
+	override_count = unique;
+	return ok;
+}
+
+NvU32 rop_expected_count(NvU16 vendorId, NvU16 deviceId, NvU32 subsystemId)
+{
+	// Board-specific entries first, overrides before the built-in table
+	const uint64_t keys[] = {
+		EXPECTED_KEY(vendorId, deviceId, subsystemId),
+		EXPECTED_KEY(vendorId, deviceId, 0),
+	};
+	for (size_t i = subsystemId == 0 ? 1 : 0; i < sizeof(keys) / sizeof(keys[0]); ++i) {
+		const struct expected_entry* entry = find(overrides, override_count, keys[i]);
+		if (entry == NULL) {
+			entry = find(builtin_table, sizeof(builtin_table) / sizeof(builtin_table[0]), keys[i]);
+		}
+		if (entry != NULL) {
+			return entry->ropOperationsCount;
+		}
+	}
+	return 0;
+}
+
+bool rop_expected_uses_subsystem(void)
+{
+	return has_subsystem_entry(overrides, override_count) ||
+	       has_subsystem_entry(builtin_table, sizeof(builtin_table) / sizeof(builtin_table[0]));
+}
+
+enum rop_verdict rop_verdict_for(NvU32 expectedCount, NvU32 ropOperationsCount)
+{
+	if (expectedCount == 0) {
+		return ROP_VERDICT_UNKNOWN;
+	}
+	return ropOperationsCount >= expectedCount ? ROP_VERDICT_PASS : ROP_VERDICT_DEFICIENT;
+}
+
+const char* rop_verdict_string(enum rop_verdict verdict)
+{
+	switch (verdict) {
+	case ROP_VERDICT_UNKNOWN:
+		return "UNKNOWN";
+	case ROP_VERDICT_PASS:
+		return "PASS";
+	case ROP_VERDICT_DEFICIENT:
+		return "DEFICIENT";
+	}
+	return "UNKNOWN";
+}
@@ -0,0 +1,1259 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+
+#include "fakerm.h"
+
+#define FAKERM_MAX_FDS 256
+#define FAKERM_MAX_OBJECTS 1024
+#define FAKERM_FD_BASE 0x100000 // keeps fake fds clear of real ones
+#define FAKERM_CLIENT_HANDLE_BASE 0xC1D00000
+#define FAKERM_OBJECT_HANDLE_BASE 0xCAF00000
+#define FAKERM_EVENT_QUEUE 64
+
+enum fake_fd_kind
+{
+	FAKE_FD_FREE = 0,
+	FAKE_FD_CTL,
+	FAKE_FD_DEVICE,
+};
+
+// Events queued on a control fd after NV_ESC_ALLOC_OS_EVENT. A real eventfd
+// stands in for the fd's poll readiness, it is readable while count > 0.
+struct fake_event_queue
+{
+	int poll_fd;
+	int head;
+	int count;
+	NvUnixEvent events[FAKERM_EVENT_QUEUE];
+};
+
+struct fake_fd
+{
+	enum fake_fd_kind kind;
+	int gpu;         // FAKE_FD_DEVICE only
+	bool registered; // NV_ESC_REGISTER_FD done
+	struct fake_event_queue* queue; // FAKE_FD_CTL after NV_ESC_ALLOC_OS_EVENT
+};
+
+struct fake_object
+{
+	bool used;
+	NvHandle hClient;
+	NvHandle handle;
+	NvHandle parent;
+	NvU32 hClass;
+	int gpu;    // -1 for clients
+	int ctl_fd; // fd the client was allocated on
+	// NV01_EVENT_OS_EVENT only
+	int event_fd;
+	NvU32 notify_index;
+	bool armed; // EVENT_SET_NOTIFICATION enabled the notifier on the subdevice
+	NvU32 mig_id; // AMPERE_SMC_PARTITION_REF: GI ID, AMPERE_SMC_EXEC_PARTITION_REF: CI ID
+};
+
+struct fakerm
+{
+	struct rop_backend backend;
+	struct fakerm_config config;
+	pthread_mutex_t lock;
+	struct fake_fd fds[FAKERM_MAX_FDS];
+	struct fake_object objects[FAKERM_MAX_OBJECTS];
+	NvU32 next_handle;
+	unsigned busy_left[ROP_MAX_GPUS]; // NV_ERR_BUSY_RETRY answers still to give
+	pthread_mutex_t api_lock;             // modeled RM locks, see hold_lock
+	pthread_mutex_t gpu_locks[ROP_MAX_GPUS];
+	struct fakerm_stats stats;
+	pthread_t event_thread; // fires the spec's timed Xids
+	bool event_thread_started;
+	bool stopping;
+	pthread_cond_t stop_cond;
+};
+
+static void sleep_us(unsigned latency_us)
+{
+	if (latency_us == 0) {
+		return;
+	}
+	struct timespec ts = {
+		.tv_sec = latency_us / 1000000,
+		.tv_nsec = (long)(latency_us % 1000000) * 1000
+	};
+	while (nanosleep(&ts, &ts) == -1 && errno == EINTR) {
+	}
+}
+
+// Holds a modeled RM lock for hold_us. Unlike rm->lock, which only guards
+// the simulation's own state, these stand in for the RM API lock and the
+// per-GPU locks, so concurrent callers queue up behind each other the way they
+// would in the driver.
+static void hold_lock(struct fakerm* rm, pthread_mutex_t* lock, unsigned hold_us)
+{
+	if (hold_us == 0) {
+		return;
+	}
+	struct timespec start, acquired;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	pthread_mutex_lock(lock);
+	clock_gettime(CLOCK_MONOTONIC, &acquired);
+	uint64_t wait_ns = (uint64_t)(acquired.tv_sec - start.tv_sec) * 1000000000 + (uint64_t)acquired.tv_nsec - (uint64_t)start.tv_nsec;
+	__atomic_add_fetch(&rm->stats.lock_wait_ns, wait_ns, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&rm->stats.lock_holds, 1, __ATOMIC_RELAXED);
+	sleep_us(hold_us);
+	pthread_mutex_unlock(lock);
+}
+
+static struct fake_fd* lookup_fd(struct fakerm* rm, int fd)
+{
+	int slot = fd - FAKERM_FD_BASE;
+	if (slot < 0 || slot >= FAKERM_MAX_FDS || rm->fds[slot].kind == FAKE_FD_FREE) {
+		return NULL;
+	}
+	return &rm->fds[slot];
+}
+
+static struct fake_object* lookup_object(struct fakerm* rm, NvHandle hClient, NvHandle handle)
+{
+	for (int i = 0; i < FAKERM_MAX_OBJECTS; ++i) {
+		struct fake_object* object = &rm->objects[i];
+		if (object->used && object->hClient == hClient && object->handle == handle) {
+			return object;
+		}
+	}
+	return NULL;
+}
+
+// First object of `hClass` allocated directly under `parent`
+static struct fake_object* lookup_child(struct fakerm* rm, const struct fake_object* parent, NvU32 hClass)
+{
+	for (int i = 0; i < FAKERM_MAX_OBJECTS; ++i) {
+		struct fake_object* object = &rm->objects[i];
+		if (object->used && object->hClient == parent->hClient && object->parent == parent->handle && object->hClass == hClass) {
+			return object;
+		}
+	}
+	return NULL;
+}
+
+// The GI reference of the client, which RM lets subscribe to one GI only
+static struct fake_object* lookup_subscription(struct fakerm* rm, NvHandle hClient)
+{
+	for (int i = 0; i < FAKERM_MAX_OBJECTS; ++i) {
+		struct fake_object* object = &rm->objects[i];
+		if (object->used && object->hClient == hClient && object->hClass == AMPERE_SMC_PARTITION_REF) {
+			return object;
+		}
+	}
+	return NULL;
+}
+
+// Index of the GPU whose device node is /dev/nvidia<minor>, -1 if none
+static int gpu_by_minor(const struct fakerm* rm, int minor)
+{
+	for (int i = 0; i < rm->config.gpu_count; ++i) {
+		if (rm->config.gpus[i].minor == minor && !rm->config.gpus[i].hidden) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+static NvU32 gpu_id(int gpu)
+{
+	return (NvU32)(gpu + 1) << 8;
+}
+
+static int gpu_by_id(const struct fakerm* rm, NvU32 gpuId)
+{
+	for (int i = 0; i < rm->config.gpu_count; ++i) {
+		if (gpu_id(i) == gpuId) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+static bool gpu_attached(struct fakerm* rm, int gpu)
+{
+	for (int i = 0; i < FAKERM_MAX_FDS; ++i) {
+		if (rm->fds[i].kind == FAKE_FD_DEVICE && rm->fds[i].gpu == gpu && rm->fds[i].registered) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// Uses up one of the GPU's injected NV_ERR_BUSY_RETRY answers, if any are left
+static bool gpu_busy(struct fakerm* rm, int gpu)
+{
+	if (rm->busy_left[gpu] == 0) {
+		return false;
+	}
+	rm->busy_left[gpu]--;
+	return true;
+}
+
+static struct fake_object* new_object(struct fakerm* rm, NvHandle hClient, NvHandle handle, NvHandle parent, NvU32 hClass, int gpu)
+{
+	for (int i = 0; i < FAKERM_MAX_OBJECTS; ++i) {
+		struct fake_object* object = &rm->objects[i];
+		if (!object->used) {
+			if (handle == 0) {
+				handle = (hClass == NV01_ROOT ? FAKERM_CLIENT_HANDLE_BASE : FAKERM_OBJECT_HANDLE_BASE) + rm->next_handle++;
+			}
+			*object = (struct fake_object) {
+				.used = true,
+				.hClient = hClass == NV01_ROOT ? handle : hClient,
+				.handle = handle,
+				.parent = parent,
+				.hClass = hClass,
+				.gpu = gpu,
+				.ctl_fd = -1
+			};
+			rm->stats.live_objects++;
+			return object;
+		}
+	}
+	return NULL;
+}
+
+// Frees an object and, like RM, everything allocated beneath it
+static void free_object(struct fakerm* rm, struct fake_object* object)
+{
+	NvHandle hClient = object->hClient;
+	NvHandle handle = object->handle;
+	object->used = false;
+	rm->stats.live_objects--;
+	for (int i = 0; i < FAKERM_MAX_OBJECTS; ++i) {
+		struct fake_object* child = &rm->objects[i];
+		if (child->used && child->hClient == hClient && child->parent == handle) {
+			free_object(rm, child);
+		}
+	}
+}
+
+static NvV32 fake_alloc_client(struct fakerm* rm, int ctl_fd, NVOS21_PARAMETERS* request)
+{
+	if (request->hClass != NV01_ROOT) {
+		return NV_ERR_INVALID_CLASS;
+	}
+	if (request->hObjectNew != 0 && lookup_object(rm, request->hObjectNew, request->hObjectNew) != NULL) {
+		return NV_ERR_INVALID_OBJECT_HANDLE;
+	}
+	struct fake_object* client = new_object(rm, 0, request->hObjectNew, 0, NV01_ROOT, -1);
+	if (client == NULL) {
+		return NV_ERR_INSUFFICIENT_RESOURCES;
+	}
+	client->ctl_fd = ctl_fd;
+	request->hObjectNew = client->handle;
+	return NV_OK;
+}
+
+static NvV32 fake_alloc(struct fakerm* rm, NVOS64_PARAMETERS* request, int* gpu)
+{
+	struct fake_object* parent = lookup_object(rm, request->hRoot, request->hObjectParent);
+	if (lookup_object(rm, request->hRoot, request->hRoot) == NULL) {
+		return NV_ERR_INVALID_CLIENT;
+	}
+	if (parent == NULL) {
+		return NV_ERR_INVALID_OBJECT_PARENT;
+	}
+	if (request->hObjectNew != 0 && lookup_object(rm, request->hRoot, request->hObjectNew) != NULL) {
+		return NV_ERR_INVALID_OBJECT_HANDLE;
+	}
+
+	switch (request->hClass) {
+	case NV01_EVENT_OS_EVENT: {
+		const NV0005_ALLOC_PARAMETERS* params = request->pAllocParms;
+		if (parent->hClass != NV20_SUBDEVICE_0) {
+			return NV_ERR_INVALID_OBJECT_PARENT;
+		}
+		if (params == NULL || request->paramsSize != sizeof(*params) || params->hSrcResource != parent->handle) {
+			return NV_ERR_INVALID_ARGUMENT;
+		}
+		struct fake_fd* event_file = lookup_fd(rm, (int)(uintptr_t)params->data);
+		if (event_file == NULL || event_file->queue == NULL) {
+			return NV_ERR_INVALID_ARGUMENT;
+		}
+		*gpu = parent->gpu;
+		break;
+	}
+	case AMPERE_SMC_PARTITION_REF: {
+		const NVC637_ALLOCATION_PARAMETERS* params = request->pAllocParms;
+		if (parent->hClass != NV20_SUBDEVICE_0) {
+			return NV_ERR_INVALID_OBJECT_PARENT;
+		}
+		if (params == NULL || request->paramsSize != sizeof(*params)) {
+			return NV_ERR_INVALID_ARGUMENT;
+		}
+		if (params->swizzId == 0 || params->swizzId > rm->config.gpus[parent->gpu].mig) {
+			return NV_ERR_OBJECT_NOT_FOUND;
+		}
+		if (lookup_subscription(rm, request->hRoot) != NULL) {
+			return NV_ERR_INVALID_STATE;
+		}
+		*gpu = parent->gpu;
+		break;
+	}
+	case AMPERE_SMC_EXEC_PARTITION_REF: {
+		const NVC638_ALLOCATION_PARAMETERS* params = request->pAllocParms;
+		if (parent->hClass != AMPERE_SMC_PARTITION_REF) {
+			return NV_ERR_INVALID_OBJECT_PARENT;
+		}
+		if (params == NULL || request->paramsSize != sizeof(*params)) {
+			return NV_ERR_INVALID_ARGUMENT;
+		}
+		if (params->execPartitionId >= rm->config.gpus[parent->gpu].mig_ci) {
+			return NV_ERR_OBJECT_NOT_FOUND;
+		}
+		if (lookup_child(rm, parent, AMPERE_SMC_EXEC_PARTITION_REF) != NULL) {
+			return NV_ERR_INVALID_STATE;
+		}
+		*gpu = parent->gpu;
+		break;
+	}
+	case NV01_DEVICE_0: {
+		const NV0080_ALLOC_PARAMETERS* params = request->pAllocParms;
+		if (parent->hClass != NV01_ROOT || params == NULL || request->paramsSize != sizeof(*params)) {
+			return NV_ERR_INVALID_ARGUMENT;
+		}
+		if ((int)params->deviceId >= rm->config.gpu_count || !gpu_attached(rm, (int)params->deviceId)) {
+			return NV_ERR_INVALID_ARGUMENT;
+		}
+		*gpu = (int)params->deviceId;
+		break;
+	}
+	case NV20_SUBDEVICE_0: {
+		const NV2080_ALLOC_PARAMETERS* params = request->pAllocParms;
+		if (parent->hClass != NV01_DEVICE_0) {
+			return NV_ERR_INVALID_OBJECT_PARENT;
+		}
+		if (params == NULL || request->paramsSize != sizeof(*params) || params->subDeviceId != 0) {
+			return NV_ERR_INVALID_ARGUMENT;
+		}
+		*gpu = parent->gpu;
+		break;
+	}
+	default:
+		return NV_ERR_INVALID_CLASS;
+	}
+
+	if (rm->config.gpus[*gpu].lost) {
+		return NV_ERR_GPU_IS_LOST;
+	}
+	if (gpu_busy(rm, *gpu)) {
+		return NV_ERR_BUSY_RETRY;
+	}
+	struct fake_object* object = new_object(rm, request->hRoot, request->hObjectNew, request->hObjectParent, request->hClass, *gpu);
+	if (object == NULL) {
+		return NV_ERR_INSUFFICIENT_RESOURCES;
+	}
+	if (request->hClass == NV01_EVENT_OS_EVENT) {
+		const NV0005_ALLOC_PARAMETERS* params = request->pAllocParms;
+		object->event_fd = (int)(uintptr_t)params->data;
+		object->notify_index = params->notifyIndex;
+	}
+	else if (request->hClass == AMPERE_SMC_PARTITION_REF) {
+		object->mig_id = ((const NVC637_ALLOCATION_PARAMETERS*)request->pAllocParms)->swizzId;
+	}
+	else if (request->hClass == AMPERE_SMC_EXEC_PARTITION_REF) {
+		object->mig_id = ((const NVC638_ALLOCATION_PARAMETERS*)request->pAllocParms)->execPartitionId;
+	}
+	request->hObjectNew = object->handle;
+	return NV_OK;
+}
+
+// Marketing names of the parts the fake can pose as, by PCI device ID
+static const char* fake_gpu_name(NvU16 pci_device)
+{
+	switch (pci_device) {
+	case 0x2b85:
+		return "NVIDIA GeForce RTX 5090";
+	case 0x2c02:
+		return "NVIDIA GeForce RTX 5080";
+	case 0x2c05:
+		return "NVIDIA GeForce RTX 5070 Ti";
+	case 0x2f04:
+		return "NVIDIA GeForce RTX 5070";
+	default:
+		return "NVIDIA Graphics Device";
+	}
+}
+
+static NvU32 scale(NvU32 value, NvU32 numerator, NvU32 denominator)
+{
+	return denominator != 0 ? (NvU32)((uint64_t)value * numerator / denominator) : value;
+}
+
+// GPCs configured for each GI, an even share of the GPU's, and for each CI
+// within a GI of `gpcs`
+static NvU32 mig_share(const struct fakerm_gpu* gpu)
+{
+	NvU32 share = gpu->mig != 0 ? gpu->gpcs / gpu->mig : gpu->gpcs;
+	return share > 0 ? share : 1;
+}
+
+static NvU32 mig_compute_share(const struct fakerm_gpu* gpu, NvU32 gpcs)
+{
+	NvU32 share = gpu->mig_ci != 0 ? gpcs / gpu->mig_ci : gpcs;
+	return share > 0 ? share : 1;
+}
+
+// The GPU as a client sees it over `subdevice`: whole unless the client is
+// subscribed to a GI, then GR units and ROPs are the GI's, or the CI's when
+// it is subscribed to one inside the GI
+static struct fakerm_gpu scoped_gpu(struct fakerm* rm, const struct fake_object* subdevice)
+{
+	const struct fakerm_gpu* gpu = &rm->config.gpus[subdevice->gpu];
+	struct fakerm_gpu scoped = *gpu;
+	const struct fake_object* instance = lookup_child(rm, subdevice, AMPERE_SMC_PARTITION_REF);
+	if (instance == NULL) {
+		return scoped;
+	}
+	const struct fakerm_mig_instance* overrides = &gpu->mig_instances[instance->mig_id - 1];
+	NvU32 share = mig_share(gpu);
+	NvU32 gpcs = overrides->gpcs != 0 ? overrides->gpcs : share;
+	NvU32 units = overrides->units != 0 ? overrides->units : scale(gpu->rop.ropUnitCount, gpcs, gpu->gpcs);
+	if (lookup_child(rm, instance, AMPERE_SMC_EXEC_PARTITION_REF) != NULL) {
+		NvU32 compute_gpcs = mig_compute_share(gpu, gpcs);
+		units = scale(units, compute_gpcs, gpcs);
+		gpcs = compute_gpcs;
+	}
+	scoped.gpcs = gpcs;
+	scoped.tpcs = scale(gpu->tpcs, gpcs, gpu->gpcs);
+	scoped.cores = scale(gpu->cores, gpcs, gpu->gpcs);
+	scoped.zcull_banks = scale(gpu->zcull_banks, gpcs, gpu->gpcs);
+	scoped.fbps = scale(gpu->fbps, share, gpu->gpcs); // memory slices belong to the whole GI
+	scoped.rop.ropUnitCount = units;
+	scoped.rop.ropOperationsCount = units * gpu->rop.ropOperationsFactor;
+	return scoped;
+}
+
+static NvV32 fake_get_partitions(struct fakerm* rm, const struct fake_object* subdevice, NV2080_CTRL_GPU_GET_PARTITIONS_PARAMS* params)
+{
+	const struct fakerm_gpu* gpu = &rm->config.gpus[subdevice->gpu];
+	if (gpu->mig == 0) {
+		return NV_ERR_NOT_SUPPORTED;
+	}
+	// Without bGetAllPartitionInfo only the client's own GI is listed
+	const struct fake_object* subscription = lookup_subscription(rm, subdevice->hClient);
+	NvU32 share = mig_share(gpu);
+	NvU32 count = 0;
+	memset(params->queryPartitionInfo, 0, sizeof(params->queryPartitionInfo));
+	for (NvU32 id = 1; id <= gpu->mig && id <= NV2080_CTRL_GPU_MAX_PARTITIONS; ++id) {
+		if (!params->bGetAllPartitionInfo && (subscription == NULL || subscription->mig_id != id)) {
+			continue;
+		}
+		NV2080_CTRL_GPU_GET_PARTITION_INFO* info = &params->queryPartitionInfo[count++];
+		info->swizzId = id;
+		info->grEngCount = gpu->mig_ci;
+		info->gpcCount = share;
+		info->smCount = scale(gpu->tpcs, share, gpu->gpcs) * gpu->sm_per_tpc;
+		info->bValid = 1;
+	}
+	params->validPartitionCount = count;
+	return NV_OK;
+}
+
+static NvV32 fake_get_exec_partitions(struct fakerm* rm, const struct fake_object* instance, NVC637_CTRL_EXEC_PARTITIONS_GET_PARAMS* params)
+{
+	const struct fakerm_gpu* gpu = &rm->config.gpus[instance->gpu];
+	NvU32 gpcs = mig_compute_share(gpu, mig_share(gpu));
+	memset(params, 0, sizeof(*params));
+	for (NvU32 id = 0; id < gpu->mig_ci && id < NVC637_CTRL_MAX_EXEC_PARTITIONS; ++id) {
+		params->execPartId[params->execPartCount] = id;
+		params->execPartInfo[params->execPartCount].gpcCount = gpcs;
+		params->execPartInfo[params->execPartCount].smCount = scale(gpu->tpcs, gpcs, gpu->gpcs) * gpu->sm_per_tpc;
+		params->execPartCount++;
+	}
+	return NV_OK;
+}
+
+static NvV32 fake_gr_get_info(const struct fakerm_gpu* gpu, NV2080_CTRL_GR_GET_INFO_PARAMS* params)
+{
+	NV2080_CTRL_GR_INFO* infoList = params->grInfoList;
+	if (infoList == NULL && params->grInfoListSize != 0) {
+		return NV_ERR_INVALID_PARAM_STRUCT;
+	}
+	for (NvU32 i = 0; i < params->grInfoListSize; ++i) {
+		switch (infoList[i].index) {
+		case NV2080_CTRL_GR_INFO_INDEX_LITTER_NUM_GPCS:
+			infoList[i].data = gpu->gpcs;
+			break;
+		case NV2080_CTRL_GR_INFO_INDEX_SHADER_PIPE_COUNT:
+			infoList[i].data = gpu->tpcs;
+			break;
+		case NV2080_CTRL_GR_INFO_INDEX_LITTER_NUM_SM_PER_TPC:
+			infoList[i].data = gpu->sm_per_tpc;
+			break;
+		case NV2080_CTRL_GR_INFO_INDEX_GPU_CORE_COUNT:
+			infoList[i].data = gpu->cores;
+			break;
+		case NV2080_CTRL_GR_INFO_INDEX_LITTER_NUM_FBPS:
+			infoList[i].data = gpu->fbps;
+			break;
+		case NV2080_CTRL_GR_INFO_INDEX_LITTER_NUM_ZCULL_BANKS:
+			infoList[i].data = gpu->zcull_banks;
+			break;
+		default:
+			return NV_ERR_INVALID_ARGUMENT;
+		}
+	}
+	return NV_OK;
+}
+
+static NvV32 fake_control(struct fakerm* rm, NVOS54_PARAMETERS* request, int* gpu)
+{
+	if (lookup_object(rm, request->hClient, request->hClient) == NULL) {
+		return NV_ERR_INVALID_CLIENT;
+	}
+	struct fake_object* object = lookup_object(rm, request->hClient, request->hObject);
+	if (object == NULL) {
+		return NV_ERR_INVALID_OBJECT_HANDLE;
+	}
+	*gpu = object->gpu;
+	if (object->gpu >= 0 && rm->config.gpus[object->gpu].lost) {
+		return NV_ERR_GPU_IS_LOST;
+	}
+	if (object->gpu >= 0 && gpu_busy(rm, object->gpu)) {
+		return NV_ERR_BUSY_RETRY;
+	}
+
+	switch (request->cmd) {
+	case NV0000_CTRL_CMD_GPU_GET_PROBED_IDS: {
+		NV0000_CTRL_GPU_GET_PROBED_IDS_PARAMS* params = request->params;
+		if (object->hClass != NV01_ROOT) {
+			return NV_ERR_NOT_SUPPORTED;
+		}
+		if (params == NULL || request->paramsSize != sizeof(*params)) {
+			return NV_ERR_INVALID_PARAM_STRUCT;
+		}
+		for (int i = 0; i < NV0000_CTRL_GPU_MAX_PROBED_GPUS; ++i) {
+			params->gpuIds[i] = i < rm->config.gpu_count ? gpu_id(i) : NV0000_CTRL_GPU_INVALID_ID;
+			params->excludedGpuIds[i] = NV0000_CTRL_GPU_INVALID_ID;
+		}
+		return NV_OK;
+	}
+	case NV0000_CTRL_CMD_GPU_GET_ID_INFO_V2: {
+		NV0000_CTRL_GPU_GET_ID_INFO_V2_PARAMS* params = request->params;
+		if (object->hClass != NV01_ROOT) {
+			return NV_ERR_NOT_SUPPORTED;
+		}
+		if (params == NULL || request->paramsSize != sizeof(*params)) {
+			return NV_ERR_INVALID_PARAM_STRUCT;
+		}
+		// Like RM, only attached GPUs have a device instance
+		int index = gpu_by_id(rm, params->gpuId);
+		if (index < 0 || !gpu_attached(rm, index)) {
+			return NV_ERR_INVALID_ARGUMENT;
+		}
+		*gpu = index;
+		params->deviceInstance = (NvU32)index;
+		params->subDeviceInstance = 0;
+		params->gpuInstance = (NvU32)index;
+		params->numaId = -1;
+		return NV_OK;
+	}
+	case NV0000_CTRL_CMD_GPU_GET_UUID_FROM_GPU_ID: {
+		NV0000_CTRL_GPU_GET_UUID_FROM_GPU_ID_PARAMS* params = request->params;
+		if (object->hClass != NV01_ROOT) {
+			return NV_ERR_NOT_SUPPORTED;
+		}
+		if (params == NULL || request->paramsSize != sizeof(*params) ||
+		    params->flags != NV0000_CTRL_CMD_GPU_GET_UUID_FROM_GPU_ID_FLAGS_FORMAT_ASCII) {
+			return NV_ERR_INVALID_PARAM_STRUCT;
+		}
+		int index = gpu_by_id(rm, params->gpuId);
+		if (index < 0) {
+			return NV_ERR_INVALID_ARGUMENT;
+		}
+		memset(params->gpuUuid, 0, sizeof(params->gpuUuid));
+		int length = snprintf((char*)params->gpuUuid, sizeof(params->gpuUuid), FAKERM_UUID_FORMAT, index);
+		params->uuidStrLen = (NvU32)length;
+		return NV_OK;
+	}
+	case CMD_SUBDEVICE_CTRL_GR_GET_ROP_INFO: {
+		if (object->hClass != NV20_SUBDEVICE_0) {
+			return NV_ERR_NOT_SUPPORTED;
+		}
+		if (request->params == NULL || request->paramsSize != sizeof(NV2080_CTRL_GR_GET_ROP_INFO_PARAMS)) {
+			return NV_ERR_INVALID_PARAM_STRUCT;
+		}
+		struct fakerm_gpu scoped = scoped_gpu(rm, object);
+		memcpy(request->params, &scoped.rop, sizeof(NV2080_CTRL_GR_GET_ROP_INFO_PARAMS));
+		return NV_OK;
+	}
+	case NV2080_CTRL_CMD_GPU_GET_PARTITIONS:
+		if (object->hClass != NV20_SUBDEVICE_0) {
+			return NV_ERR_NOT_SUPPORTED;
+		}
+		if (request->params == NULL || request->paramsSize != sizeof(NV2080_CTRL_GPU_GET_PARTITIONS_PARAMS)) {
+			return NV_ERR_INVALID_PARAM_STRUCT;
+		}
+		return fake_get_partitions(rm, object, request->params);
+	case NVC637_CTRL_CMD_EXEC_PARTITIONS_GET:
+		if (object->hClass != AMPERE_SMC_PARTITION_REF) {
+			return NV_ERR_NOT_SUPPORTED;
+		}
+		if (request->params == NULL || request->paramsSize != sizeof(NVC637_CTRL_EXEC_PARTITIONS_GET_PARAMS)) {
+			return NV_ERR_INVALID_PARAM_STRUCT;
+		}
+		return fake_get_exec_partitions(rm, object, request->params);
+	case NV2080_CTRL_CMD_GPU_GET_NAME_STRING: {
+		NV2080_CTRL_GPU_GET_NAME_STRING_PARAMS* params = request->params;
+		if (object->hClass != NV20_SUBDEVICE_0) {
+			return NV_ERR_NOT_SUPPORTED;
+		}
+		if (params == NULL || request->paramsSize != sizeof(*params) ||
+		    params->gpuNameStringFlags != NV2080_CTRL_GPU_GET_NAME_STRING_FLAGS_TYPE_ASCII) {
+			return NV_ERR_INVALID_PARAM_STRUCT;
+		}
+		memset(&params->gpuNameString, 0, sizeof(params->gpuNameString));
+		strncpy((char*)params->gpuNameString.ascii, fake_gpu_name(rm->config.gpus[object->gpu].pci_device),
+		        sizeof(params->gpuNameString.ascii) - 1);
+		return NV_OK;
+	}
+	case NV2080_CTRL_CMD_BUS_GET_PCI_INFO: {
+		NV2080_CTRL_BUS_GET_PCI_INFO_PARAMS* params = request->params;
+		if (object->hClass != NV20_SUBDEVICE_0) {
+			return NV_ERR_NOT_SUPPORTED;
+		}
+		if (params == NULL || request->paramsSize != sizeof(*params)) {
+			return NV_ERR_INVALID_PARAM_STRUCT;
+		}
+		memset(params, 0, sizeof(*params));
+		params->pciDeviceId = (NvU32)rm->config.gpus[object->gpu].pci_device << 16 | 0x10de;
+		params->pciSubSystemId = rm->config.gpus[object->gpu].subsystem;
+		return NV_OK;
+	}
+	case NV2080_CTRL_CMD_EVENT_SET_NOTIFICATION: {
+		const NV2080_CTRL_EVENT_SET_NOTIFICATION_PARAMS* params = request->params;
+		if (object->hClass != NV20_SUBDEVICE_0) {
+			return NV_ERR_NOT_SUPPORTED;
+		}
+		if (params == NULL || request->paramsSize != sizeof(*params)) {
+			return NV_ERR_INVALID_PARAM_STRUCT;
+		}
+		for (int i = 0; i < FAKERM_MAX_OBJECTS; ++i) {
+			struct fake_object* event = &rm->objects[i];
+			if (event->used && event->hClass == NV01_EVENT_OS_EVENT && event->hClient == object->hClient &&
+			    event->parent == object->handle && event->notify_index == params->event) {
+				event->armed = params->action != NV2080_CTRL_EVENT_SET_NOTIFICATION_ACTION_DISABLE;
+			}
+		}
+		return NV_OK;
+	}
+	case NV2080_CTRL_CMD_GR_GET_INFO: {
+		if (object->hClass != NV20_SUBDEVICE_0) {
+			return NV_ERR_NOT_SUPPORTED;
+		}
+		if (request->params == NULL || request->paramsSize != sizeof(NV2080_CTRL_GR_GET_INFO_PARAMS)) {
+			return NV_ERR_INVALID_PARAM_STRUCT;
+		}
+		struct fakerm_gpu scoped = scoped_gpu(rm, object);
+		return fake_gr_get_info(&scoped, request->params);
+	}
+	default:
+		return NV_ERR_NOT_SUPPORTED;
+	}
+}
+
+static NvV32 fake_free(struct fakerm* rm, NVOS00_PARAMETERS* request, int* gpu)
+{
+	if (lookup_object(rm, request->hRoot, request->hRoot) == NULL) {
+		return NV_ERR_INVALID_CLIENT;
+	}
+	struct fake_object* object = lookup_object(rm, request->hRoot, request->hObjectOld);
+	if (object == NULL) {
+		return NV_ERR_INVALID_OBJECT_HANDLE;
+	}
+	*gpu = object->gpu;
+	free_object(rm, object);
+	return NV_OK;
+}
+
+static int fake_open(void* ctx, const char* path, int flags)
+{
+	struct fakerm* rm = ctx;
+	enum fake_fd_kind kind;
+	int gpu = -1;
+	char trailing;
+	(void)flags;
+
+	if (strcmp(path, "/dev/nvidiactl") == 0) {
+		kind = FAKE_FD_CTL;
+	}
+	else if (sscanf(path, "/dev/nvidia%d%c", &gpu, &trailing) == 1 && (gpu = gpu_by_minor(rm, gpu)) >= 0) {
+		kind = FAKE_FD_DEVICE;
+	}
+	else {
+		errno = ENOENT;
+		return -1;
+	}
+
+	pthread_mutex_lock(&rm->lock);
+	rm->stats.opens++;
+	for (int i = 0; i < FAKERM_MAX_FDS; ++i) {
+		if (rm->fds[i].kind == FAKE_FD_FREE) {
+			rm->fds[i] = (struct fake_fd) { .kind = kind, .gpu = gpu, .registered = false };
+			pthread_mutex_unlock(&rm->lock);
+			if (gpu >= 0) {
+				sleep_us(rm->config.gpus[gpu].latency_us);
+			}
+			return FAKERM_FD_BASE + i;
+		}
+	}
+	pthread_mutex_unlock(&rm->lock);
+	errno = EMFILE;
+	return -1;
+}
+
+static int fake_close(void* ctx, int fd)
+{
+	struct fakerm* rm = ctx;
+	pthread_mutex_lock(&rm->lock);
+	struct fake_fd* file = lookup_fd(rm, fd);
+	if (file == NULL) {
+		pthread_mutex_unlock(&rm->lock);
+		errno = EBADF;
+		return -1;
+	}
+	if (file->queue != NULL) {
+		close(file->queue->poll_fd);
+		free(file->queue);
+		file->queue = NULL;
+	}
+	if (file->kind == FAKE_FD_CTL) {
+		// Closing the control fd tears down the clients allocated through it
+		for (int i = 0; i < FAKERM_MAX_OBJECTS; ++i) {
+			struct fake_object* object = &rm->objects[i];
+			if (object->used && object->hClass == NV01_ROOT && object->ctl_fd == fd) {
+				free_object(rm, object);
+			}
+		}
+	}
+	file->kind = FAKE_FD_FREE;
+	pthread_mutex_unlock(&rm->lock);
+	return 0;
+}
+
+static NvV32 fake_alloc_os_event(struct fakerm* rm, struct fake_fd* file, const nv_ioctl_alloc_os_event_t* params)
+{
+	if (lookup_object(rm, params->hClient, params->hClient) == NULL) {
+		return NV_ERR_INVALID_CLIENT;
+	}
+	if (file->queue != NULL) {
+		return NV_OK;
+	}
+	file->queue = calloc(1, sizeof(*file->queue));
+	if (file->queue == NULL) {
+		return NV_ERR_INSUFFICIENT_RESOURCES;
+	}
+	file->queue->poll_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (file->queue->poll_fd == -1) {
+		free(file->queue);
+		file->queue = NULL;
+		return NV_ERR_INSUFFICIENT_RESOURCES;
+	}
+	return NV_OK;
+}
+
+static NvV32 fake_free_os_event(struct fake_fd* file, const nv_ioctl_alloc_os_event_t* params)
+{
+	(void)params;
+	if (file->queue == NULL) {
+		return NV_ERR_INVALID_ARGUMENT;
+	}
+	close(file->queue->poll_fd);
+	free(file->queue);
+	file->queue = NULL;
+	return NV_OK;
+}
+
+static NvV32 fake_get_event_data(struct fake_fd* file, NVOS41_PARAMETERS* params)
+{
+	struct fake_event_queue* queue = file->queue;
+	params->MoreEvents = 0;
+	if (queue == NULL || params->pEvent == NULL) {
+		return NV_ERR_INVALID_ARGUMENT;
+	}
+	if (queue->count == 0) {
+		return NV_ERR_GENERIC;
+	}
+	memcpy(params->pEvent, &queue->events[queue->head], sizeof(NvUnixEvent));
+	queue->head = (queue->head + 1) % FAKERM_EVENT_QUEUE;
+	queue->count--;
+	params->MoreEvents = queue->count > 0;
+	if (queue->count == 0) {
+		uint64_t value;
+		if (read(queue->poll_fd, &value, sizeof(value)) != sizeof(value)) {
+			// Nothing was pending, readiness already matches the queue
+		}
+	}
+	return NV_OK;
+}
+
+// Queues the event on every armed event object of `gpu` for the notifier,
+// like RM's notification fan-out; called with rm->lock held
+static void fire_event(struct fakerm* rm, int gpu, NvU32 notify_index, NvU32 info32)
+{
+	if (notify_index == NV2080_NOTIFIERS_RC_ERROR && info32 == ROBUST_CHANNEL_GPU_HAS_FALLEN_OFF_THE_BUS) {
+		rm->config.gpus[gpu].lost = true;
+	}
+	for (int i = 0; i < FAKERM_MAX_OBJECTS; ++i) {
+		const struct fake_object* event = &rm->objects[i];
+		if (!event->used || event->hClass != NV01_EVENT_OS_EVENT || event->gpu != gpu ||
+		    event->notify_index != notify_index || !event->armed) {
+			continue;
+		}
+		struct fake_fd* file = lookup_fd(rm, event->event_fd);
+		struct fake_event_queue* queue = file != NULL ? file->queue : NULL;
+		if (queue == NULL || queue->count == FAKERM_EVENT_QUEUE) {
+			continue; // RM drops events on a full queue too
+		}
+		queue->events[(queue->head + queue->count) % FAKERM_EVENT_QUEUE] = (NvUnixEvent) {
+			.hObject = event->handle,
+			.NotifyIndex = notify_index,
+			.info32 = info32,
+			.info16 = 0
+		};
+		queue->count++;
+		uint64_t one = 1;
+		if (write(queue->poll_fd, &one, sizeof(one)) != sizeof(one)) {
+			perror("fakerm: failed to signal an event");
+		}
+	}
+}
+
+static int fake_ioctl(void* ctx, int fd, unsigned long request, void* arg)
+{
+	struct fakerm* rm = ctx;
+	int escape = _IOC_NR(request);
+	size_t size = _IOC_SIZE(request);
+	int gpu = -1;
+	int ret = 0;
+	int error = 0;
+
+	pthread_mutex_lock(&rm->lock);
+	rm->stats.ioctls++;
+	struct fake_fd* file = lookup_fd(rm, fd);
+	if (file == NULL || arg == NULL) {
+		error = file == NULL ? EBADF : EFAULT;
+	}
+	else if (_IOC_TYPE(request) != NV_IOCTL_MAGIC) {
+		error = ENOTTY;
+	}
+	else if (escape == NV_ESC_REGISTER_FD) {
+		struct fake_fd* ctl = size == sizeof(int) ? lookup_fd(rm, *(int*)arg) : NULL;
+		if (file->kind != FAKE_FD_DEVICE || ctl == NULL || ctl->kind != FAKE_FD_CTL) {
+			error = EINVAL;
+		}
+		else {
+			file->registered = true;
+			gpu = file->gpu;
+		}
+	}
+	else if (file->kind != FAKE_FD_CTL) {
+		error = EINVAL;
+	}
+	else if (escape == NV_ESC_CARD_INFO && size % sizeof(nv_ioctl_card_info_t) == 0) {
+		nv_ioctl_card_info_t* cards = arg;
+		memset(cards, 0, size);
+		for (int i = 0; i < rm->config.gpu_count && (size_t)i < size / sizeof(*cards); ++i) {
+			cards[i].valid = 1;
+			cards[i].pci_info.bus = (NvU8)(i + 1);
+			cards[i].pci_info.vendor_id = 0x10de;
+			cards[i].pci_info.device_id = rm->config.gpus[i].pci_device;
+			cards[i].gpu_id = gpu_id(i);
+			cards[i].minor_number = (NvU32)rm->config.gpus[i].minor;
+		}
+	}
+	else if ((escape == NV_ESC_ALLOC_OS_EVENT || escape == NV_ESC_FREE_OS_EVENT) && size == sizeof(nv_ioctl_alloc_os_event_t)) {
+		nv_ioctl_alloc_os_event_t* params = arg;
+		params->Status = escape == NV_ESC_ALLOC_OS_EVENT ? fake_alloc_os_event(rm, file, params) : fake_free_os_event(file, params);
+	}
+	else if (escape == NV_ESC_RM_GET_EVENT_DATA && size == sizeof(NVOS41_PARAMETERS)) {
+		NVOS41_PARAMETERS* params = arg;
+		params->status = fake_get_event_data(file, params);
+	}
+	else if (escape == NV_ESC_RM_ALLOC && size == sizeof(NVOS21_PARAMETERS)) {
+		NVOS21_PARAMETERS* params = arg;
+		params->status = fake_alloc_client(rm, fd, params);
+	}
+	else if (escape == NV_ESC_RM_ALLOC && size == sizeof(NVOS64_PARAMETERS)) {
+		NVOS64_PARAMETERS* params = arg;
+		params->status = fake_alloc(rm, params, &gpu);
+	}
+	else if (escape == NV_ESC_RM_CONTROL && size == sizeof(NVOS54_PARAMETERS)) {
+		NVOS54_PARAMETERS* params = arg;
+		params->status = fake_control(rm, params, &gpu);
+	}
+	else if (escape == NV_ESC_RM_FREE && size == sizeof(NVOS00_PARAMETERS)) {
+		NVOS00_PARAMETERS* params = arg;
+		params->status = fake_free(rm, params, &gpu);
+	}
+	else {
+		error = EINVAL;
+	}
+	pthread_mutex_unlock(&rm->lock);
+
+	if (error == 0 && (escape == NV_ESC_RM_ALLOC || escape == NV_ESC_RM_CONTROL || escape == NV_ESC_RM_FREE)) {
+		hold_lock(rm, &rm->api_lock, rm->config.lock_us);
+		if (gpu >= 0) {
+			hold_lock(rm, &rm->gpu_locks[gpu], rm->config.gpus[gpu].gpu_lock_us);
+		}
+	}
+	sleep_us(rm->config.latency_us + (gpu >= 0 ? rm->config.gpus[gpu].latency_us : 0));
+	if (error != 0) {
+		errno = error;
+		ret = -1;
+	}
+	return ret;
+}
+
+static int fake_poll_fd(void* ctx, int fd)
+{
+	struct fakerm* rm = ctx;
+	pthread_mutex_lock(&rm->lock);
+	struct fake_fd* file = lookup_fd(rm, fd);
+	int poll_fd = file != NULL && file->queue != NULL ? file->queue->poll_fd : -1;
+	pthread_mutex_unlock(&rm->lock);
+	if (poll_fd == -1) {
+		errno = EBADF;
+	}
+	return poll_fd;
+}
+
+static int fake_access(void* ctx, const char* path, int mode)
+{
+	struct fakerm* rm = ctx;
+	int minor;
+	char trailing;
+	(void)mode;
+
+	if (strcmp(path, "/dev/nvidiactl") == 0 ||
+	    (sscanf(path, "/dev/nvidia%d%c", &minor, &trailing) == 1 && gpu_by_minor(rm, minor) >= 0)) {
+		return 0;
+	}
+	errno = ENOENT;
+	return -1;
+}
+
+void fakerm_default_config(struct fakerm_config* config)
+{
+	memset(config, 0, sizeof(*config));
+	config->gpu_count = 1;
+	for (int i = 0; i < ROP_MAX_GPUS; ++i) {
+		config->gpus[i].rop.ropUnitCount = 12;
+		config->gpus[i].rop.ropOperationsFactor = 8;
+		config->gpus[i].gpcs = 6;
+		config->gpus[i].tpcs = 35;
+		config->gpus[i].sm_per_tpc = 2;
+		config->gpus[i].cores = 8960;
+		config->gpus[i].fbps = 8;
+		config->gpus[i].zcull_banks = 4;
+		config->gpus[i].minor = i;
+		config->gpus[i].pci_device = 0x2c05;
+		config->gpus[i].mig_ci = 1;
+	}
+}
+
+static bool parse_gpu_key(const char* key, unsigned long value, struct fakerm_gpu* gpu)
+{
+	unsigned instance_id;
+	int key_offset = 0;
+
+	if (sscanf(key, "gi%u.%n", &instance_id, &key_offset) == 1 && key_offset > 0) {
+		if (instance_id == 0 || instance_id > FAKERM_MAX_MIG_INSTANCES) {
+			return false;
+		}
+		struct fakerm_mig_instance* instance = &gpu->mig_instances[instance_id - 1];
+		if (strcmp(key + key_offset, "gpcs") == 0) {
+			instance->gpcs = (NvU32)value;
+		}
+		else if (strcmp(key + key_offset, "units") == 0) {
+			instance->units = (NvU32)value;
+		}
+		else {
+			return false;
+		}
+	}
+	else if (strcmp(key, "units") == 0) {
+		gpu->rop.ropUnitCount = (NvU32)value;
+	}
+	else if (strcmp(key, "factor") == 0) {
+		gpu->rop.ropOperationsFactor = (NvU32)value;
+	}
+	else if (strcmp(key, "gpcs") == 0) {
+		gpu->gpcs = (NvU32)value;
+	}
+	else if (strcmp(key, "tpcs") == 0) {
+		gpu->tpcs = (NvU32)value;
+	}
+	else if (strcmp(key, "sm_per_tpc") == 0) {
+		gpu->sm_per_tpc = (NvU32)value;
+	}
+	else if (strcmp(key, "cores") == 0) {
+		gpu->cores = (NvU32)value;
+	}
+	else if (strcmp(key, "fbps") == 0) {
+		gpu->fbps = (NvU32)value;
+	}
+	else if (strcmp(key, "zcull_banks") == 0) {
+		gpu->zcull_banks = (NvU32)value;
+	}
+	else if (strcmp(key, "latency_us") == 0) {
+		gpu->latency_us = (unsigned)value;
+	}
+	else if (strcmp(key, "lost") == 0) {
+		gpu->lost = value != 0;
+	}
+	else if (strcmp(key, "gpu_lock_us") == 0) {
+		gpu->gpu_lock_us = (unsigned)value;
+	}
+	else if (strcmp(key, "busy") == 0) {
+		gpu->busy = (unsigned)value;
+	}
+	else if (strcmp(key, "hidden") == 0) {
+		gpu->hidden = value != 0;
+	}
+	else if (strcmp(key, "minor") == 0) {
+		gpu->minor = (int)value;
+	}
+	else if (strcmp(key, "pci_device") == 0) {
+		gpu->pci_device = (NvU16)value;
+	}
+	else if (strcmp(key, "subsystem") == 0) {
+		gpu->subsystem = (NvU32)value;
+	}
+	else if (strcmp(key, "xid") == 0) {
+		gpu->xid = (NvU32)value;
+	}
+	else if (strcmp(key, "xid_ms") == 0) {
+		gpu->xid_ms = (unsigned)value;
+	}
+	else if (strcmp(key, "mig") == 0 && value <= FAKERM_MAX_MIG_INSTANCES) {
+		gpu->mig = (unsigned)value;
+	}
+	else if (strcmp(key, "mig_ci") == 0 && value >= 1 && value <= NVC637_CTRL_MAX_EXEC_PARTITIONS) {
+		gpu->mig_ci = (unsigned)value;
+	}
+	else {
+		return false;
+	}
+	return true;
+}
+
+bool fakerm_parse_spec(const char* spec, struct fakerm_config* config)
+{
+	char buffer[1024];
+	char* saveptr = NULL;
+
+	if (strlen(spec) >= sizeof(buffer)) {
+		fprintf(stderr, "fakerm: spec too long\n");
+		return false;
+	}
+
+	// Global keys first so that gpuI.* overrides win regardless of order
+	for (int pass = 0; pass < 2; ++pass) {
+		strcpy(buffer, spec);
+		for (char* item = strtok_r(buffer, ",", &saveptr); item != NULL; item = strtok_r(NULL, ",", &saveptr)) {
+			char* equals = strchr(item, '=');
+			char* end;
+			int gpu_index;
+			int key_offset = 0;
+
+			if (equals == NULL) {
+				fprintf(stderr, "fakerm: expected key=value, got '%s'\n", item);
+				return false;
+			}
+			*equals = '\0';
+			unsigned long value = strtoul(equals + 1, &end, 0);
+			if (*end != '\0') {
+				fprintf(stderr, "fakerm: invalid value for '%s'\n", item);
+				return false;
+			}
+
+			bool per_gpu = sscanf(item, "gpu%d.%n", &gpu_index, &key_offset) == 1 && key_offset > 0;
+			if (per_gpu != (pass == 1)) {
+				continue;
+			}
+			if (per_gpu) {
+				if (gpu_index < 0 || gpu_index >= ROP_MAX_GPUS || !parse_gpu_key(item + key_offset, value, &config->gpus[gpu_index])) {
+					fprintf(stderr, "fakerm: unknown key '%s'\n", item);
+					return false;
+				}
+			}
+			else if (strcmp(item, "gpus") == 0) {
+				if (value > ROP_MAX_GPUS) {
+					fprintf(stderr, "fakerm: at most %d GPUs\n", ROP_MAX_GPUS);
+					return false;
+				}
+				config->gpu_count = (int)value;
+			}
+			else if (strcmp(item, "latency_us") == 0) {
+				config->latency_us = (unsigned)value;
+			}
+			else if (strcmp(item, "lock_us") == 0) {
+				config->lock_us = (unsigned)value;
+			}
+			else {
+				for (int i = 0; i < ROP_MAX_GPUS; ++i) {
+					if (!parse_gpu_key(item, value, &config->gpus[i])) {
+						fprintf(stderr, "fakerm: unknown key '%s'\n", item);
+						return false;
+					}
+				}
+			}
+		}
+	}
+	return true;
+}
+
+static uint64_t elapsed_ms(const struct timespec* start)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	return (uint64_t)(now.tv_sec - start->tv_sec) * 1000 + (uint64_t)((now.tv_nsec - start->tv_nsec) / 1000000);
+}
+
+// Fires each GPU's spec Xid once, xid_ms after the fake was created
+static void* event_thread(void* arg)
+{
+	struct fakerm* rm = arg;
+	bool fired[ROP_MAX_GPUS] = { false };
+	struct timespec start;
+	clock_gettime(CLOCK_REALTIME, &start);
+
+	pthread_mutex_lock(&rm->lock);
+	while (!rm->stopping) {
+		unsigned next_ms = 0;
+		bool pending = false;
+		for (int i = 0; i < rm->config.gpu_count; ++i) {
+			const struct fakerm_gpu* gpu = &rm->config.gpus[i];
+			if (gpu->xid == 0 || fired[i]) {
+				continue;
+			}
+			if (elapsed_ms(&start) >= gpu->xid_ms) {
+				fire_event(rm, i, NV2080_NOTIFIERS_RC_ERROR, gpu->xid);
+				fired[i] = true;
+			}
+			else if (!pending || gpu->xid_ms < next_ms) {
+				next_ms = gpu->xid_ms;
+				pending = true;
+			}
+		}
+		if (!pending) {
+			break;
+		}
+		struct timespec deadline = {
+			.tv_sec = start.tv_sec + next_ms / 1000,
+			.tv_nsec = start.tv_nsec + (long)(next_ms % 1000) * 1000000
+		};
+		if (deadline.tv_nsec >= 1000000000) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000;
+		}
+		pthread_cond_timedwait(&rm->stop_cond, &rm->lock, &deadline);
+	}
+	pthread_mutex_unlock(&rm->lock);
+	return NULL;
+}
+
+void fakerm_fire_event(const struct rop_backend* backend, int gpu, NvU32 notify_index, NvU32 info32)
+{
+	struct fakerm* rm = backend->ctx;
+	pthread_mutex_lock(&rm->lock);
+	if (gpu >= 0 && gpu < rm->config.gpu_count) {
+		fire_event(rm, gpu, notify_index, info32);
+	}
+	pthread_mutex_unlock(&rm->lock);
+}
+
+const struct rop_backend* fakerm_create(const struct fakerm_config* config)
+{
+	struct fakerm* rm = calloc(1, sizeof(*rm));
+	if (rm == NULL) {
+		return NULL;
+	}
+	rm->config = *config;
+	for (int i = 0; i < ROP_MAX_GPUS; ++i) {
+		NV2080_CTRL_GR_GET_ROP_INFO_PARAMS* rop = &rm->config.gpus[i].rop;
+		rop->ropOperationsCount = rop->ropUnitCount * rop->ropOperationsFactor;
+		rm->busy_left[i] = rm->config.gpus[i].busy;
+	}
+	pthread_mutex_init(&rm->lock, NULL);
+	pthread_mutex_init(&rm->api_lock, NULL);
+	for (int i = 0; i < ROP_MAX_GPUS; ++i) {
+		pthread_mutex_init(&rm->gpu_locks[i], NULL);
+	}
+	rm->backend = (struct rop_backend) {
+		.name = "fake",
+		.open = fake_open,
+		.close = fake_close,
+		.ioctl = fake_ioctl,
+		.access = fake_access,
+		.poll_fd = fake_poll_fd,
+		.ctx = rm
+	};
+
+	pthread_cond_init(&rm->stop_cond, NULL);
+	for (int i = 0; i < rm->config.gpu_count && !rm->event_thread_started; ++i) {
+		if (rm->config.gpus[i].xid != 0) {
+			rm->event_thread_started = pthread_create(&rm->event_thread, NULL, event_thread, rm) == 0;
+		}
+	}
+	return &rm->backend;
+}
+
+const struct rop_backend* fakerm_create_from_spec(const char* spec)
+{
+	struct fakerm_config config;
+	fakerm_default_config(&config);
+	if (!fakerm_parse_spec(spec, &config)) {
+		return NULL;
+	}
+	return fakerm_create(&config);
+}
+
+void fakerm_destroy(const struct rop_backend* backend)
+{
+	struct fakerm* rm = backend->ctx;
+	if (rm->event_thread_started) {
+		pthread_mutex_lock(&rm->lock);
+		rm->stopping = true;
+		pthread_cond_signal(&rm->stop_cond);
+		pthread_mutex_unlock(&rm->lock);
+		pthread_join(rm->event_thread, NULL);
+	}
+	for (int i = 0; i < FAKERM_MAX_FDS; ++i) {
+		if (rm->fds[i].queue != NULL) {
+			close(rm->fds[i].queue->poll_fd);
+			free(rm->fds[i].queue);
+		}
+	}
+	pthread_cond_destroy(&rm->stop_cond);
+	pthread_mutex_destroy(&rm->lock);
+	pthread_mutex_destroy(&rm->api_lock);
+	for (int i = 0; i < ROP_MAX_GPUS; ++i) {
+		pthread_mutex_destroy(&rm->gpu_locks[i]);
+	}
+	free(rm);
+}
+
+void fakerm_get_stats(const struct rop_backend* backend, struct fakerm_stats* stats)
+{
+	struct fakerm* rm = backend->ctx;
+	pthread_mutex_lock(&rm->lock);
+	*stats = rm->stats;
+	pthread_mutex_unlock(&rm->lock);
+}
@@ -0,0 +1,122 @@
+#ifndef FAKERM_H
+#define FAKERM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "librop.h"
+
+// fakerm: an in-process simulation of the NVIDIA RM behind the rop_backend
+// interface, for running and benchmarking the probe on machines without a GPU.
+//
+// It models /dev/nvidiactl and /dev/nvidiaN file descriptors, NV_ESC_REGISTER_FD,
+// NV_ESC_CARD_INFO, the probed-ID and ID-info controls on the client, clients,
+// devices and subdevices with RM-assigned handles, parent/child freeing, and
+// canned GR_GET_ROP_INFO, GR_GET_INFO, GPU_GET_NAME_STRING and
+// BUS_GET_PCI_INFO answers for each virtual GPU, and RM events: OS event fds
+// (NV_ESC_ALLOC_OS_EVENT, readable through the backend's poll_fd), event
+// objects armed by EVENT_SET_NOTIFICATION and NV_ESC_RM_GET_EVENT_DATA, and
+// MIG partitions: GPU_GET_PARTITIONS, EXEC_PARTITIONS_GET, and GI and CI
+// references that scope a client's GR answers to the instance. Virtual GPU I sits at PCI bus I+1 with GPU ID (I+1)<<8,
+// device instance I and UUID GPU-fa4e0000-0000-4000-8000-00000000000I (I in
+// hex, FAKERM_UUID_FORMAT); the client answers UUIDs without attaching GPUs.
+//
+// Spec strings (ROP_FAKE_RM) are comma-separated key=value pairs:
+//   gpus=N             number of virtual GPUs (default 1)
+//   units=U,factor=F   ROP info of every GPU (default 12 and 8, count = U*F)
+//   latency_us=L       delay added to every ioctl
+//   lock_us=L          every RM alloc, control and free holds a global lock
+//                      (RM's API lock) for L, so concurrent calls serialize
+//   gpu_lock_us=L      the same for a per-GPU lock, taken after the API lock
+//                      by calls on a GPU (also per GPU as gpuI.gpu_lock_us)
+//   gpcs=,tpcs=,sm_per_tpc=,cores=,fbps=,zcull_banks=
+//                      GR_GET_INFO unit counts (default to a 5070 Ti-like part)
+//   gpuI.units=U       per-GPU overrides of the above, I is the device index
+//   gpuI.factor=F
+//   gpuI.latency_us=L  extra delay for calls that target GPU I, a large L
+//                      stands in for a hung GPU
+//   gpuI.lost=1        every RM call on GPU I fails with NV_ERR_GPU_IS_LOST
+//   gpuI.busy=N        the first N RM calls on GPU I fail with NV_ERR_BUSY_RETRY
+//   gpuI.minor=M       device node /dev/nvidiaM (default I)
+//   gpuI.hidden=1      RM knows GPU I but its device node is absent
+//   gpuI.pci_device=D  PCI device ID (default 0x2c05), also picks the name
+//   gpuI.subsystem=S   PCI subsystem ID, device << 16 | vendor (default 0)
+//   gpuI.xid=N         fire an RC_ERROR event with Xid N on GPU I's armed event
+//   gpuI.xid_ms=T      objects T ms after startup (default 0); Xid 79 also
+//                      marks the GPU lost
+//   gpuI.mig=G         MIG mode with G GPU instances, GI IDs 1..G, that split
+//                      the GPCs evenly (default 0, MIG off)
+//   gpuI.mig_ci=C      compute instances per GPU instance, CI IDs 0..C-1, that
+//                      split its GPCs evenly (default 1)
+//   gpuI.giJ.gpcs=N    GPCs that GR reports inside GI J, fewer than its share
+//                      models an instance that came up degraded
+//   gpuI.giJ.units=U   ROP units inside GI J (default: scaled by its GPCs)
+// e.g. ROP_FAKE_RM="gpus=4,latency_us=50,gpu2.units=11"
+//      ROP_FAKE_RM="gpus=3,gpu1.latency_us=5000000,gpu2.busy=2"
+
+#define FAKERM_UUID_FORMAT "GPU-fa4e0000-0000-4000-8000-%012x"
+#define FAKERM_MAX_MIG_INSTANCES 8
+
+// Overrides of what GR reports inside one MIG GPU instance, 0 for its share
+struct fakerm_mig_instance
+{
+	NvU32 gpcs;
+	NvU32 units;
+};
+
+struct fakerm_gpu
+{
+	NV2080_CTRL_GR_GET_ROP_INFO_PARAMS rop;
+	NvU32 gpcs;
+	NvU32 tpcs;
+	NvU32 sm_per_tpc;
+	NvU32 cores;
+	NvU32 fbps;
+	NvU32 zcull_banks;
+	int minor;
+	NvU16 pci_device;
+	NvU32 subsystem;
+	unsigned latency_us;
+	unsigned gpu_lock_us;
+	unsigned busy;
+	NvU32 xid;       // RC error fired once on the GPU's armed event objects
+	unsigned xid_ms; // when, in ms after fakerm_create
+	unsigned mig;    // GPU instances, 0 for MIG mode off
+	unsigned mig_ci; // compute instances per GPU instance
+	struct fakerm_mig_instance mig_instances[FAKERM_MAX_MIG_INSTANCES]; // by GI ID - 1
+	bool lost;
+	bool hidden;
+};
+
+struct fakerm_config
+{
+	int gpu_count;
+	unsigned latency_us;
+	unsigned lock_us;
+	struct fakerm_gpu gpus[ROP_MAX_GPUS];
+};
+
+struct fakerm_stats
+{
+	unsigned long ioctls;
+	unsigned long opens;
+	int live_objects; // clients, devices and subdevices not yet freed
+	uint64_t lock_wait_ns; // time spent waiting for the modeled RM locks
+	unsigned long lock_holds;
+};
+
+void fakerm_default_config(struct fakerm_config* config);
+bool fakerm_parse_spec(const char* spec, struct fakerm_config* config);
+
+// Returns a new backend simulating `config`, NULL on allocation failure.
+const struct rop_backend* fakerm_create(const struct fakerm_config* config);
+const struct rop_backend* fakerm_create_from_spec(const char* spec);
+void fakerm_destroy(const struct rop_backend* backend);
+
+void fakerm_get_stats(const struct rop_backend* backend, struct fakerm_stats* stats);
+
+// Queues an event for `notify_index` (NV2080_NOTIFIERS_*) with `info32` on
+// every armed NV01_EVENT_OS_EVENT object of the GPU, and wakes their event fds.
+void fakerm_fire_event(const struct rop_backend* backend, int gpu, NvU32 notify_index, NvU32 info32);
+
+#endif
@@ -0,0 +1,1618 @@
+#define _GNU_SOURCE // cpu_set_t in affinity.h
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <pthread.h>
+
+#include "librop.h"
+
+#include "affinity.h"
+#include "fakerm.h"
+
+static int kernel_open(void* ctx, const char* path, int flags)
+{
+	(void)ctx;
+	return openat(AT_FDCWD, path, flags);
+}
+
+static int kernel_close(void* ctx, int fd)
+{
+	(void)ctx;
+	return close(fd);
+}
+
+static int kernel_ioctl(void* ctx, int fd, unsigned long request, void* arg)
+{
+	(void)ctx;
+	return ioctl(fd, request, arg);
+}
+
+static int kernel_access(void* ctx, const char* path, int mode)
+{
+	(void)ctx;
+	return access(path, mode);
+}
+
+const struct rop_backend rop_kernel_backend = {
+	.name = "kernel",
+	.open = kernel_open,
+	.close = kernel_close,
+	.ioctl = kernel_ioctl,
+	.access = kernel_access,
+	.ctx = NULL
+};
+
+const struct rop_backend* rop_default_backend(void)
+{
+	static const struct rop_backend* backend;
+	if (backend == NULL) {
+		// A bad spec is an error rather than a silent fallback to the real driver
+		const char* spec = getenv("ROP_FAKE_RM");
+		backend = spec != NULL ? fakerm_create_from_spec(spec) : &rop_kernel_backend;
+	}
+	return backend;
+}
+
+// Phase timing, see rop_timing_enable. Each phase is timed in the thread
+// that runs it, so workers probing distinct GPUs never share a counter.
+static struct rop_timing* timing;
+static __thread unsigned thread_ioctls; // ioctls issued by this thread
+
+struct phase_mark
+{
+	uint64_t start_ns;
+	unsigned ioctls;
+};
+
+static uint64_t monotonic_ns(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000 + (uint64_t)now.tv_nsec;
+}
+
+static void phase_begin(struct phase_mark* mark)
+{
+	if (timing != NULL) {
+		mark->start_ns = monotonic_ns();
+		mark->ioctls = thread_ioctls;
+	}
+}
+
+// device_index -1 books the phase on the session rather than a GPU
+static void phase_end(int device_index, enum rop_phase phase, const struct phase_mark* mark)
+{
+	if (timing == NULL || device_index >= ROP_MAX_GPUS) {
+		return;
+	}
+	struct rop_phase_time* time = device_index < 0 ? &timing->session[phase] : &timing->gpus[device_index][phase];
+	time->ns += monotonic_ns() - mark->start_ns;
+	time->calls++;
+	time->ioctls += thread_ioctls - mark->ioctls;
+}
+
+// Evaluates `call` as one `phase` of device_index and yields its value
+#define TIMED(device_index, phase, call) ({ \
+	struct phase_mark mark_; \
+	phase_begin(&mark_); \
+	__typeof__(call) ret_ = (call); \
+	phase_end((device_index), (phase), &mark_); \
+	ret_; \
+})
+
+void rop_timing_enable(struct rop_timing* timing_out)
+{
+	timing = timing_out;
+}
+
+const char* rop_phase_string(enum rop_phase phase)
+{
+	static const char* const names[ROP_PHASE_COUNT] = {
+		[ROP_PHASE_OPEN_CTL] = "open nvidiactl",
+		[ROP_PHASE_ALLOC_CLIENT] = "alloc client",
+		[ROP_PHASE_ENUMERATE] = "enumerate",
+		[ROP_PHASE_OPEN_DEVICE] = "open device",
+		[ROP_PHASE_REGISTER_FD] = "register fd",
+		[ROP_PHASE_ID_INFO] = "get ID info",
+		[ROP_PHASE_ALLOC_DEVICE] = "alloc device",
+		[ROP_PHASE_ALLOC_SUBDEVICE] = "alloc subdevice",
+		[ROP_PHASE_ROP_INFO] = "get ROP count",
+		[ROP_PHASE_GR_INFO] = "get GR info",
+		[ROP_PHASE_NAME] = "get name",
+		[ROP_PHASE_PCI_INFO] = "get PCI info",
+		[ROP_PHASE_FREE] = "free handles",
+		[ROP_PHASE_CLOSE] = "close",
+	};
+	return phase >= 0 && phase < ROP_PHASE_COUNT ? names[phase] : "unknown";
+}
+
+// Ioctl tracing, see rop_trace_enable
+static struct rop_trace* trace;
+static __thread int thread_id; // cached, gettid is a syscall
+
+void rop_trace_enable(struct rop_trace* trace_out)
+{
+	trace = trace_out;
+}
+
+// Records one finished ioctl. Slots are claimed with an atomic increment so
+// concurrent workers never take a lock; events past the capacity are counted
+// but dropped.
+static void trace_ioctl(int escape, const void* params, size_t size, uint64_t start_ns, int ret)
+{
+	uint64_t end_ns = monotonic_ns();
+	uint32_t slot = __atomic_fetch_add(&trace->count, 1, __ATOMIC_RELAXED);
+	if (slot >= trace->capacity) {
+		return;
+	}
+	if (thread_id == 0) {
+		thread_id = (int)syscall(SYS_gettid);
+	}
+	struct rop_trace_event* event = &trace->events[slot];
+	event->start_ns = start_ns;
+	event->duration_ns = end_ns - start_ns;
+	event->tid = thread_id;
+	event->escape = escape;
+	event->result = ret == 0 ? 0 : errno;
+	event->handle = 0;
+	event->code = 0;
+	event->status = NV_OK;
+
+	if (escape == NV_ESC_RM_ALLOC && size == sizeof(NVOS21_PARAMETERS)) {
+		const NVOS21_PARAMETERS* request = params;
+		event->handle = request->hObjectNew;
+		event->code = request->hClass;
+		event->status = request->status;
+	}
+	else if (escape == NV_ESC_RM_ALLOC && size == sizeof(NVOS64_PARAMETERS)) {
+		const NVOS64_PARAMETERS* request = params;
+		event->handle = request->hObjectNew;
+		event->code = request->hClass;
+		event->status = request->status;
+	}
+	else if (escape == NV_ESC_RM_CONTROL && size == sizeof(NVOS54_PARAMETERS)) {
+		const NVOS54_PARAMETERS* request = params;
+		event->handle = request->hObject;
+		event->code = request->cmd;
+		event->status = request->status;
+	}
+	else if (escape == NV_ESC_RM_FREE && size == sizeof(NVOS00_PARAMETERS)) {
+		const NVOS00_PARAMETERS* request = params;
+		event->handle = request->hObjectOld;
+		event->status = request->status;
+	}
+	else if (escape == NV_ESC_REGISTER_FD && size == sizeof(int)) {
+		event->handle = (NvHandle)*(const int*)params; // the nvidiactl fd
+	}
+	else if (escape == NV_ESC_RM_GET_EVENT_DATA && size == sizeof(NVOS41_PARAMETERS)) {
+		const NVOS41_PARAMETERS* request = params;
+		const NvUnixEvent* rm_event = request->pEvent;
+		event->handle = rm_event->hObject;
+		event->code = rm_event->NotifyIndex;
+		event->status = request->status;
+	}
+}
+
+// Every RM call funnels through here so the escape encoding lives in one place.
+static int rm_ioctl(const struct rop_backend* backend, int fd, int escape, void* params, size_t size)
+{
+	unsigned long request = _IOC(_IOC_READ | _IOC_WRITE, NV_IOCTL_MAGIC, escape, size);
+	thread_ioctls++;
+	if (trace == NULL) {
+		return backend->ioctl(backend->ctx, fd, request, params);
+	}
+	uint64_t start_ns = monotonic_ns();
+	int ret = backend->ioctl(backend->ctx, fd, request, params);
+	int saved_errno = errno;
+	trace_ioctl(escape, params, size, start_ns, ret);
+	errno = saved_errno;
+	return ret;
+}
+
+// RM answers NV_ERR_BUSY_RETRY while the GPU is busy with e.g. a reset or a
+// power transition. Such calls are retried with exponential backoff, 1 ms
+// doubling up to 5 attempts (31 ms at most), before the status is reported.
+#define RM_BUSY_RETRIES 5
+#define RM_BUSY_BACKOFF_US 1000
+
+// Sleeps before the next attempt and returns true if `status` is worth retrying
+static bool rm_busy_backoff(NvV32 status, int* const attempt)
+{
+	if (status != NV_ERR_BUSY_RETRY || *attempt >= RM_BUSY_RETRIES) {
+		return false;
+	}
+	usleep(RM_BUSY_BACKOFF_US << *attempt);
+	++*attempt;
+	return true;
+}
+
+static bool open_nvidiactl(const struct rop_backend* backend, int* const nvidiactl_fd)
+{
+	*nvidiactl_fd = backend->open(backend->ctx, "/dev/nvidiactl", O_RDWR | O_CLOEXEC);
+	if (*nvidiactl_fd == -1) {
+		perror("Failed to open /dev/nvidiactl");
+		return false;
+	}
+	return true;
+}
+
+static bool open_nvidia_device(const struct rop_backend* backend, int minor, int* const nvidia_fd)
+{
+	char device_path[32];
+	snprintf(device_path, sizeof(device_path), "/dev/nvidia%d", minor);
+
+	*nvidia_fd = backend->open(backend->ctx, device_path, O_RDWR | O_CLOEXEC);
+	if (*nvidia_fd == -1) {
+		int saved_errno = errno;
+		fprintf(stderr, "Failed to open %s: %s\n", device_path, strerror(errno));
+		errno = saved_errno;
+		return false;
+	}
+	return true;
+}
+
+static bool register_fd(const struct rop_backend* backend, int nvidiactl_fd, int* const nvidia_fd)
+{
+	if (rm_ioctl(backend, *nvidia_fd, NV_ESC_REGISTER_FD, &nvidiactl_fd, sizeof(nvidiactl_fd)) != 0) {
+		int saved_errno = errno;
+		perror("ioctl NV_ESC_REGISTER_FD failed");
+		backend->close(backend->ctx, *nvidia_fd);
+		*nvidia_fd = -1;
+		errno = saved_errno;
+		return false;
+	}
+	return true;
+}
+
+static bool alloc_client(const struct rop_backend* backend, const int nvidiactl_fd, NvHandle* const hClient)
+{
+	NVOS21_PARAMETERS request;
+	memset(&request, 0, sizeof(request));
+	request.hObjectNew = 0;
+
+	if (rm_ioctl(backend, nvidiactl_fd, NV_ESC_RM_ALLOC, &request, sizeof(request)) != 0) {
+		perror("ioctl NV_ESC_RM_ALLOC (client) failed");
+		return false;
+	}
+	if (request.status != 0) {
+		fprintf(stderr, "Failed to allocate client, RM status: 0x%x\n", request.status);
+		return false;
+	}
+	*hClient = request.hObjectNew;
+	return true;
+}
+
+static bool alloc_device(const struct rop_backend* backend, const int nvidiactl_fd, const NvHandle hClient, NvU32 deviceInstance, NvHandle* const hDevice)
+{
+	NV0080_ALLOC_PARAMETERS allocParams;
+	memset(&allocParams, 0, sizeof(allocParams));
+	allocParams.deviceId = deviceInstance;
+
+	NVOS64_PARAMETERS request = {
+		.hRoot = hClient,
+		.hObjectParent = hClient,
+		.hObjectNew = 0,
+		.hClass = NV01_DEVICE_0,
+		.pAllocParms = &allocParams,
+		.pRightsRequested = NULL,
+		.paramsSize = sizeof(NV0080_ALLOC_PARAMETERS),
+		.flags = 0,
+		.status = 0
+	};
+
+	int attempt = 0;
+	do {
+		request.hObjectNew = 0;
+		request.status = 0;
+		if (rm_ioctl(backend, nvidiactl_fd, NV_ESC_RM_ALLOC, &request, sizeof(request)) != 0) {
+			perror("ioctl NV_ESC_RM_ALLOC (device) failed");
+			return false;
+		}
+	} while (rm_busy_backoff(request.status, &attempt));
+	if (request.status != 0) {
+		fprintf(stderr, "Failed to allocate device (instance %u), RM status: 0x%x\n", deviceInstance, request.status);
+		return false;
+	}
+	*hDevice = request.hObjectNew;
+	return true;
+}
+
+static bool alloc_subdevice(const struct rop_backend* backend, const int nvidiactl_fd, const NvHandle hClient, const NvHandle hParentDevice, NvHandle* const hSubDevice)
+{
+	NV2080_ALLOC_PARAMETERS allocParams;
+	memset(&allocParams, 0, sizeof(allocParams));
+	allocParams.subDeviceId = 0;
+
+	NVOS64_PARAMETERS request = {
+		.hRoot = hClient,
+		.hObjectParent = hParentDevice,
+		.hObjectNew = 0,
+		.hClass = NV20_SUBDEVICE_0,
+		.pAllocParms = &allocParams,
+		.pRightsRequested = NULL,
+		.paramsSize = sizeof(NV2080_ALLOC_PARAMETERS),
+		.flags = 0,
+		.status = 0
+	};
+	int attempt = 0;
+	do {
+		request.hObjectNew = 0;
+		request.status = 0;
+		if (rm_ioctl(backend, nvidiactl_fd, NV_ESC_RM_ALLOC, &request, sizeof(request)) != 0) {
+			perror("ioctl NV_ESC_RM_ALLOC (subdevice) failed");
+			return false;
+		}
+	} while (rm_busy_backoff(request.status, &attempt));
+	if (request.status != 0) {
+		fprintf(stderr, "Failed to allocate subdevice (parent handle 0x%x), RM status: 0x%x\n", hParentDevice, request.status);
+		return false;
+	}
+	*hSubDevice = request.hObjectNew;
+	return true;
+}
+
+// Issues one NV_ESC_RM_CONTROL and leaves RM's answer in *status, for
+// callers that expect some failures; false only if the ioctl itself failed
+static bool rm_control_status(const struct rop_backend* backend, const int nvidiactl_fd, const NvHandle hClient, const NvHandle hObject, NvV32 cmd, void* params, NvU32 paramsSize, const char* what, NvV32* const status)
+{
+	NVOS54_PARAMETERS request = {
+		.hClient = hClient,
+		.hObject = hObject,
+		.cmd = cmd,
+		.flags = 0,
+		.params = params,
+		.paramsSize = paramsSize,
+		.status = 0
+	};
+	int attempt = 0;
+	do {
+		request.status = 0;
+		if (rm_ioctl(backend, nvidiactl_fd, NV_ESC_RM_CONTROL, &request, sizeof(request)) != 0) {
+			fprintf(stderr, "ioctl NV_ESC_RM_CONTROL (%s) failed: %s\n", what, strerror(errno));
+			return false;
+		}
+	} while (rm_busy_backoff(request.status, &attempt));
+	*status = request.status;
+	return true;
+}
+
+// Issues one NV_ESC_RM_CONTROL; `what` names the control in error messages
+static bool rm_control(const struct rop_backend* backend, const int nvidiactl_fd, const NvHandle hClient, const NvHandle hObject, NvV32 cmd, void* params, NvU32 paramsSize, const char* what)
+{
+	NvV32 status;
+	if (!rm_control_status(backend, nvidiactl_fd, hClient, hObject, cmd, params, paramsSize, what, &status)) {
+		return false;
+	}
+	if (status != 0) {
+		fprintf(stderr, "Failed to %s (object handle 0x%x), RM status: 0x%x\n", what, hObject, status);
+		return false;
+	}
+	return true;
+}
+
+static bool get_rop_count(const struct rop_backend* backend, const int nvidiactl_fd, const NvHandle hClient, const NvHandle hSubdevice, NV2080_CTRL_GR_GET_ROP_INFO_PARAMS* ropParams)
+{
+	return rm_control(backend, nvidiactl_fd, hClient, hSubdevice, CMD_SUBDEVICE_CTRL_GR_GET_ROP_INFO,
+	                  ropParams, sizeof(NV2080_CTRL_GR_GET_ROP_INFO_PARAMS), "get ROP count");
+}
+
+static bool get_gr_info(const struct rop_backend* backend, const int nvidiactl_fd, const NvHandle hClient, const NvHandle hSubdevice, NV2080_CTRL_GR_INFO* infoList, NvU32 infoCount)
+{
+	NV2080_CTRL_GR_GET_INFO_PARAMS grParams;
+	memset(&grParams, 0, sizeof(grParams));
+	grParams.grInfoListSize = infoCount;
+	grParams.grInfoList = infoList;
+
+	return rm_control(backend, nvidiactl_fd, hClient, hSubdevice, NV2080_CTRL_CMD_GR_GET_INFO,
+	                  &grParams, sizeof(grParams), "get GR info");
+}
+
+static bool get_gpu_name(const struct rop_backend* backend, const int nvidiactl_fd, const NvHandle hClient, const NvHandle hSubdevice, NV2080_CTRL_GPU_GET_NAME_STRING_PARAMS* nameParams)
+{
+	memset(nameParams, 0, sizeof(*nameParams));
+	nameParams->gpuNameStringFlags = NV2080_CTRL_GPU_GET_NAME_STRING_FLAGS_TYPE_ASCII;
+
+	return rm_control(backend, nvidiactl_fd, hClient, hSubdevice, NV2080_CTRL_CMD_GPU_GET_NAME_STRING,
+	                  nameParams, sizeof(*nameParams), "get GPU name");
+}
+
+static bool get_pci_info(const struct rop_backend* backend, const int nvidiactl_fd, const NvHandle hClient, const NvHandle hSubdevice, NV2080_CTRL_BUS_GET_PCI_INFO_PARAMS* pciParams)
+{
+	memset(pciParams, 0, sizeof(*pciParams));
+	return rm_control(backend, nvidiactl_fd, hClient, hSubdevice, NV2080_CTRL_CMD_BUS_GET_PCI_INFO,
+	                  pciParams, sizeof(*pciParams), "get PCI info");
+}
+
+static bool get_probed_ids(const struct rop_backend* backend, const int nvidiactl_fd, const NvHandle hClient, NV0000_CTRL_GPU_GET_PROBED_IDS_PARAMS* probedParams)
+{
+	memset(probedParams, 0, sizeof(*probedParams));
+	return rm_control(backend, nvidiactl_fd, hClient, hClient, NV0000_CTRL_CMD_GPU_GET_PROBED_IDS,
+	                  probedParams, sizeof(*probedParams), "get probed GPU IDs");
+}
+
+static bool get_device_instance(const struct rop_backend* backend, const int nvidiactl_fd, const NvHandle hClient, NvU32 gpuId, NvU32* const deviceInstance)
+{
+	NV0000_CTRL_GPU_GET_ID_INFO_V2_PARAMS idParams;
+	memset(&idParams, 0, sizeof(idParams));
+	idParams.gpuId = gpuId;
+
+	if (!rm_control(backend, nvidiactl_fd, hClient, hClient, NV0000_CTRL_CMD_GPU_GET_ID_INFO_V2,
+	                &idParams, sizeof(idParams), "get GPU ID info")) {
+		return false;
+	}
+	*deviceInstance = idParams.deviceInstance;
+	return true;
+}
+
+static bool get_card_info(const struct rop_backend* backend, const int nvidiactl_fd, nv_ioctl_card_info_t* cards, size_t cardCount)
+{
+	memset(cards, 0, cardCount * sizeof(*cards));
+	if (rm_ioctl(backend, nvidiactl_fd, NV_ESC_CARD_INFO, cards, cardCount * sizeof(*cards)) != 0) {
+		perror("ioctl NV_ESC_CARD_INFO failed");
+		return false;
+	}
+	return true;
+}
+
+static bool free_handle(const struct rop_backend* backend, const int nvidiactl_fd, const NvHandle hClient, const NvHandle hObject)
+{
+	NVOS00_PARAMETERS request = {
+		.hRoot = hClient,
+		.hObjectParent = 0,
+		.hObjectOld = hObject,
+		.status = 0
+	};
+
+	if (rm_ioctl(backend, nvidiactl_fd, NV_ESC_RM_FREE, &request, sizeof(request)) != 0) {
+		perror("ioctl NV_ESC_RM_FREE failed");
+		return false;
+	}
+	if (request.status != 0) {
+		fprintf(stderr, "Failed to free handle 0x%x, RM status: 0x%x\n", hObject, request.status);
+		return false;
+	}
+	return true;
+}
+
+// Maps RM's probed GPU IDs to minors and PCI addresses without opening any GPU
+static bool enumerate_devices(struct rop_session* session)
+{
+	const struct rop_backend* backend = session->backend;
+	NV0000_CTRL_GPU_GET_PROBED_IDS_PARAMS probedParams;
+	nv_ioctl_card_info_t cards[ROP_MAX_GPUS];
+
+	if (!get_probed_ids(backend, session->nvidiactl_fd, session->hClient, &probedParams) ||
+	    !get_card_info(backend, session->nvidiactl_fd, cards, ROP_MAX_GPUS)) {
+		return false;
+	}
+
+	session->device_count = 0;
+	for (int i = 0; i < NV0000_CTRL_GPU_MAX_PROBED_GPUS; ++i) {
+		NvU32 gpuId = probedParams.gpuIds[i];
+		if (gpuId == NV0000_CTRL_GPU_INVALID_ID) {
+			continue;
+		}
+		const nv_ioctl_card_info_t* card = NULL;
+		for (int j = 0; j < ROP_MAX_GPUS && card == NULL; ++j) {
+			if (cards[j].valid && cards[j].gpu_id == gpuId) {
+				card = &cards[j];
+			}
+		}
+		if (card == NULL) {
+			continue;
+		}
+
+		// Skip GPUs whose node isn't there, e.g. ones not passed into this container
+		char device_path[32];
+		snprintf(device_path, sizeof(device_path), "/dev/nvidia%u", card->minor_number);
+		if (backend->access(backend->ctx, device_path, F_OK) != 0) {
+			continue;
+		}
+
+		struct rop_device device = {
+			.gpuId = gpuId,
+			.minor = (int)card->minor_number,
+			.domain = card->pci_info.domain,
+			.bus = card->pci_info.bus,
+			.slot = card->pci_info.slot,
+			.function = card->pci_info.function,
+			.vendorId = card->pci_info.vendor_id,
+			.pciDeviceId = card->pci_info.device_id
+		};
+		snprintf(device.busId, sizeof(device.busId), "%04x:%02x:%02x.%x", device.domain, device.bus, device.slot, device.function);
+
+		// Keep the table ordered by minor
+		int pos = session->device_count++;
+		while (pos > 0 && session->devices[pos - 1].minor > device.minor) {
+			session->devices[pos] = session->devices[pos - 1];
+			pos--;
+		}
+		session->devices[pos] = device;
+	}
+	return true;
+}
+
+bool rop_session_open(struct rop_session* session)
+{
+	return rop_session_open_backend(session, rop_default_backend());
+}
+
+bool rop_session_open_backend(struct rop_session* session, const struct rop_backend* backend)
+{
+	memset(session, 0, sizeof(*session));
+	session->backend = backend;
+	session->nvidiactl_fd = -1;
+	for (int i = 0; i < ROP_MAX_GPUS; ++i) {
+		session->gpus[i].device_index = i;
+		session->gpus[i].nvidia_fd = -1;
+	}
+	if (backend == NULL) {
+		return false;
+	}
+
+	if (!TIMED(-1, ROP_PHASE_OPEN_CTL, open_nvidiactl(backend, &session->nvidiactl_fd))) {
+		return false;
+	}
+	if (!TIMED(-1, ROP_PHASE_ALLOC_CLIENT, alloc_client(backend, session->nvidiactl_fd, &session->hClient))) {
+		backend->close(backend->ctx, session->nvidiactl_fd);
+		session->nvidiactl_fd = -1;
+		return false;
+	}
+	if (!TIMED(-1, ROP_PHASE_ENUMERATE, enumerate_devices(session))) {
+		rop_session_close(session);
+		return false;
+	}
+	return true;
+}
+
+void rop_session_close(struct rop_session* session)
+{
+	if (session->nvidiactl_fd == -1) {
+		return;
+	}
+	for (int i = 0; i < ROP_MAX_GPUS; ++i) {
+		rop_gpu_detach(session, &session->gpus[i]);
+	}
+	TIMED(-1, ROP_PHASE_FREE, free_handle(session->backend, session->nvidiactl_fd, session->hClient, session->hClient));
+	TIMED(-1, ROP_PHASE_CLOSE, session->backend->close(session->backend->ctx, session->nvidiactl_fd));
+	session->nvidiactl_fd = -1;
+}
+
+// Returns the session's cached GPU for device_index, attaching it if needed
+static enum rop_status session_gpu(struct rop_session* session, int device_index, struct rop_gpu** gpu)
+{
+	if (device_index < 0 || device_index >= session->device_count) {
+		errno = ENOENT;
+		return ROP_ERR_OPEN;
+	}
+	*gpu = &session->gpus[device_index];
+	// A held handle does not keep the GPU awake, but a control on it would wake it
+	if (session->no_wake && (*gpu)->nvidia_fd != -1 &&
+	    rop_device_power_state(&session->devices[device_index]) == ROP_POWER_SUSPENDED) {
+		return ROP_ERR_SUSPENDED;
+	}
+	if ((*gpu)->nvidia_fd == -1) {
+		return rop_gpu_attach(session, device_index, *gpu);
+	}
+	return ROP_OK;
+}
+
+enum rop_status rop_session_query(struct rop_session* session, int device_index, NV2080_CTRL_GR_GET_ROP_INFO_PARAMS* ropParams)
+{
+	struct rop_gpu* gpu;
+	enum rop_status status = session_gpu(session, device_index, &gpu);
+	if (status != ROP_OK) {
+		return status;
+	}
+	return rop_gpu_query(session, gpu, ropParams);
+}
+
+enum rop_status rop_session_get_gr_info(struct rop_session* session, int device_index, struct rop_gr_info* grInfo)
+{
+	struct rop_gpu* gpu;
+	enum rop_status status = session_gpu(session, device_index, &gpu);
+	if (status != ROP_OK) {
+		return status;
+	}
+	return rop_gpu_get_gr_info(session, gpu, grInfo);
+}
+
+enum rop_status rop_session_get_name(struct rop_session* session, int device_index, char* name, size_t name_size)
+{
+	struct rop_gpu* gpu;
+	enum rop_status status = session_gpu(session, device_index, &gpu);
+	if (status != ROP_OK) {
+		return status;
+	}
+	return rop_gpu_get_name(session, gpu, name, name_size);
+}
+
+enum rop_status rop_session_judge(struct rop_session* session, int device_index, struct rop_result* result)
+{
+	struct rop_gpu* gpu;
+	enum rop_status status = session_gpu(session, device_index, &gpu);
+	if (status != ROP_OK) {
+		return status;
+	}
+	return rop_gpu_judge(session, gpu, result);
+}
+
+enum rop_status rop_session_get_uuid(const struct rop_session* session, int device_index, char* uuid, size_t uuid_size)
+{
+	NV0000_CTRL_GPU_GET_UUID_FROM_GPU_ID_PARAMS uuidParams;
+
+	if (device_index < 0 || device_index >= session->device_count) {
+		errno = ENOENT;
+		return ROP_ERR_OPEN;
+	}
+	if (session->nvidiactl_fd == -1) {
+		errno = EBADF;
+		return ROP_ERR_OPEN;
+	}
+	memset(&uuidParams, 0, sizeof(uuidParams));
+	uuidParams.gpuId = session->devices[device_index].gpuId;
+	uuidParams.flags = NV0000_CTRL_CMD_GPU_GET_UUID_FROM_GPU_ID_FLAGS_FORMAT_ASCII;
+	if (!rm_control(session->backend, session->nvidiactl_fd, session->hClient, session->hClient, NV0000_CTRL_CMD_GPU_GET_UUID_FROM_GPU_ID,
+	                &uuidParams, sizeof(uuidParams), "get GPU UUID")) {
+		return ROP_ERR_QUERY;
+	}
+	size_t length = strnlen((const char*)uuidParams.gpuUuid, sizeof(uuidParams.gpuUuid));
+	if (uuidParams.uuidStrLen > 0 && uuidParams.uuidStrLen < length) {
+		length = uuidParams.uuidStrLen;
+	}
+	if (uuid_size > 0) {
+		length = length < uuid_size - 1 ? length : uuid_size - 1;
+		memcpy(uuid, uuidParams.gpuUuid, length);
+		uuid[length] = '\0';
+	}
+	return ROP_OK;
+}
+
+static uint32_t attach_generation;
+
+enum rop_status rop_gpu_attach(const struct rop_session* session, int device_index, struct rop_gpu* gpu)
+{
+	gpu->device_index = device_index;
+	gpu->generation = __atomic_add_fetch(&attach_generation, 1, __ATOMIC_RELAXED);
+	gpu->nvidia_fd = -1;
+	gpu->deviceInstance = 0;
+	gpu->hDevice = 0;
+	gpu->hSubDevice = 0;
+
+	if (device_index < 0 || device_index >= session->device_count) {
+		errno = ENOENT;
+		return ROP_ERR_OPEN;
+	}
+	const struct rop_device* device = &session->devices[device_index];
+
+	if (session->no_wake && rop_device_power_state(device) == ROP_POWER_SUSPENDED) {
+		return ROP_ERR_SUSPENDED;
+	}
+	if (!TIMED(device_index, ROP_PHASE_OPEN_DEVICE, open_nvidia_device(session->backend, device->minor, &gpu->nvidia_fd)) ||
+	    !TIMED(device_index, ROP_PHASE_REGISTER_FD, register_fd(session->backend, session->nvidiactl_fd, &gpu->nvidia_fd))) {
+		gpu->nvidia_fd = -1;
+		return ROP_ERR_OPEN;
+	}
+	// The device instance is only meaningful once the open above has attached the GPU
+	if (!TIMED(device_index, ROP_PHASE_ID_INFO, get_device_instance(session->backend, session->nvidiactl_fd, session->hClient, device->gpuId, &gpu->deviceInstance)) ||
+	    !TIMED(device_index, ROP_PHASE_ALLOC_DEVICE, alloc_device(session->backend, session->nvidiactl_fd, session->hClient, gpu->deviceInstance, &gpu->hDevice))) {
+		session->backend->close(session->backend->ctx, gpu->nvidia_fd);
+		gpu->nvidia_fd = -1;
+		return ROP_ERR_DEVICE;
+	}
+	if (!TIMED(device_index, ROP_PHASE_ALLOC_SUBDEVICE, alloc_subdevice(session->backend, session->nvidiactl_fd, session->hClient, gpu->hDevice, &gpu->hSubDevice))) {
+		free_handle(session->backend, session->nvidiactl_fd, session->hClient, gpu->hDevice);
+		session->backend->close(session->backend->ctx, gpu->nvidia_fd);
+		gpu->nvidia_fd = -1;
+		return ROP_ERR_SUBDEVICE;
+	}
+	return ROP_OK;
+}
+
+enum rop_status rop_gpu_query(const struct rop_session* session, const struct rop_gpu* gpu, NV2080_CTRL_GR_GET_ROP_INFO_PARAMS* ropParams)
+{
+	memset(ropParams, 0, sizeof(*ropParams));
+	if (!TIMED(gpu->device_index, ROP_PHASE_ROP_INFO, get_rop_count(session->backend, session->nvidiactl_fd, session->hClient, gpu->hSubDevice, ropParams))) {
+		return ROP_ERR_QUERY;
+	}
+	return ROP_OK;
+}
+
+// Every counter rides in the same control, so the inventory costs one ioctl
+static bool query_gr_info(const struct rop_backend* backend, const int nvidiactl_fd, const NvHandle hClient, const NvHandle hSubdevice, struct rop_gr_info* grInfo)
+{
+	NV2080_CTRL_GR_INFO infoList[] = {
+		{ .index = NV2080_CTRL_GR_INFO_INDEX_LITTER_NUM_GPCS },
+		{ .index = NV2080_CTRL_GR_INFO_INDEX_SHADER_PIPE_COUNT },
+		{ .index = NV2080_CTRL_GR_INFO_INDEX_LITTER_NUM_SM_PER_TPC },
+		{ .index = NV2080_CTRL_GR_INFO_INDEX_GPU_CORE_COUNT },
+		{ .index = NV2080_CTRL_GR_INFO_INDEX_LITTER_NUM_FBPS },
+		{ .index = NV2080_CTRL_GR_INFO_INDEX_LITTER_NUM_ZCULL_BANKS },
+	};
+
+	memset(grInfo, 0, sizeof(*grInfo));
+	if (!get_gr_info(backend, nvidiactl_fd, hClient, hSubdevice, infoList, sizeof(infoList) / sizeof(infoList[0]))) {
+		return false;
+	}
+	grInfo->gpcCount = infoList[0].data;
+	grInfo->tpcCount = infoList[1].data;
+	grInfo->smCount = infoList[1].data * infoList[2].data;
+	grInfo->coreCount = infoList[3].data;
+	grInfo->fbpCount = infoList[4].data;
+	grInfo->zcullBankCount = infoList[5].data;
+	return true;
+}
+
+enum rop_status rop_gpu_get_gr_info(const struct rop_session* session, const struct rop_gpu* gpu, struct rop_gr_info* grInfo)
+{
+	if (!TIMED(gpu->device_index, ROP_PHASE_GR_INFO, query_gr_info(session->backend, session->nvidiactl_fd, session->hClient, gpu->hSubDevice, grInfo))) {
+		return ROP_ERR_QUERY;
+	}
+	return ROP_OK;
+}
+
+enum rop_status rop_gpu_get_name(const struct rop_session* session, const struct rop_gpu* gpu, char* name, size_t name_size)
+{
+	NV2080_CTRL_GPU_GET_NAME_STRING_PARAMS nameParams;
+
+	if (!TIMED(gpu->device_index, ROP_PHASE_NAME, get_gpu_name(session->backend, session->nvidiactl_fd, session->hClient, gpu->hSubDevice, &nameParams))) {
+		return ROP_ERR_QUERY;
+	}
+	// RM pads with NULs but does not promise a terminator on a full buffer
+	const NvU8* ascii = nameParams.gpuNameString.ascii;
+	size_t length = strnlen((const char*)ascii, sizeof(nameParams.gpuNameString.ascii));
+	if (name_size > 0) {
+		length = length < name_size - 1 ? length : name_size - 1;
+		memcpy(name, ascii, length);
+		name[length] = '\0';
+	}
+	return ROP_OK;
+}
+
+enum rop_status rop_gpu_judge(const struct rop_session* session, const struct rop_gpu* gpu, struct rop_result* result)
+{
+	const struct rop_device* device = &session->devices[gpu->device_index];
+	NvU32 subsystemId = 0;
+
+	// Vendor and device come from enumeration, only board entries cost an ioctl
+	if (rop_expected_uses_subsystem()) {
+		NV2080_CTRL_BUS_GET_PCI_INFO_PARAMS pciParams;
+		if (!TIMED(gpu->device_index, ROP_PHASE_PCI_INFO, get_pci_info(session->backend, session->nvidiactl_fd, session->hClient, gpu->hSubDevice, &pciParams))) {
+			return ROP_ERR_QUERY;
+		}
+		subsystemId = pciParams.pciSubSystemId;
+	}
+	result->expectedCount = rop_expected_count(device->vendorId, device->pciDeviceId, subsystemId);
+	result->verdict = rop_verdict_for(result->expectedCount, result->rop.ropOperationsCount);
+	return ROP_OK;
+}
+
+void rop_gpu_detach(const struct rop_session* session, struct rop_gpu* gpu)
+{
+	if (gpu->nvidia_fd == -1) {
+		return;
+	}
+	// Free in reverse order of allocation
+	struct phase_mark mark;
+	phase_begin(&mark);
+	free_handle(session->backend, session->nvidiactl_fd, session->hClient, gpu->hSubDevice);
+	free_handle(session->backend, session->nvidiactl_fd, session->hClient, gpu->hDevice);
+	phase_end(gpu->device_index, ROP_PHASE_FREE, &mark);
+	TIMED(gpu->device_index, ROP_PHASE_CLOSE, session->backend->close(session->backend->ctx, gpu->nvidia_fd));
+	gpu->nvidia_fd = -1;
+}
+
+// Allocates a MIG instance reference, which subscribes hClient to the instance
+static bool alloc_instance_ref(const struct rop_backend* backend, const int nvidiactl_fd, const NvHandle hClient, const NvHandle hParent, NvV32 hClass, void* allocParams, NvU32 paramsSize, NvU32 id, NvHandle* const hRef)
+{
+	NVOS64_PARAMETERS request = {
+		.hRoot = hClient,
+		.hObjectParent = hParent,
+		.hObjectNew = 0,
+		.hClass = hClass,
+		.pAllocParms = allocParams,
+		.pRightsRequested = NULL,
+		.paramsSize = paramsSize,
+		.flags = 0,
+		.status = 0
+	};
+	int attempt = 0;
+	do {
+		request.hObjectNew = 0;
+		request.status = 0;
+		if (rm_ioctl(backend, nvidiactl_fd, NV_ESC_RM_ALLOC, &request, sizeof(request)) != 0) {
+			perror("ioctl NV_ESC_RM_ALLOC (MIG instance) failed");
+			return false;
+		}
+	} while (rm_busy_backoff(request.status, &attempt));
+	if (request.status != 0) {
+		fprintf(stderr, "Failed to subscribe to %s instance %u, RM status: 0x%x\n",
+		        hClass == AMPERE_SMC_PARTITION_REF ? "GPU" : "compute", id, request.status);
+		return false;
+	}
+	*hRef = request.hObjectNew;
+	return true;
+}
+
+// Reads ROP info and GR units over a subdevice of a subscribed client
+static void query_scope(const struct rop_backend* backend, const int nvidiactl_fd, const NvHandle hClient, const NvHandle hSubDevice, struct rop_mig_scope* scope)
+{
+	memset(&scope->rop, 0, sizeof(scope->rop));
+	if (!get_rop_count(backend, nvidiactl_fd, hClient, hSubDevice, &scope->rop) ||
+	    !query_gr_info(backend, nvidiactl_fd, hClient, hSubDevice, &scope->gr)) {
+		scope->status = ROP_ERR_QUERY;
+		return;
+	}
+	scope->status = ROP_OK;
+}
+
+// Queries one GI and its CIs. A client subscribes to at most one GI, and to
+// at most one CI within it, so each GI gets a client of its own on the
+// session's control fd and each CI reference is freed before the next.
+static void query_mig_instance(const struct rop_session* session, const struct rop_gpu* gpu, struct rop_mig_instance* instance)
+{
+	const struct rop_backend* backend = session->backend;
+	const int fd = session->nvidiactl_fd;
+	NvHandle hClient, hDevice, hSubDevice, hPartition;
+
+	instance->scoped.status = ROP_ERR_DEVICE;
+	if (!alloc_client(backend, fd, &hClient)) {
+		return;
+	}
+	if (!alloc_device(backend, fd, hClient, gpu->deviceInstance, &hDevice)) {
+		free_handle(backend, fd, hClient, hClient);
+		return;
+	}
+	instance->scoped.status = ROP_ERR_SUBDEVICE;
+	if (!alloc_subdevice(backend, fd, hClient, hDevice, &hSubDevice)) {
+		free_handle(backend, fd, hClient, hClient);
+		return;
+	}
+	NVC637_ALLOCATION_PARAMETERS partitionParams = { .swizzId = instance->swizzId };
+	instance->scoped.status = ROP_ERR_QUERY;
+	if (!alloc_instance_ref(backend, fd, hClient, hSubDevice, AMPERE_SMC_PARTITION_REF, &partitionParams, sizeof(partitionParams), instance->swizzId, &hPartition)) {
+		free_handle(backend, fd, hClient, hClient);
+		return;
+	}
+	query_scope(backend, fd, hClient, hSubDevice, &instance->scoped);
+
+	NVC637_CTRL_EXEC_PARTITIONS_GET_PARAMS execParams;
+	memset(&execParams, 0, sizeof(execParams));
+	if (rm_control(backend, fd, hClient, hPartition, NVC637_CTRL_CMD_EXEC_PARTITIONS_GET, &execParams, sizeof(execParams), "list compute instances")) {
+		for (NvU32 i = 0; i < execParams.execPartCount && i < NVC637_CTRL_MAX_EXEC_PARTITIONS; ++i) {
+			struct rop_mig_compute* compute = &instance->compute[instance->compute_count++];
+			compute->id = execParams.execPartId[i];
+			compute->gpcCount = execParams.execPartInfo[i].gpcCount;
+			compute->smCount = execParams.execPartInfo[i].smCount;
+			compute->scoped.status = ROP_ERR_QUERY;
+
+			NVC638_ALLOCATION_PARAMETERS execPartitionParams = { .execPartitionId = compute->id };
+			NvHandle hExecPartition;
+			if (alloc_instance_ref(backend, fd, hClient, hPartition, AMPERE_SMC_EXEC_PARTITION_REF, &execPartitionParams, sizeof(execPartitionParams), compute->id, &hExecPartition)) {
+				query_scope(backend, fd, hClient, hSubDevice, &compute->scoped);
+				free_handle(backend, fd, hClient, hExecPartition);
+			}
+		}
+	}
+	// Frees the references, subdevice and device with it
+	free_handle(backend, fd, hClient, hClient);
+}
+
+enum rop_status rop_gpu_get_mig_instances(const struct rop_session* session, const struct rop_gpu* gpu, struct rop_mig_instance* instances, int* count)
+{
+	NV2080_CTRL_GPU_GET_PARTITIONS_PARAMS partitionParams;
+	NvV32 status;
+
+	*count = 0;
+	memset(&partitionParams, 0, sizeof(partitionParams));
+	partitionParams.bGetAllPartitionInfo = 1;
+	if (!rm_control_status(session->backend, session->nvidiactl_fd, session->hClient, gpu->hSubDevice, NV2080_CTRL_CMD_GPU_GET_PARTITIONS,
+	                       &partitionParams, sizeof(partitionParams), "list MIG GPU instances", &status)) {
+		return ROP_ERR_QUERY;
+	}
+	// GPUs without MIG, or with MIG mode off
+	if (status == NV_ERR_NOT_SUPPORTED || status == NV_ERR_INVALID_STATE) {
+		return ROP_OK;
+	}
+	if (status != NV_OK) {
+		fprintf(stderr, "Failed to list MIG GPU instances (object handle 0x%x), RM status: 0x%x\n", gpu->hSubDevice, status);
+		return ROP_ERR_QUERY;
+	}
+	for (NvU32 i = 0; i < partitionParams.validPartitionCount && i < NV2080_CTRL_GPU_MAX_PARTITIONS; ++i) {
+		const NV2080_CTRL_GPU_GET_PARTITION_INFO* info = &partitionParams.queryPartitionInfo[i];
+		if (!info->bValid) {
+			continue;
+		}
+		struct rop_mig_instance* instance = &instances[(*count)++];
+		memset(instance, 0, sizeof(*instance));
+		instance->swizzId = info->swizzId;
+		instance->gpcCount = info->gpcCount;
+		instance->smCount = info->smCount;
+		query_mig_instance(session, gpu, instance);
+	}
+	return ROP_OK;
+}
+
+enum rop_status rop_session_get_mig_instances(struct rop_session* session, int device_index, struct rop_mig_instance* instances, int* count)
+{
+	struct rop_gpu* gpu;
+	enum rop_status status = session_gpu(session, device_index, &gpu);
+	if (status != ROP_OK) {
+		*count = 0;
+		return status;
+	}
+	return rop_gpu_get_mig_instances(session, gpu, instances, count);
+}
+
+bool rop_mig_reduced(NvU32 gpcCount, NvU32 smCount, const struct rop_mig_scope* scoped)
+{
+	return scoped->status == ROP_OK && (scoped->gr.gpcCount < gpcCount || scoped->gr.smCount < smCount);
+}
+
+const char* rop_status_string(enum rop_status status)
+{
+	switch (status) {
+	case ROP_OK:
+		return "ok";
+	case ROP_ERR_OPEN:
+		return "device open failure";
+	case ROP_ERR_DEVICE:
+		return "device allocation failure";
+	case ROP_ERR_SUBDEVICE:
+		return "subdevice allocation failure";
+	case ROP_ERR_QUERY:
+		return "ROP count retrieval failure";
+	case ROP_ERR_TIMEOUT:
+		return "timeout";
+	case ROP_ERR_SUSPENDED:
+		return "runtime suspend";
+	}
+	return "unknown";
+}
+
+struct probe_pool
+{
+	const struct rop_session* session;
+	const int* device_indices;
+	unsigned flags;
+	struct rop_result* results;
+	int count;
+	int next; // next unclaimed slot, taken with an atomic increment
+};
+
+static void probe_one(const struct rop_session* session, int device_index, unsigned flags, struct rop_result* result)
+{
+	struct rop_gpu gpu;
+	struct affinity_saved saved = { .pinned = false };
+	memset(result, 0, sizeof(*result));
+	result->device_index = device_index;
+
+	// The whole attach/query/detach sequence runs on the GPU's own node
+	if (device_index >= 0 && device_index < session->device_count) {
+		affinity_pin(&session->devices[device_index], &saved);
+	}
+	result->status = rop_gpu_attach(session, device_index, &gpu);
+	if (result->status == ROP_ERR_OPEN) {
+		result->error = errno;
+		affinity_restore(&saved);
+		return;
+	}
+	if (result->status == ROP_OK) {
+		result->status = rop_gpu_query(session, &gpu, &result->rop);
+		if (result->status == ROP_OK && (flags & ROP_PROBE_GR_INFO)) {
+			result->status = rop_gpu_get_gr_info(session, &gpu, &result->gr);
+		}
+		if (result->status == ROP_OK && (flags & ROP_PROBE_VERDICT)) {
+			result->status = rop_gpu_judge(session, &gpu, result);
+		}
+		// The name is informational, a GPU RM cannot name still probed fine
+		if (result->status == ROP_OK && (flags & ROP_PROBE_NAME) &&
+		    rop_gpu_get_name(session, &gpu, result->name, sizeof(result->name)) != ROP_OK) {
+			result->name[0] = '\0';
+		}
+		rop_gpu_detach(session, &gpu);
+	}
+	affinity_restore(&saved);
+}
+
+static void* probe_worker(void* arg)
+{
+	struct probe_pool* pool = arg;
+	for (;;) {
+		int slot = __atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED);
+		if (slot >= pool->count) {
+			return NULL;
+		}
+		probe_one(pool->session, pool->device_indices[slot], pool->flags, &pool->results[slot]);
+	}
+}
+
+void rop_probe_parallel(const struct rop_session* session, const int* device_indices, int count, int jobs, unsigned flags, struct rop_result* results)
+{
+	struct probe_pool pool = {
+		.session = session,
+		.device_indices = device_indices,
+		.flags = flags,
+		.results = results,
+		.count = count,
+		.next = 0
+	};
+	pthread_t threads[ROP_MAX_GPUS];
+	int started = 0;
+
+	if (jobs > count) {
+		jobs = count;
+	}
+	if (jobs > ROP_MAX_GPUS) {
+		jobs = ROP_MAX_GPUS;
+	}
+	// The calling thread is one of the workers
+	for (int i = 1; i < jobs; ++i) {
+		if (pthread_create(&threads[started], NULL, probe_worker, &pool) != 0) {
+			break;
+		}
+		started++;
+	}
+	probe_worker(&pool);
+	for (int i = 0; i < started; ++i) {
+		pthread_join(threads[i], NULL);
+	}
+}
+
+// Shared between rop_probe_deadline and its workers. A worker still inside
+// the driver when the deadline passes keeps its reference, so the last one
+// out, caller or worker, frees the job.
+struct deadline_job
+{
+	pthread_mutex_t lock;
+	pthread_cond_t done; // signalled as each worker finishes
+	struct rop_session session; // a copy, the caller's may go out of scope
+	unsigned flags;
+	int pending;
+	int refs;
+	struct deadline_slot
+	{
+		struct deadline_job* job;
+		int device_index;
+		bool finished;
+		struct rop_result result;
+	} slots[ROP_MAX_GPUS];
+};
+
+static void deadline_job_put(struct deadline_job* job)
+{
+	// Called with job->lock held, which it releases
+	bool last = --job->refs == 0;
+	pthread_mutex_unlock(&job->lock);
+	if (last) {
+		pthread_cond_destroy(&job->done);
+		pthread_mutex_destroy(&job->lock);
+		free(job);
+	}
+}
+
+static void* deadline_worker(void* arg)
+{
+	struct deadline_slot* slot = arg;
+	struct deadline_job* job = slot->job;
+	struct rop_result result;
+
+	probe_one(&job->session, slot->device_index, job->flags, &result);
+
+	pthread_mutex_lock(&job->lock);
+	slot->result = result;
+	slot->finished = true;
+	job->pending--;
+	pthread_cond_signal(&job->done);
+	deadline_job_put(job);
+	return NULL;
+}
+
+int rop_probe_deadline(const struct rop_session* session, const int* device_indices, int count, unsigned timeout_ms, unsigned flags, struct rop_result* results)
+{
+	struct deadline_job* job = calloc(1, sizeof(*job));
+	pthread_condattr_t condattr;
+	pthread_attr_t attr;
+	struct timespec deadline;
+	int timed_out = 0;
+
+	if (count > ROP_MAX_GPUS) {
+		count = ROP_MAX_GPUS;
+	}
+	if (job == NULL) {
+		// Nothing to bound the probe with, but the caller still gets results
+		rop_probe_parallel(session, device_indices, count, count, flags, results);
+		return 0;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	deadline.tv_sec += timeout_ms / 1000;
+	deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000;
+	if (deadline.tv_nsec >= 1000000000) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000;
+	}
+
+	pthread_mutex_init(&job->lock, NULL);
+	pthread_condattr_init(&condattr);
+	pthread_condattr_setclock(&condattr, CLOCK_MONOTONIC);
+	pthread_cond_init(&job->done, &condattr);
+	pthread_condattr_destroy(&condattr);
+	job->session = *session;
+	job->flags = flags;
+	job->pending = count;
+	job->refs = count + 1;
+
+	// Detached, since a worker stuck in an ioctl is never joined
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	for (int i = 0; i < count; ++i) {
+		struct deadline_slot* slot = &job->slots[i];
+		pthread_t thread;
+		slot->job = job;
+		slot->device_index = device_indices[i];
+		if (pthread_create(&thread, &attr, deadline_worker, slot) != 0) {
+			deadline_worker(slot); // out of threads, probe this one unbounded
+		}
+	}
+	pthread_attr_destroy(&attr);
+
+	pthread_mutex_lock(&job->lock);
+	while (job->pending > 0) {
+		if (pthread_cond_timedwait(&job->done, &job->lock, &deadline) == ETIMEDOUT) {
+			break;
+		}
+	}
+	for (int i = 0; i < count; ++i) {
+		if (job->slots[i].finished) {
+			results[i] = job->slots[i].result;
+			continue;
+		}
+		memset(&results[i], 0, sizeof(results[i]));
+		results[i].device_index = device_indices[i];
+		results[i].status = ROP_ERR_TIMEOUT;
+		timed_out++;
+	}
+	deadline_job_put(job);
+	return timed_out;
+}
+
+// One rop_async_submit call. It sits on the work queue until every device
+// is claimed by a worker and moves to the done queue when the last finishes.
+struct async_request
+{
+	struct async_request* next;
+	int ticket;
+	unsigned flags;
+	int count;
+	int claimed;
+	int pending;
+	int device_indices[ROP_MAX_GPUS];
+	struct rop_result results[ROP_MAX_GPUS];
+};
+
+struct rop_async
+{
+	pthread_mutex_t lock;
+	pthread_cond_t work; // signalled on submit and on shutdown
+	struct rop_session session; // a copy, the caller's may go out of scope
+	int event_fd; // readable iff `done` is not empty, both change under `lock`
+	bool stopping;
+	int next_ticket;
+	struct async_request* queue;
+	struct async_request* queue_tail;
+	struct async_request* done;
+	struct async_request* done_tail;
+	int thread_count;
+	pthread_t threads[ROP_MAX_GPUS];
+};
+
+static void* async_worker(void* arg)
+{
+	struct rop_async* async = arg;
+
+	pthread_mutex_lock(&async->lock);
+	for (;;) {
+		while (!async->stopping && async->queue == NULL) {
+			pthread_cond_wait(&async->work, &async->lock);
+		}
+		if (async->stopping) {
+			break;
+		}
+		struct async_request* request = async->queue;
+		int slot = request->claimed++;
+		if (request->claimed == request->count) {
+			async->queue = request->next;
+			if (async->queue == NULL) {
+				async->queue_tail = NULL;
+			}
+			request->next = NULL;
+		}
+		pthread_mutex_unlock(&async->lock);
+
+		// Each slot is written by its worker only, outside the lock
+		probe_one(&async->session, request->device_indices[slot], request->flags, &request->results[slot]);
+
+		pthread_mutex_lock(&async->lock);
+		if (--request->pending == 0) {
+			if (async->done_tail != NULL) {
+				async->done_tail->next = request;
+			}
+			else {
+				async->done = request;
+			}
+			async->done_tail = request;
+			uint64_t one = 1;
+			if (write(async->event_fd, &one, sizeof(one)) != sizeof(one)) {
+				perror("Failed to signal the async probe eventfd");
+			}
+		}
+	}
+	pthread_mutex_unlock(&async->lock);
+	return NULL;
+}
+
+struct rop_async* rop_async_create(const struct rop_session* session, int jobs)
+{
+	struct rop_async* async = calloc(1, sizeof(*async));
+	if (async == NULL) {
+		return NULL;
+	}
+	async->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (async->event_fd == -1) {
+		perror("Failed to create the async probe eventfd");
+		free(async);
+		return NULL;
+	}
+	pthread_mutex_init(&async->lock, NULL);
+	pthread_cond_init(&async->work, NULL);
+	async->session = *session;
+
+	if (jobs < 1) {
+		jobs = 1;
+	}
+	if (jobs > ROP_MAX_GPUS) {
+		jobs = ROP_MAX_GPUS;
+	}
+	for (int i = 0; i < jobs; ++i) {
+		if (pthread_create(&async->threads[async->thread_count], NULL, async_worker, async) != 0) {
+			break;
+		}
+		async->thread_count++;
+	}
+	if (async->thread_count == 0) {
+		fprintf(stderr, "Failed to start async probe workers\n");
+		rop_async_destroy(async);
+		return NULL;
+	}
+	return async;
+}
+
+int rop_async_fd(const struct rop_async* async)
+{
+	return async->event_fd;
+}
+
+int rop_async_submit(struct rop_async* async, const int* device_indices, int count, unsigned flags)
+{
+	if (count < 1 || count > ROP_MAX_GPUS) {
+		errno = EINVAL;
+		return -1;
+	}
+	struct async_request* request = calloc(1, sizeof(*request));
+	if (request == NULL) {
+		return -1;
+	}
+	request->flags = flags;
+	request->count = count;
+	request->pending = count;
+	memcpy(request->device_indices, device_indices, sizeof(device_indices[0]) * (size_t)count);
+
+	pthread_mutex_lock(&async->lock);
+	// Tickets stay non-negative, the one after INT_MAX is 0 again
+	request->ticket = async->next_ticket;
+	async->next_ticket = async->next_ticket == INT_MAX ? 0 : async->next_ticket + 1;
+	if (async->queue_tail != NULL) {
+		async->queue_tail->next = request;
+	}
+	else {
+		async->queue = request;
+	}
+	async->queue_tail = request;
+	int ticket = request->ticket;
+	// Wake as many workers as there are devices to claim
+	if (count > 1) {
+		pthread_cond_broadcast(&async->work);
+	}
+	else {
+		pthread_cond_signal(&async->work);
+	}
+	pthread_mutex_unlock(&async->lock);
+	return ticket;
+}
+
+int rop_async_collect(struct rop_async* async, int* ticket, struct rop_result* results)
+{
+	pthread_mutex_lock(&async->lock);
+	struct async_request* request = async->done;
+	if (request == NULL) {
+		pthread_mutex_unlock(&async->lock);
+		errno = EAGAIN;
+		return -1;
+	}
+	async->done = request->next;
+	if (async->done == NULL) {
+		async->done_tail = NULL;
+		// Drains the counter so that the fd stops polling readable
+		uint64_t value;
+		if (read(async->event_fd, &value, sizeof(value)) != sizeof(value) && errno != EAGAIN) {
+			perror("Failed to reset the async probe eventfd");
+		}
+	}
+	pthread_mutex_unlock(&async->lock);
+
+	int count = request->count;
+	*ticket = request->ticket;
+	memcpy(results, request->results, sizeof(results[0]) * (size_t)count);
+	free(request);
+	return count;
+}
+
+static void async_free_list(struct async_request* request)
+{
+	while (request != NULL) {
+		struct async_request* next = request->next;
+		free(request);
+		request = next;
+	}
+}
+
+void rop_async_destroy(struct rop_async* async)
+{
+	if (async == NULL) {
+		return;
+	}
+	pthread_mutex_lock(&async->lock);
+	async->stopping = true;
+	pthread_cond_broadcast(&async->work);
+	pthread_mutex_unlock(&async->lock);
+	for (int i = 0; i < async->thread_count; ++i) {
+		pthread_join(async->threads[i], NULL);
+	}
+
+	// Partly claimed requests are still on the queue, finished ones on done
+	async_free_list(async->queue);
+	async_free_list(async->done);
+	close(async->event_fd);
+	pthread_cond_destroy(&async->work);
+	pthread_mutex_destroy(&async->lock);
+	free(async);
+}
+
+// Notifiers each subscription arms, in rop_events::hEvents order
+static const NvU32 event_notifiers[ROP_EVENT_NOTIFIER_COUNT] = {
+	NV2080_NOTIFIERS_RC_ERROR,
+	NV2080_NOTIFIERS_ECC_DBE,
+};
+
+bool rop_events_open(struct rop_events* events, const struct rop_session* session)
+{
+	const struct rop_backend* backend = session->backend;
+	memset(events, 0, sizeof(*events));
+	events->backend = backend;
+	events->hClient = session->hClient;
+	events->poll_fd = -1;
+
+	if (!open_nvidiactl(backend, &events->fd)) {
+		return false;
+	}
+	nv_ioctl_alloc_os_event_t request = {
+		.hClient = session->hClient,
+		.hDevice = session->hClient,
+		.fd = (NvU32)events->fd,
+		.Status = 0
+	};
+	if (rm_ioctl(backend, events->fd, NV_ESC_ALLOC_OS_EVENT, &request, sizeof(request)) != 0 || request.Status != NV_OK) {
+		fprintf(stderr, "Failed to allocate the RM event queue, RM status: 0x%x\n", request.Status);
+		backend->close(backend->ctx, events->fd);
+		events->fd = -1;
+		return false;
+	}
+	events->poll_fd = backend->poll_fd != NULL ? backend->poll_fd(backend->ctx, events->fd) : events->fd;
+	return true;
+}
+
+// Allocates one NV01_EVENT_OS_EVENT under the subdevice and arms its notifier
+static bool alloc_event(const struct rop_events* events, const struct rop_session* session, NvHandle hSubDevice, NvU32 notifyIndex, NvHandle* const hEvent)
+{
+	NV0005_ALLOC_PARAMETERS allocParams = {
+		.hParentClient = session->hClient,
+		.hSrcResource = hSubDevice,
+		.hClass = NV01_EVENT_OS_EVENT,
+		.notifyIndex = notifyIndex,
+		.data = (NvP64)(uintptr_t)events->fd
+	};
+	NVOS64_PARAMETERS request = {
+		.hRoot = session->hClient,
+		.hObjectParent = hSubDevice,
+		.hObjectNew = 0,
+		.hClass = NV01_EVENT_OS_EVENT,
+		.pAllocParms = &allocParams,
+		.pRightsRequested = NULL,
+		.paramsSize = sizeof(allocParams),
+		.flags = 0,
+		.status = 0
+	};
+
+	int attempt = 0;
+	do {
+		request.hObjectNew = 0;
+		request.status = 0;
+		if (rm_ioctl(session->backend, session->nvidiactl_fd, NV_ESC_RM_ALLOC, &request, sizeof(request)) != 0) {
+			perror("ioctl NV_ESC_RM_ALLOC (event) failed");
+			return false;
+		}
+	} while (rm_busy_backoff(request.status, &attempt));
+	if (request.status != 0) {
+		fprintf(stderr, "Failed to allocate event (notifier %u), RM status: 0x%x\n", notifyIndex, request.status);
+		return false;
+	}
+	*hEvent = request.hObjectNew;
+
+	NV2080_CTRL_EVENT_SET_NOTIFICATION_PARAMS notifyParams = {
+		.event = notifyIndex,
+		.action = NV2080_CTRL_EVENT_SET_NOTIFICATION_ACTION_REPEAT
+	};
+	return rm_control(session->backend, session->nvidiactl_fd, session->hClient, hSubDevice, NV2080_CTRL_CMD_EVENT_SET_NOTIFICATION,
+	                  &notifyParams, sizeof(notifyParams), "arm event notification");
+}
+
+enum rop_status rop_events_subscribe(struct rop_events* events, struct rop_session* session, int device_index)
+{
+	struct rop_gpu* gpu;
+	enum rop_status status = session_gpu(session, device_index, &gpu);
+	if (status != ROP_OK) {
+		return status;
+	}
+	if (events->subscribed[device_index] && events->generation[device_index] == gpu->generation) {
+		return ROP_OK;
+	}
+	rop_events_unsubscribe(events, session, device_index);
+	events->subscribed[device_index] = true; // so a partial subscription is freed
+	events->generation[device_index] = gpu->generation;
+	for (int i = 0; i < ROP_EVENT_NOTIFIER_COUNT; ++i) {
+		if (!alloc_event(events, session, gpu->hSubDevice, event_notifiers[i], &events->hEvents[device_index][i])) {
+			rop_events_unsubscribe(events, session, device_index);
+			return ROP_ERR_QUERY;
+		}
+	}
+	return ROP_OK;
+}
+
+void rop_events_unsubscribe(struct rop_events* events, const struct rop_session* session, int device_index)
+{
+	if (device_index < 0 || device_index >= ROP_MAX_GPUS || !events->subscribed[device_index]) {
+		return;
+	}
+	// After a detach RM has already freed them along with the subdevice
+	const struct rop_gpu* gpu = &session->gpus[device_index];
+	bool attached = gpu->nvidia_fd != -1 && gpu->generation == events->generation[device_index];
+	for (int i = 0; i < ROP_EVENT_NOTIFIER_COUNT; ++i) {
+		if (attached && events->hEvents[device_index][i] != 0) {
+			free_handle(session->backend, session->nvidiactl_fd, session->hClient, events->hEvents[device_index][i]);
+		}
+		events->hEvents[device_index][i] = 0;
+	}
+	events->subscribed[device_index] = false;
+}
+
+int rop_events_fd(const struct rop_events* events)
+{
+	return events->poll_fd;
+}
+
+static enum rop_event_kind event_kind(const NvUnixEvent* rm_event)
+{
+	if (rm_event->NotifyIndex == NV2080_NOTIFIERS_ECC_DBE) {
+		return ROP_EVENT_FATAL;
+	}
+	switch (rm_event->info32) {
+	case ROBUST_CHANNEL_GPU_HAS_FALLEN_OFF_THE_BUS:
+		return ROP_EVENT_LOST;
+	case ROBUST_CHANNEL_GPU_RECOVERY_ACTION_CHANGED:
+		return ROP_EVENT_RESET;
+	case 48:  // double bit ECC error
+	case 94:  // contained ECC error
+	case 95:  // uncontained ECC error
+	case 119: // GSP RPC timeout
+	case 120: // GSP error
+		return ROP_EVENT_FATAL;
+	}
+	return ROP_EVENT_XID;
+}
+
+int rop_events_read(struct rop_events* events, struct rop_event* out, int max)
+{
+	int count = 0;
+	while (count < max) {
+		NvUnixEvent rm_event;
+		memset(&rm_event, 0, sizeof(rm_event));
+		NVOS41_PARAMETERS request = {
+			.pEvent = &rm_event,
+			.MoreEvents = 0,
+			.status = 0
+		};
+		if (rm_ioctl(events->backend, events->fd, NV_ESC_RM_GET_EVENT_DATA, &request, sizeof(request)) != 0) {
+			perror("ioctl NV_ESC_RM_GET_EVENT_DATA failed");
+			return count > 0 ? count : -1;
+		}
+		if (request.status != NV_OK) {
+			break; // the queue is empty
+		}
+
+		// The event carries no parent, only the event object it fired on
+		int device_index = -1;
+		for (int i = 0; i < ROP_MAX_GPUS && device_index < 0; ++i) {
+			for (int j = 0; j < ROP_EVENT_NOTIFIER_COUNT && events->subscribed[i]; ++j) {
+				if (events->hEvents[i][j] != 0 && events->hEvents[i][j] == rm_event.hObject) {
+					device_index = i;
+					break;
+				}
+			}
+		}
+		if (device_index >= 0) {
+			out[count].device_index = device_index;
+			out[count].kind = event_kind(&rm_event);
+			out[count].xid = rm_event.NotifyIndex == NV2080_NOTIFIERS_RC_ERROR ? rm_event.info32 : 0;
+			count++;
+		}
+		if (!request.MoreEvents) {
+			break;
+		}
+	}
+	return count;
+}
+
+void rop_events_close(struct rop_events* events, const struct rop_session* session)
+{
+	if (events->fd == -1) {
+		return;
+	}
+	for (int i = 0; i < ROP_MAX_GPUS; ++i) {
+		rop_events_unsubscribe(events, session, i);
+	}
+	nv_ioctl_free_os_event_t request = {
+		.hClient = events->hClient,
+		.hDevice = events->hClient,
+		.fd = (NvU32)events->fd,
+		.Status = 0
+	};
+	rm_ioctl(events->backend, events->fd, NV_ESC_FREE_OS_EVENT, &request, sizeof(request));
+	events->backend->close(events->backend->ctx, events->fd);
+	events->fd = -1;
+	events->poll_fd = -1;
+}
+
+const char* rop_event_kind_string(enum rop_event_kind kind)
+{
+	switch (kind) {
+	case ROP_EVENT_XID:
+		return "Xid";
+	case ROP_EVENT_FATAL:
+		return "fatal error";
+	case ROP_EVENT_RESET:
+		return "reset";
+	case ROP_EVENT_LOST:
+		return "GPU lost";
+	}
+	return "unknown";
+}
@@ -0,0 +1,473 @@
+#ifndef LIBROP_H
+#define LIBROP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "nvrm.h"
+
+// librop: ROP count probe over the NVIDIA RM ioctl interface.
+//
+// A rop_session owns /dev/nvidiactl and one RM client, and enumerates the
+// GPUs through RM when it is opened. GPUs are attached once (open
+// /dev/nvidia<minor>, allocate device and subdevice) and can then be queried
+// any number of times until the session is closed. Device indexes used
+// throughout are positions in the session's device table, ordered by minor.
+// RM calls answered with NV_ERR_BUSY_RETRY are retried a few times with
+// exponential backoff before they count as failed.
+
+#define ROP_MAX_GPUS 32
+#define ROP_GPU_NAME_LENGTH NV2080_GPU_MAX_NAME_STRING_LENGTH
+
+enum rop_status
+{
+	ROP_OK = 0,
+	ROP_ERR_OPEN,      // no such device, or open/NV_ESC_REGISTER_FD failed, errno is set
+	ROP_ERR_DEVICE,    // NV01_DEVICE_0 allocation failed
+	ROP_ERR_SUBDEVICE, // NV20_SUBDEVICE_0 allocation failed
+	ROP_ERR_QUERY,     // GR_GET_ROP_INFO or GR_GET_INFO control failed
+	ROP_ERR_TIMEOUT,   // still inside the driver when rop_probe_deadline gave up
+	ROP_ERR_SUSPENDED, // runtime-suspended and left asleep, see rop_session::no_wake
+};
+
+enum rop_verdict
+{
+	ROP_VERDICT_UNKNOWN = 0, // SKU not in the expected-count table
+	ROP_VERDICT_PASS,        // at least the expected ropOperationsCount
+	ROP_VERDICT_DEFICIENT,   // fewer ROPs than the SKU ships with
+};
+
+// Graphics engine unit inventory, fetched with one batched GR_GET_INFO control
+struct rop_gr_info
+{
+	NvU32 gpcCount;
+	NvU32 tpcCount;
+	NvU32 smCount;
+	NvU32 coreCount;
+	NvU32 fbpCount;
+	NvU32 zcullBankCount;
+};
+
+// Everything librop does to the driver goes through a backend. The kernel
+// backend talks to the real device nodes; src/fakerm.c simulates the RM.
+struct rop_backend
+{
+	const char* name;
+	int (*open)(void* ctx, const char* path, int flags);
+	int (*close)(void* ctx, int fd);
+	int (*ioctl)(void* ctx, int fd, unsigned long request, void* arg);
+	int (*access)(void* ctx, const char* path, int mode);
+	// Returns the fd to poll(2) for events queued on a backend fd after
+	// NV_ESC_ALLOC_OS_EVENT; NULL means the backend fd itself
+	int (*poll_fd)(void* ctx, int fd);
+	void* ctx;
+};
+
+extern const struct rop_backend rop_kernel_backend;
+
+// Backend used by rop_session_open: the fake RM if ROP_FAKE_RM is set in
+// the environment (see src/fakerm.h for the spec), the kernel otherwise.
+// NULL if ROP_FAKE_RM is set but invalid.
+const struct rop_backend* rop_default_backend(void);
+
+// A GPU found by enumeration; nothing is opened to fill this in
+struct rop_device
+{
+	NvU32 gpuId;
+	int minor; // /dev/nvidia<minor>
+	NvU32 domain;
+	NvU8 bus;
+	NvU8 slot;
+	NvU8 function;
+	NvU16 vendorId;
+	NvU16 pciDeviceId;
+	char busId[16]; // "0000:01:00.0"
+};
+
+struct rop_gpu
+{
+	int device_index;
+	int nvidia_fd; // -1 while not attached
+	NvU32 deviceInstance;
+	NvHandle hDevice;
+	NvHandle hSubDevice;
+	uint32_t generation; // distinct for every attach, RM reuses handles
+};
+
+struct rop_session
+{
+	const struct rop_backend* backend;
+	int nvidiactl_fd;
+	NvHandle hClient;
+	int device_count;
+	struct rop_device devices[ROP_MAX_GPUS];
+	struct rop_gpu gpus[ROP_MAX_GPUS]; // attached lazily by rop_session_query
+	// Set after opening to leave runtime-suspended GPUs asleep: opening
+	// /dev/nvidia<minor> or issuing a control resumes a GPU from D3, so GPUs
+	// whose sysfs runtime_status is suspended fail with ROP_ERR_SUSPENDED
+	// instead of being attached or queried.
+	bool no_wake;
+};
+
+// Opens /dev/nvidiactl, allocates the RM client and enumerates the GPUs:
+// RM's probed GPU IDs are mapped to minor numbers and PCI addresses with
+// NV_ESC_CARD_INFO, and GPUs whose device node is absent (e.g. not exposed
+// to this container) are left out.
+bool rop_session_open(struct rop_session* session);
+bool rop_session_open_backend(struct rop_session* session, const struct rop_backend* backend);
+
+// Frees every cached GPU, the client, and closes /dev/nvidiactl.
+void rop_session_close(struct rop_session* session);
+
+// Queries the ROP info of devices[device_index], attaching it on first use.
+// A GPU that fails to attach is not cached and is retried on the next call.
+enum rop_status rop_session_query(struct rop_session* session, int device_index, NV2080_CTRL_GR_GET_ROP_INFO_PARAMS* ropParams);
+
+// Fetches the GR unit inventory of an attached GPU in a single RM control.
+enum rop_status rop_session_get_gr_info(struct rop_session* session, int device_index, struct rop_gr_info* grInfo);
+
+// Reads the marketing name (e.g. "NVIDIA GeForce RTX 5070 Ti") from RM over
+// the GPU's subdevice, so no NVML initialization is needed. `name` holds at
+// least ROP_GPU_NAME_LENGTH bytes for the full string.
+enum rop_status rop_session_get_name(struct rop_session* session, int device_index, char* name, size_t name_size);
+
+// Lower level API for callers that manage their own GPU handles. The session
+// is only read, so several threads may attach and query distinct rop_gpu
+// objects over one session concurrently.
+enum rop_status rop_gpu_attach(const struct rop_session* session, int device_index, struct rop_gpu* gpu);
+enum rop_status rop_gpu_query(const struct rop_session* session, const struct rop_gpu* gpu, NV2080_CTRL_GR_GET_ROP_INFO_PARAMS* ropParams);
+enum rop_status rop_gpu_get_gr_info(const struct rop_session* session, const struct rop_gpu* gpu, struct rop_gr_info* grInfo);
+enum rop_status rop_gpu_get_name(const struct rop_session* session, const struct rop_gpu* gpu, char* name, size_t name_size);
+void rop_gpu_detach(const struct rop_session* session, struct rop_gpu* gpu);
+
+// MIG (Multi-Instance GPU) partitions. The whole-GPU queries above report
+// every GPC; what a GPU instance (GI) or compute instance (CI) received is
+// only visible to a client subscribed to it, for which RM scopes
+// GR_GET_ROP_INFO and GR_GET_INFO to the instance's own GPCs.
+//
+// rop_gpu_get_mig_instances lists the GPU's GIs with GPU_GET_PARTITIONS,
+// then subscribes a short-lived client to each GI, and in turn to each of
+// its CIs, to read their scoped ROP info and GR units. It returns ROP_OK with
+// *count 0 when MIG mode is off. Listing every instance needs a privileged
+// client (root), as for nvidia-smi mig -lgi. Per-instance failures are
+// reported in rop_mig_scope::status.
+#define ROP_MAX_MIG_INSTANCES 8 // NV2080_CTRL_GPU_MAX_PARTITIONS
+#define ROP_MAX_MIG_COMPUTE 8   // NVC637_CTRL_MAX_EXEC_PARTITIONS
+
+struct rop_mig_scope
+{
+	enum rop_status status;
+	NV2080_CTRL_GR_GET_ROP_INFO_PARAMS rop;
+	struct rop_gr_info gr;
+};
+
+struct rop_mig_compute
+{
+	NvU32 id;       // CI ID within its GI
+	NvU32 gpcCount; // as configured, compare with scoped.gr
+	NvU32 smCount;
+	struct rop_mig_scope scoped;
+};
+
+struct rop_mig_instance
+{
+	NvU32 swizzId;  // GI ID
+	NvU32 gpcCount; // as configured, compare with scoped.gr
+	NvU32 smCount;
+	struct rop_mig_scope scoped;
+	int compute_count;
+	struct rop_mig_compute compute[ROP_MAX_MIG_COMPUTE];
+};
+
+enum rop_status rop_session_get_mig_instances(struct rop_session* session, int device_index, struct rop_mig_instance* instances, int* count);
+enum rop_status rop_gpu_get_mig_instances(const struct rop_session* session, const struct rop_gpu* gpu, struct rop_mig_instance* instances, int* count);
+
+// True if the scoped GR units fall short of what the instance was configured with
+bool rop_mig_reduced(NvU32 gpcCount, NvU32 smCount, const struct rop_mig_scope* scoped);
+
+const char* rop_status_string(enum rop_status status);
+
+// Expected ROP counts (src/expected.c). A compile-time table keyed by PCI
+// vendor, device and subsystem ID gives the ropOperationsCount each SKU
+// ships with; subsystem 0 in an entry matches any board.
+//
+// rop_expected_load reads an override file, to be called once at startup
+// before probing. Each line is "vendor:device[:subsystem] count" in hex
+// (count in decimal), e.g. "10de:2c05 96"; '#' starts a comment. Overrides
+// win over the built-in table.
+bool rop_expected_load(const char* path);
+NvU32 rop_expected_count(NvU16 vendorId, NvU16 deviceId, NvU32 subsystemId);
+bool rop_expected_uses_subsystem(void); // any entry is board specific
+enum rop_verdict rop_verdict_for(NvU32 expectedCount, NvU32 ropOperationsCount);
+const char* rop_verdict_string(enum rop_verdict verdict);
+
+struct rop_result
+{
+	int device_index;
+	enum rop_status status;
+	int error; // errno of a failed open, 0 otherwise
+	NV2080_CTRL_GR_GET_ROP_INFO_PARAMS rop;
+	struct rop_gr_info gr; // only with ROP_PROBE_GR_INFO
+	char name[ROP_GPU_NAME_LENGTH]; // only with ROP_PROBE_NAME, empty if RM has none
+	NvU32 expectedCount;            // only with ROP_PROBE_VERDICT, 0 if unknown
+	enum rop_verdict verdict;       // only with ROP_PROBE_VERDICT
+};
+
+#define ROP_PROBE_GR_INFO 0x1 // also fetch the GR unit inventory
+#define ROP_PROBE_NAME 0x2    // also fetch the marketing name
+#define ROP_PROBE_VERDICT 0x4 // also judge the count against the SKU table
+
+// Fills result->expectedCount and result->verdict for a successfully probed
+// GPU. The subsystem ID is only fetched (one BUS_GET_PCI_INFO control) when
+// some table entry needs it.
+enum rop_status rop_gpu_judge(const struct rop_session* session, const struct rop_gpu* gpu, struct rop_result* result);
+enum rop_status rop_session_judge(struct rop_session* session, int device_index, struct rop_result* result);
+
+// Reads a GPU's UUID ("GPU-xxxxxxxx-xxxx-xxxx-xxxx-xxxxxxxxxxxx") with a
+// control on the session's client, without opening the GPU's device node.
+// Needs an open session, not one filled by rop_cache_load.
+#define ROP_GPU_UUID_LENGTH 64
+enum rop_status rop_session_get_uuid(const struct rop_session* session, int device_index, char* uuid, size_t uuid_size);
+
+// GPU selection (src/select.c). Resolves a comma-separated list of
+// selectors against the session's device table, which RM filled without
+// opening any GPU, so that only the selected GPUs are then attached:
+//   3                      device index
+//   nvidia3, /dev/nvidia3  device minor
+//   0000:01:00.0, 01:00.0  PCI bus ID, the domain defaults to 0000
+//   GPU-<uuid>             UUID, see rop_session_get_uuid
+// Stores the selected device indexes in ascending order (duplicates
+// collapse) and returns how many there are, or -1 after printing which
+// selector matched no GPU.
+int rop_select_devices(const struct rop_session* session, const char* selectors, int* device_indices);
+bool rop_select_needs_session(const char* selectors); // has a UUID selector
+
+// Boot-scoped result cache (src/cache.c). The ROP count cannot change
+// without a reboot or driver reload, so results are kept in
+// ROP_CACHE_DEFAULT_DIR (or $ROP_CACHE_DIR), keyed by the boot ID, the
+// driver version and the bus ID of every GPU, all read from /proc.
+//
+// rop_cache_load fills the session's device table and results[device_index]
+// without opening /dev/nvidiactl, and returns the bit mask of device indexes
+// with cached results carrying at least `flags`; 0 on a miss. The session is
+// left unopened, rop_session_close on it is a no-op. rop_cache_store merges
+// the successful results[0..count) into the cache and replaces it atomically;
+// it silently does nothing if the directory is not writable.
+#define ROP_CACHE_DEFAULT_DIR "/run/rop"
+#define ROP_DEVICE_MASK(count) ((count) >= 32 ? 0xFFFFFFFFu : (1u << (count)) - 1)
+uint32_t rop_cache_load(struct rop_session* session, unsigned flags, struct rop_result* results);
+void rop_cache_store(const struct rop_session* session, unsigned flags, const struct rop_result* results, int count);
+
+// Shared-memory result board (src/board.c). A resident prober (ropd --board)
+// publishes the latest result of every GPU into a POSIX shared memory
+// segment (/dev/shm/<name>), and any number of local readers map it once and
+// then take consistent snapshots with plain loads: no syscalls, no locks, and
+// readers never delay the writer or each other.
+//
+// Consistency comes from a seqlock. The single writer makes `sequence` odd,
+// updates the entries, and makes it even again; a reader copies the board and
+// retries if the sequence was odd or changed meanwhile. The layout is fixed
+// size, host byte order, and versioned for readers built separately.
+#define ROP_BOARD_DEFAULT_NAME "/rop-board"
+#define ROP_BOARD_MAGIC 0x42504f52 // "ROPB"
+#define ROP_BOARD_VERSION 1
+
+struct rop_board_entry
+{
+	uint32_t status;  // enum rop_status
+	uint32_t verdict; // enum rop_verdict
+	NV2080_CTRL_GR_GET_ROP_INFO_PARAMS rop;
+	NvU32 expectedCount;
+	uint64_t timestamp_ns; // CLOCK_REALTIME of the probe
+	char busId[16];
+};
+
+struct rop_board
+{
+	uint32_t magic;      // ROP_BOARD_MAGIC
+	uint32_t version;    // ROP_BOARD_VERSION
+	uint32_t sequence;   // odd while the writer is updating
+	uint32_t writer_pid; // 0 once the writer has shut down
+	uint32_t device_count;
+	uint32_t reserved;
+	struct rop_board_entry entries[ROP_MAX_GPUS];
+};
+
+// Writer side: creates or takes over the segment, and publishes entries[0..count)
+struct rop_board* rop_board_create(const char* name);
+void rop_board_publish(struct rop_board* board, const struct rop_board_entry* entries, int count);
+void rop_board_destroy(struct rop_board* board, const char* name); // also unlinks it
+
+// Reader side: maps the segment read-only, NULL if there is no such board or
+// it has another layout. rop_board_read copies a consistent snapshot and
+// returns false if the writer stayed mid-update for the whole retry budget.
+const struct rop_board* rop_board_open(const char* name);
+bool rop_board_read(const struct rop_board* board, struct rop_board* snapshot);
+void rop_board_close(const struct rop_board* board);
+
+// Probe thread placement (src/affinity.c), for rop_probe_parallel and
+// rop_probe_deadline. With `numa_local`, each GPU is attached, queried and
+// detached on a thread pinned to the CPUs of the GPU's NUMA node, read from
+// the numa_node and local_cpulist attributes of its PCI device in sysfs
+// ($ROP_SYSFS_ROOT, /sys by default). `exclude_cpus` is a CPU list like
+// "0-7,64-71" that probe threads never run on, e.g. CPUs reserved for
+// workloads; NULL for none. Where excluding leaves no local CPU, the GPU is
+// probed from any other allowed CPU. Call once before probing; false if the
+// list does not parse.
+bool rop_probe_set_affinity(bool numa_local, const char* exclude_cpus);
+int rop_device_numa_node(const struct rop_device* device); // -1 if unknown
+
+// Runtime power state of a GPU from its PCI device's power/runtime_status
+enum rop_power_state
+{
+	ROP_POWER_UNKNOWN = 0, // no runtime PM for the device, or no sysfs
+	ROP_POWER_ACTIVE,
+	ROP_POWER_SUSPENDED,   // in (or entering) D3, an open would resume it
+};
+enum rop_power_state rop_device_power_state(const struct rop_device* device);
+
+// Probes device_indices[0..count) on up to `jobs` worker threads and stores
+// the outcome of device_indices[i] in results[i]. Each worker attaches its
+// own fd and handles and frees them again, so nothing is cached in the session.
+void rop_probe_parallel(const struct rop_session* session, const int* device_indices, int count, int jobs, unsigned flags, struct rop_result* results);
+
+// Like rop_probe_parallel with one worker per device, but returns after at
+// most `timeout_ms` and marks the devices not done by then ROP_ERR_TIMEOUT,
+// so a hung GPU cannot stall the others. Returns the number of timeouts.
+// Late workers are abandoned, not cancelled: they still use the session's
+// client and /dev/nvidiactl, so the caller must not rop_session_close a
+// session with timed out devices (exiting the process is fine).
+int rop_probe_deadline(const struct rop_session* session, const int* device_indices, int count, unsigned timeout_ms, unsigned flags, struct rop_result* results);
+
+// Asynchronous probing for event loops. rop_async_create starts `jobs`
+// worker threads probing over a copy of `session`, which must stay open
+// until rop_async_destroy. rop_async_submit queues a probe of
+// device_indices[0..count) and returns its ticket (>= 0), or -1 with errno
+// set. Devices are probed like rop_probe_parallel, across submissions in
+// submission order. rop_async_fd is a non-blocking eventfd, readable while
+// completed submissions wait to be collected: add it to epoll/poll with
+// EPOLLIN and call rop_async_collect until it fails. rop_async_collect moves
+// one completed submission's results, in submission order, into results,
+// stores its ticket and returns the result count; -1 with errno EAGAIN if
+// none has completed. rop_async_destroy drops queued devices not yet
+// started, waits for the ones in flight and frees everything.
+struct rop_async;
+struct rop_async* rop_async_create(const struct rop_session* session, int jobs);
+int rop_async_fd(const struct rop_async* async);
+int rop_async_submit(struct rop_async* async, const int* device_indices, int count, unsigned flags);
+int rop_async_collect(struct rop_async* async, int* ticket, struct rop_result* results);
+void rop_async_destroy(struct rop_async* async);
+
+// RM event notifications, so results cached on a session's held handles can
+// be invalidated when something happens to a GPU instead of being polled.
+// rop_events_open opens a second /dev/nvidiactl fd and turns it into an RM
+// event queue. rop_events_subscribe allocates NV01_EVENT_OS_EVENT objects
+// for Xid (RC error) and uncorrectable ECC notifications on an attached
+// GPU's subdevice and arms them. Poll rop_events_fd for POLLIN, then
+// rop_events_read dequeues up to `max` events and returns how many, -1 on
+// error. An event's GPU should be re-attached before it is trusted again:
+// rop_events_unsubscribe it, rop_gpu_detach it, probe, and subscribe anew.
+// Event objects are children of the subdevice, so detaching frees them too.
+enum rop_event_kind
+{
+	ROP_EVENT_XID = 0, // any other Xid
+	ROP_EVENT_FATAL,   // uncorrectable ECC or a GPU/GSP fatal error
+	ROP_EVENT_RESET,   // RM changed the GPU's recovery action, e.g. reset needed
+	ROP_EVENT_LOST,    // the GPU fell off the bus
+};
+
+struct rop_event
+{
+	int device_index;
+	enum rop_event_kind kind;
+	NvU32 xid; // RC error code, 0 for ECC events
+};
+
+#define ROP_EVENT_NOTIFIER_COUNT 2
+
+struct rop_events
+{
+	const struct rop_backend* backend;
+	int fd;      // the event queue, a /dev/nvidiactl fd
+	int poll_fd; // what to poll, fd itself on the kernel backend
+	NvHandle hClient;
+	bool subscribed[ROP_MAX_GPUS];
+	uint32_t generation[ROP_MAX_GPUS]; // of the attach the events hang off
+	NvHandle hEvents[ROP_MAX_GPUS][ROP_EVENT_NOTIFIER_COUNT];
+};
+
+bool rop_events_open(struct rop_events* events, const struct rop_session* session);
+enum rop_status rop_events_subscribe(struct rop_events* events, struct rop_session* session, int device_index);
+void rop_events_unsubscribe(struct rop_events* events, const struct rop_session* session, int device_index);
+int rop_events_fd(const struct rop_events* events);
+int rop_events_read(struct rop_events* events, struct rop_event* out, int max);
+void rop_events_close(struct rop_events* events, const struct rop_session* session); // before rop_session_close
+const char* rop_event_kind_string(enum rop_event_kind kind);
+
+// Phase timing. Once enabled, librop accumulates the monotonic-clock time,
+// call count and ioctl count of each step of opening a session and probing
+// a GPU into `timing`, per GPU for the steps taken on a GPU. Off (NULL) by
+// default; set it before opening a session and zero it between runs. The
+// cost when off is one pointer test per step.
+enum rop_phase
+{
+	ROP_PHASE_OPEN_CTL = 0,    // open /dev/nvidiactl
+	ROP_PHASE_ALLOC_CLIENT,    // NV01_ROOT allocation
+	ROP_PHASE_ENUMERATE,       // probed IDs and NV_ESC_CARD_INFO
+	ROP_PHASE_OPEN_DEVICE,     // open /dev/nvidia<minor>
+	ROP_PHASE_REGISTER_FD,     // NV_ESC_REGISTER_FD
+	ROP_PHASE_ID_INFO,         // GPU_GET_ID_INFO_V2 for the device instance
+	ROP_PHASE_ALLOC_DEVICE,    // NV01_DEVICE_0 allocation
+	ROP_PHASE_ALLOC_SUBDEVICE, // NV20_SUBDEVICE_0 allocation
+	ROP_PHASE_ROP_INFO,        // GR_GET_ROP_INFO
+	ROP_PHASE_GR_INFO,         // GR_GET_INFO
+	ROP_PHASE_NAME,            // GPU_GET_NAME_STRING
+	ROP_PHASE_PCI_INFO,        // BUS_GET_PCI_INFO
+	ROP_PHASE_FREE,            // NV_ESC_RM_FREE of the handles
+	ROP_PHASE_CLOSE,           // close of the fd
+	ROP_PHASE_COUNT
+};
+
+struct rop_phase_time
+{
+	uint64_t ns;
+	uint32_t calls;
+	uint32_t ioctls; // including NV_ERR_BUSY_RETRY retries
+};
+
+struct rop_timing
+{
+	struct rop_phase_time session[ROP_PHASE_COUNT]; // client and /dev/nvidiactl
+	struct rop_phase_time gpus[ROP_MAX_GPUS][ROP_PHASE_COUNT]; // by device index
+};
+
+void rop_timing_enable(struct rop_timing* timing);
+const char* rop_phase_string(enum rop_phase phase);
+
+// Ioctl tracing. Once enabled, every ioctl librop issues is recorded into
+// the caller's preallocated `events`, with no allocation or I/O on the probe
+// path; write them out when done (src/trace.c). Concurrent probes append
+// lock-free. count keeps counting past capacity, the excess is dropped.
+struct rop_trace_event
+{
+	uint64_t start_ns;    // CLOCK_MONOTONIC
+	uint32_t duration_ns;
+	int tid;
+	int escape;           // NV_ESC_*
+	int result;           // errno of a failed ioctl, 0 otherwise
+	NvHandle handle;      // new, controlled or freed object; the nvidiactl fd for NV_ESC_REGISTER_FD
+	NvU32 code;           // class of an allocation, cmd of a control
+	NvV32 status;         // RM status
+};
+
+struct rop_trace
+{
+	struct rop_trace_event* events;
+	uint32_t capacity;
+	uint32_t count;
+};
+
+void rop_trace_enable(struct rop_trace* trace);
+
+#endif
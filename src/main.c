@@ -0,0 +1,64 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "main.h"
+
+// bin/rop is a multi-call binary: the tool is picked from the name it was
+// started as (bin/ropmulti, bin/ropnvml, bin/ropd and bin/ropstress are
+// symlinks to it), or from a subcommand, e.g. `rop multi --jobs 4`.
+
+struct command
+{
+	const char* name;    // subcommand
+	const char* program; // argv[0] basename
+	int (*main)(int argc, char** argv);
+	const char* summary;
+};
+
+static const struct command commands[] = {
+	{ "rop", "rop", rop_main, "ROP count of the first GPU" },
+	{ "multi", "ropmulti", ropmulti_main, "ROP count of every GPU" },
+	{ "nvml", "ropnvml", ropnvml_main, "ROP count and name of every GPU" },
+	{ "ropd", "ropd", ropd_main, "daemon serving ROP queries over a Unix socket" },
+	{ "stress", "ropstress", ropstress_main, "RM call load generator for choosing a probe rate" },
+};
+
+#define COMMAND_COUNT (int)(sizeof(commands) / sizeof(commands[0]))
+
+static void usage(const char* argv0)
+{
+	fprintf(stderr, "Usage: %s [COMMAND] [OPTIONS]\n", argv0);
+	for (int i = 0; i < COMMAND_COUNT; ++i) {
+		fprintf(stderr, "  %-6s %s\n", commands[i].name, commands[i].summary);
+	}
+	fprintf(stderr, "Without a command, %s runs `rop`. `%s COMMAND --help` lists its options.\n", argv0, argv0);
+}
+
+int main(int argc, char** argv)
+{
+	const char* slash = strrchr(argv[0], '/');
+	const char* program = slash != NULL ? slash + 1 : argv[0];
+
+	for (int i = 0; i < COMMAND_COUNT; ++i) {
+		if (commands[i].main != rop_main && strcmp(program, commands[i].program) == 0) {
+			return commands[i].main(argc, argv);
+		}
+	}
+
+	if (argc > 1) {
+		if (strcmp(argv[1], "help") == 0 || strcmp(argv[1], "--help") == 0 || strcmp(argv[1], "-h") == 0) {
+			usage(argv[0]);
+			return 0;
+		}
+		for (int i = 0; i < COMMAND_COUNT; ++i) {
+			if (strcmp(argv[1], commands[i].name) == 0) {
+				// Usage messages then read e.g. "rop multi [--jobs N]"
+				char name[256];
+				snprintf(name, sizeof(name), "%s %s", argv[0], commands[i].name);
+				argv[1] = name;
+				return commands[i].main(argc - 1, argv + 1);
+			}
+		}
+	}
+	return rop_main(argc, argv);
+}
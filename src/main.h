@@ -0,0 +1,11 @@
+#ifndef MAIN_H
+#define MAIN_H
+
+// Entry points of the tools bundled in the multi-call bin/rop, see main.c
+int rop_main(int argc, char** argv);
+int ropmulti_main(int argc, char** argv);
+int ropnvml_main(int argc, char** argv);
+int ropd_main(int argc, char** argv);
+int ropstress_main(int argc, char** argv);
+
+#endif
@@ -0,0 +1,385 @@
+#ifndef NVRM_H
+#define NVRM_H
+
+#include <stdint.h>
+
+// Subset of the NVIDIA resource manager (RM) ioctl ABI used by the ROP probe.
+// Layouts mirror the open-gpu-kernel-modules SDK headers.
+
+#define NV_ALIGN_BYTES(size) __attribute__ ((aligned (size)))
+#define NV_DECLARE_ALIGNED(TYPE_VAR, ALIGN) TYPE_VAR __attribute__ ((aligned (ALIGN)))
+
+typedef unsigned __INT32_TYPE__ NvV32;
+typedef unsigned __INT32_TYPE__ NvU32;
+typedef NvU32 NvHandle;
+typedef void* NvP64;
+typedef uint64_t NvU64;
+typedef uint16_t NvU16;
+typedef uint8_t NvU8;
+typedef int32_t NvS32;
+typedef NvU8 NvBool;
+
+#define NV_IOCTL_MAGIC 'F'
+#define NV_IOCTL_BASE 200
+#define NV_ESC_CARD_INFO (NV_IOCTL_BASE + 0)
+#define NV_ESC_REGISTER_FD (NV_IOCTL_BASE + 1)
+#define NV_ESC_ALLOC_OS_EVENT (NV_IOCTL_BASE + 6)
+#define NV_ESC_FREE_OS_EVENT (NV_IOCTL_BASE + 7)
+#define NV_ESC_RM_FREE 0x29
+#define NV_ESC_RM_CONTROL 0x2A
+#define NV_ESC_RM_ALLOC 0x2B
+#define NV_ESC_RM_GET_EVENT_DATA 0x52
+
+// RM status codes (nvstatuscodes.h)
+#define NV_OK 0x00000000
+#define NV_ERR_BUSY_RETRY 0x00000003
+#define NV_ERR_GPU_IS_LOST 0x0000000F
+#define NV_ERR_INSUFFICIENT_RESOURCES 0x0000001A
+#define NV_ERR_INVALID_ARGUMENT 0x0000001F
+#define NV_ERR_INVALID_CLASS 0x00000022
+#define NV_ERR_INVALID_CLIENT 0x00000023
+#define NV_ERR_INVALID_OBJECT_HANDLE 0x00000033
+#define NV_ERR_INVALID_OBJECT_PARENT 0x00000036
+#define NV_ERR_INVALID_PARAM_STRUCT 0x00000039
+#define NV_ERR_INVALID_STATE 0x00000040
+#define NV_ERR_NOT_SUPPORTED 0x00000056
+#define NV_ERR_OBJECT_NOT_FOUND 0x00000057
+#define NV_ERR_GENERIC 0x0000FFFF
+
+#define NV01_ROOT 0x0U
+#define NV01_DEVICE_0 0x80U
+#define NV20_SUBDEVICE_0 0x2080U
+#define NV01_EVENT_OS_EVENT 0x79U
+// Allocating these subscribes the client to a MIG GPU instance (under a
+// subdevice) or to a compute instance (under the GPU instance reference)
+#define AMPERE_SMC_PARTITION_REF 0xC637U
+#define AMPERE_SMC_EXEC_PARTITION_REF 0xC638U
+
+// Subdevice notifier indexes (cl2080_notification.h) and the RC error codes
+// (Xids) RM reports in an RC_ERROR event's info32
+#define NV2080_NOTIFIERS_ECC_DBE 81
+#define NV2080_NOTIFIERS_RC_ERROR 128
+#define ROBUST_CHANNEL_GPU_HAS_FALLEN_OFF_THE_BUS 79
+#define ROBUST_CHANNEL_GPU_RECOVERY_ACTION_CHANGED 154
+
+#define NV2080_CTRL_CMD_EVENT_SET_NOTIFICATION 0x20800301
+#define NV2080_CTRL_EVENT_SET_NOTIFICATION_ACTION_DISABLE 0
+#define NV2080_CTRL_EVENT_SET_NOTIFICATION_ACTION_SINGLE 1
+#define NV2080_CTRL_EVENT_SET_NOTIFICATION_ACTION_REPEAT 2
+
+// Controls on the client (NV01_ROOT) object
+#define NV0000_CTRL_CMD_GPU_GET_ID_INFO_V2 0x205
+#define NV0000_CTRL_CMD_GPU_GET_PROBED_IDS 0x214
+#define NV0000_CTRL_GPU_MAX_PROBED_GPUS 32
+#define NV0000_CTRL_GPU_INVALID_ID 0xFFFFFFFFU
+#define NV0000_CTRL_CMD_GPU_GET_UUID_FROM_GPU_ID 0x275
+#define NV0000_CTRL_CMD_GPU_GET_UUID_FROM_GPU_ID_FLAGS_FORMAT_ASCII 0
+#define NV0000_GPU_MAX_GID_LENGTH 0x100
+
+#define NV2080_CTRL_CMD_GPU_GET_NAME_STRING 0x20800110
+#define NV2080_CTRL_GPU_GET_NAME_STRING_FLAGS_TYPE_ASCII 0
+#define NV2080_GPU_MAX_NAME_STRING_LENGTH 0x40
+
+#define NV2080_CTRL_CMD_BUS_GET_PCI_INFO 0x20801801
+
+#define NV2080_CTRL_CMD_GPU_GET_PARTITIONS 0x20800175
+#define NV2080_CTRL_GPU_MAX_PARTITIONS 0x8
+#define NV2080_CTRL_GPU_MAX_SMC_IDS 0x8
+#define NVC637_CTRL_CMD_EXEC_PARTITIONS_GET 0xC6370103
+#define NVC637_CTRL_MAX_EXEC_PARTITIONS 0x8
+
+#define CMD_SUBDEVICE_CTRL_GR_GET_ROP_INFO 0x20801213
+#define NV2080_CTRL_CMD_GR_GET_INFO 0x20801201
+
+// NV2080_CTRL_GR_INFO indexes (ctrl0080gr.h)
+#define NV2080_CTRL_GR_INFO_INDEX_SHADER_PIPE_COUNT 0x07 // TPCs
+#define NV2080_CTRL_GR_INFO_INDEX_LITTER_NUM_GPCS 0x14
+#define NV2080_CTRL_GR_INFO_INDEX_LITTER_NUM_FBPS 0x15
+#define NV2080_CTRL_GR_INFO_INDEX_LITTER_NUM_ZCULL_BANKS 0x16
+#define NV2080_CTRL_GR_INFO_INDEX_GPU_CORE_COUNT 0x1D
+#define NV2080_CTRL_GR_INFO_INDEX_LITTER_NUM_SM_PER_TPC 0x20
+
+typedef struct
+{
+	NvHandle hRoot;
+	NvHandle hObjectParent;
+	NvHandle hObjectOld;
+	NvV32 status;
+} NVOS00_PARAMETERS;
+
+typedef struct
+{
+	NvHandle hRoot;
+	NvHandle hObjectParent;
+	NvHandle hObjectNew;
+	NvV32 hClass;
+	NvP64 pAllocParms NV_ALIGN_BYTES(8);
+	NvU32 paramsSize;
+	NvV32 status;
+} NVOS21_PARAMETERS;
+
+/* New struct with rights requested */
+typedef struct
+{
+	NvHandle hRoot;                               // [IN] client handle
+	NvHandle hObjectParent;                       // [IN] parent handle of new object
+	NvHandle hObjectNew;                          // [INOUT] new object handle, 0 to generate
+	NvV32 hClass;                                 // [in] class num of new object
+	NvP64 pAllocParms NV_ALIGN_BYTES(8);          // [IN] class-specific alloc parameters
+	NvP64 pRightsRequested NV_ALIGN_BYTES(8);     // [IN] RS_ACCESS_MASK to request rights, or NULL
+	NvU32 paramsSize;                             // [IN] Size of alloc params
+	NvU32 flags;                                  // [IN] flags for FINN serialization
+	NvV32 status;                                 // [OUT] status
+} NVOS64_PARAMETERS;
+
+typedef struct
+{
+	NvHandle hClient;
+	NvHandle hObject;
+	NvV32 cmd;
+	NvU32 flags;
+	NvP64 params NV_ALIGN_BYTES(8);
+	NvU32 paramsSize;
+	NvV32 status;
+} NVOS54_PARAMETERS;
+
+// NV_ESC_ALLOC_OS_EVENT / NV_ESC_FREE_OS_EVENT turn an fd of /dev/nvidiactl
+// into an event queue that NV01_EVENT_OS_EVENT objects deliver to
+typedef struct
+{
+	NvHandle hClient;
+	NvHandle hDevice;
+	NvU32 fd;
+	NvU32 Status;
+} nv_ioctl_alloc_os_event_t;
+
+typedef nv_ioctl_alloc_os_event_t nv_ioctl_free_os_event_t;
+
+// NV01_EVENT_OS_EVENT allocation parameters, `data` carries the event fd
+typedef struct
+{
+	NvHandle hParentClient;
+	NvHandle hSrcResource;
+	NvV32 hClass;
+	NvV32 notifyIndex;
+	NvP64 data NV_ALIGN_BYTES(8);
+} NV0005_ALLOC_PARAMETERS;
+
+// One queued event, dequeued with NV_ESC_RM_GET_EVENT_DATA on the event fd.
+// RM copies out only this; the parent recorded in the kernel's own event
+// entry is the client handle, so the event object is all there is to route on.
+typedef struct
+{
+	NvHandle hObject;  // the NV01_EVENT_OS_EVENT object
+	NvU32 NotifyIndex;
+	NvU32 info32;
+	NvU16 info16;
+} NvUnixEvent;
+
+typedef struct
+{
+	NvP64 pEvent NV_ALIGN_BYTES(8); // NvUnixEvent
+	NvV32 MoreEvents;
+	NvV32 status;
+} NVOS41_PARAMETERS;
+
+typedef struct
+{
+	NvU32 event; // notifier index
+	NvU32 action;
+	NvBool bNotifyState;
+	NvU32 info32;
+	NvU16 info16;
+} NV2080_CTRL_EVENT_SET_NOTIFICATION_PARAMS;
+
+// NV_ESC_CARD_INFO fills one entry per GPU known to the kernel module
+typedef struct
+{
+	NvU32 domain;
+	NvU8 bus;
+	NvU8 slot;
+	NvU8 function;
+	NvU16 vendor_id;
+	NvU16 device_id;
+} nv_pci_info_t;
+
+typedef struct
+{
+	NvBool valid;
+	nv_pci_info_t pci_info;
+	NvU32 gpu_id;
+	NvU16 interrupt_line;
+	NvU64 reg_address NV_ALIGN_BYTES(8);
+	NvU64 reg_size NV_ALIGN_BYTES(8);
+	NvU64 fb_address NV_ALIGN_BYTES(8);
+	NvU64 fb_size NV_ALIGN_BYTES(8);
+	NvU32 minor_number;
+	NvU8 dev_name[10];
+} nv_ioctl_card_info_t;
+
+typedef struct
+{
+	NvU32 gpuIds[NV0000_CTRL_GPU_MAX_PROBED_GPUS];
+	NvU32 excludedGpuIds[NV0000_CTRL_GPU_MAX_PROBED_GPUS];
+} NV0000_CTRL_GPU_GET_PROBED_IDS_PARAMS;
+
+typedef struct
+{
+	NvU32 gpuId;
+	NvU32 gpuFlags;
+	NvU32 deviceInstance;
+	NvU32 subDeviceInstance;
+	NvU32 sliStatus;
+	NvU32 boardId;
+	NvU32 gpuInstance;
+	NvS32 numaId;
+} NV0000_CTRL_GPU_GET_ID_INFO_V2_PARAMS;
+
+typedef struct
+{
+	NvU32 gpuId;
+	NvU32 flags;
+	NvU8 gpuUuid[NV0000_GPU_MAX_GID_LENGTH]; // "GPU-..." in ASCII format
+	NvU32 uuidStrLen;
+} NV0000_CTRL_GPU_GET_UUID_FROM_GPU_ID_PARAMS;
+
+typedef struct
+{
+	NvU32 deviceId;
+	NvHandle hClientShare;
+	NvHandle hTargetClient;
+	NvHandle hTargetDevice;
+	NvV32 flags;
+	NV_DECLARE_ALIGNED(NvU64 vaSpaceSize, 8);
+	NV_DECLARE_ALIGNED(NvU64 vaStartInternal, 8);
+	NV_DECLARE_ALIGNED(NvU64 vaLimitInternal, 8);
+	NvV32 vaMode;
+} NV0080_ALLOC_PARAMETERS;
+
+typedef struct
+{
+	NvU32 subDeviceId;
+} NV2080_ALLOC_PARAMETERS;
+
+typedef struct
+{
+	NvU32 gpuNameStringFlags;
+	union
+	{
+		NvU8 ascii[NV2080_GPU_MAX_NAME_STRING_LENGTH];
+		NvU16 unicode[NV2080_GPU_MAX_NAME_STRING_LENGTH];
+	} gpuNameString;
+} NV2080_CTRL_GPU_GET_NAME_STRING_PARAMS;
+
+typedef struct
+{
+	NvU32 pciDeviceId;    // device << 16 | vendor
+	NvU32 pciSubSystemId; // subsystem device << 16 | subsystem vendor
+	NvU32 pciRevisionId;
+	NvU32 pciExtDeviceId;
+} NV2080_CTRL_BUS_GET_PCI_INFO_PARAMS;
+
+typedef struct
+{
+	NvU32 ropUnitCount;
+	NvU32 ropOperationsFactor;
+	NvU32 ropOperationsCount;
+} NV2080_CTRL_GR_GET_ROP_INFO_PARAMS;
+
+typedef struct
+{
+	NvU32 index;
+	NvU32 data;
+} NV2080_CTRL_GR_INFO;
+
+// Selects the GR engine to query, all zero for the whole device
+typedef struct
+{
+	NvU32 flags;
+	NV_DECLARE_ALIGNED(NvU64 route, 8);
+} NV2080_CTRL_GR_ROUTE_INFO;
+
+typedef struct
+{
+	NvU32 grInfoListSize;
+	NvP64 grInfoList NV_ALIGN_BYTES(8); // NV2080_CTRL_GR_INFO[grInfoListSize]
+	NV_DECLARE_ALIGNED(NV2080_CTRL_GR_ROUTE_INFO grRouteInfo, 8);
+} NV2080_CTRL_GR_GET_INFO_PARAMS;
+
+typedef struct
+{
+	NvU32 swizzId;
+} NVC637_ALLOCATION_PARAMETERS;
+
+typedef struct
+{
+	NvU32 execPartitionId;
+} NVC638_ALLOCATION_PARAMETERS;
+
+typedef struct
+{
+	NV_DECLARE_ALIGNED(NvU64 lo, 8);
+	NV_DECLARE_ALIGNED(NvU64 hi, 8);
+} NV2080_CTRL_GPU_PARTITION_SPAN;
+
+// One MIG GPU instance as RM configured it; swizzId is nvidia-smi's GI ID
+typedef struct
+{
+	NvU32 swizzId;
+	NvU32 partitionFlag;
+	NvU32 grEngCount;
+	NvU32 veidCount;
+	NvU32 smCount;
+	NvU32 ceCount;
+	NvU32 nvEncCount;
+	NvU32 nvDecCount;
+	NvU32 nvJpgCount;
+	NvU32 nvOfaCount;
+	NvU32 gpcCount;
+	NvU32 virtualGpcCount;
+	NvU32 gfxGpcCount;
+	NvU32 gpcsPerGr[NV2080_CTRL_GPU_MAX_SMC_IDS];
+	NvU32 virtualGpcsPerGr[NV2080_CTRL_GPU_MAX_SMC_IDS];
+	NvU32 gfxGpcPerGr[NV2080_CTRL_GPU_MAX_SMC_IDS];
+	NvU32 veidsPerGr[NV2080_CTRL_GPU_MAX_SMC_IDS];
+	NV_DECLARE_ALIGNED(NvU64 memSize, 8);
+	NV_DECLARE_ALIGNED(NV2080_CTRL_GPU_PARTITION_SPAN span, 8);
+	NvBool bValid;
+	NvBool bPartitionError;
+	NvP64 validCTSIds NV_ALIGN_BYTES(8);
+	NvP64 validGfxCTSIds NV_ALIGN_BYTES(8);
+} NV2080_CTRL_GPU_GET_PARTITION_INFO;
+
+typedef struct
+{
+	NvU32 validPartitionCount;
+	NV_DECLARE_ALIGNED(NV2080_CTRL_GPU_GET_PARTITION_INFO queryPartitionInfo[NV2080_CTRL_GPU_MAX_PARTITIONS], 8);
+	NvBool bGetAllPartitionInfo; // every instance, not only the one the client is subscribed to
+} NV2080_CTRL_GPU_GET_PARTITIONS_PARAMS;
+
+typedef struct
+{
+	NvU32 gpcCount;
+	NvU32 gfxGpcCount;
+	NvU32 veidCount;
+	NvU32 ceCount;
+	NvU32 nvEncCount;
+	NvU32 nvDecCount;
+	NvU32 nvJpgCount;
+	NvU32 ofaCount;
+	NvU32 sharedEngFlag;
+	NvU32 smCount;
+	NvU32 spanStart;
+	NvU32 computeSize;
+} NVC637_CTRL_EXEC_PARTITIONS_INFO;
+
+// The compute instances of the GPU instance the control is issued on;
+// execPartId is nvidia-smi's CI ID
+typedef struct
+{
+	NvU32 execPartCount;
+	NvU32 execPartId[NVC637_CTRL_MAX_EXEC_PARTITIONS];
+	NVC637_CTRL_EXEC_PARTITIONS_INFO execPartInfo[NVC637_CTRL_MAX_EXEC_PARTITIONS];
+} NVC637_CTRL_EXEC_PARTITIONS_GET_PARAMS;
+
+#endif
@@ -0,0 +1,174 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "output.h"
+
+// Worst case per GPU is a JSON line with every name byte escaped as \u00XX
+#define OUTPUT_RECORD_MAX (256 + 6 * ROP_GPU_NAME_LENGTH)
+#define OUTPUT_BUFFER_SIZE (OUTPUT_RECORD_MAX * (ROP_MAX_GPUS + 1))
+
+struct output_buffer
+{
+	char data[OUTPUT_BUFFER_SIZE];
+	size_t length;
+};
+
+static void append(struct output_buffer* buffer, const char* format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	int written = vsnprintf(buffer->data + buffer->length, sizeof(buffer->data) - buffer->length, format, args);
+	va_end(args);
+	if (written > 0) {
+		buffer->length += (size_t)written;
+		if (buffer->length > sizeof(buffer->data) - 1) {
+			buffer->length = sizeof(buffer->data) - 1;
+		}
+	}
+}
+
+static void append_bytes(struct output_buffer* buffer, const void* bytes, size_t size)
+{
+	if (size <= sizeof(buffer->data) - buffer->length) {
+		memcpy(buffer->data + buffer->length, bytes, size);
+		buffer->length += size;
+	}
+}
+
+static void append_json_string(struct output_buffer* buffer, const char* string)
+{
+	append(buffer, "\"");
+	for (const unsigned char* c = (const unsigned char*)string; *c != '\0'; ++c) {
+		if (*c == '"' || *c == '\\') {
+			append(buffer, "\\%c", *c);
+		}
+		else if (*c < 0x20) {
+			append(buffer, "\\u%04x", *c);
+		}
+		else {
+			append(buffer, "%c", *c);
+		}
+	}
+	append(buffer, "\"");
+}
+
+// RFC 4180 quoting, the name is the only free-form field
+static void append_csv_string(struct output_buffer* buffer, const char* string)
+{
+	append(buffer, "\"");
+	for (const char* c = string; *c != '\0'; ++c) {
+		append(buffer, *c == '"' ? "\"\"" : "%c", *c);
+	}
+	append(buffer, "\"");
+}
+
+static void format_json(struct output_buffer* buffer, const struct rop_device* device, const struct rop_result* result)
+{
+	append(buffer, "{\"index\":%d,\"minor\":%d,\"bus_id\":\"%s\",\"name\":", result->device_index, device->minor, device->busId);
+	append_json_string(buffer, result->name);
+	append(buffer, ",\"rop_unit_count\":%u,\"rop_operations_factor\":%u,\"rop_operations_count\":%u,\"status\":\"%s\","
+	       "\"expected_rop_operations_count\":%u,\"verdict\":\"%s\"}\n",
+	       result->rop.ropUnitCount, result->rop.ropOperationsFactor, result->rop.ropOperationsCount,
+	       rop_status_string(result->status), result->expectedCount, rop_verdict_string(result->verdict));
+}
+
+static void format_csv(struct output_buffer* buffer, const struct rop_device* device, const struct rop_result* result)
+{
+	append(buffer, "%d,%d,%s,", result->device_index, device->minor, device->busId);
+	append_csv_string(buffer, result->name);
+	append(buffer, ",%u,%u,%u,%s,%u,%s\n", result->rop.ropUnitCount, result->rop.ropOperationsFactor,
+	       result->rop.ropOperationsCount, rop_status_string(result->status),
+	       result->expectedCount, rop_verdict_string(result->verdict));
+}
+
+static void format_bin(struct output_buffer* buffer, const struct rop_device* device, const struct rop_result* result)
+{
+	struct rop_record record;
+	memset(&record, 0, sizeof(record));
+	record.device_index = (uint16_t)result->device_index;
+	record.minor = (uint16_t)device->minor;
+	record.status = (uint16_t)result->status;
+	record.verdict = (uint16_t)result->verdict;
+	memcpy(record.busId, device->busId, sizeof(record.busId));
+	memcpy(record.name, result->name, sizeof(record.name));
+	record.ropUnitCount = result->rop.ropUnitCount;
+	record.ropOperationsFactor = result->rop.ropOperationsFactor;
+	record.ropOperationsCount = result->rop.ropOperationsCount;
+	record.expectedCount = result->expectedCount;
+	append_bytes(buffer, &record, sizeof(record));
+}
+
+bool rop_format_parse(const char* name, enum rop_format* format)
+{
+	static const char* const names[] = {
+		[ROP_FORMAT_TEXT] = "text",
+		[ROP_FORMAT_JSON] = "json",
+		[ROP_FORMAT_CSV] = "csv",
+		[ROP_FORMAT_BIN] = "bin",
+	};
+	for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); ++i) {
+		if (strcmp(name, names[i]) == 0) {
+			*format = (enum rop_format)i;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool rop_write_results(int fd, enum rop_format format, const struct rop_session* session,
+                       const struct rop_result* results, int count, bool header)
+{
+	static struct output_buffer buffer;
+	buffer.length = 0;
+
+	if (format == ROP_FORMAT_CSV && header) {
+		append(&buffer, "index,minor,bus_id,name,rop_unit_count,rop_operations_factor,rop_operations_count,status,expected_rop_operations_count,verdict\n");
+	}
+	if (format == ROP_FORMAT_BIN) {
+		struct rop_record_header record_header = {
+			.magic = ROP_RECORD_MAGIC,
+			.version = ROP_RECORD_VERSION,
+			.count = (uint16_t)count,
+			.record_size = sizeof(struct rop_record)
+		};
+		append_bytes(&buffer, &record_header, sizeof(record_header));
+	}
+
+	for (int i = 0; i < count; ++i) {
+		const struct rop_device* device = &session->devices[results[i].device_index];
+		switch (format) {
+		case ROP_FORMAT_JSON:
+			format_json(&buffer, device, &results[i]);
+			break;
+		case ROP_FORMAT_CSV:
+			format_csv(&buffer, device, &results[i]);
+			break;
+		case ROP_FORMAT_BIN:
+			format_bin(&buffer, device, &results[i]);
+			break;
+		case ROP_FORMAT_TEXT:
+			break;
+		}
+	}
+
+	// One write() for the whole batch; only a pipe or socket that takes part
+	// of it needs another round
+	const char* data = buffer.data;
+	size_t remaining = buffer.length;
+	while (remaining > 0) {
+		ssize_t written = write(fd, data, remaining);
+		if (written == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			perror("Failed to write results");
+			return false;
+		}
+		data += written;
+		remaining -= (size_t)written;
+	}
+	return true;
+}
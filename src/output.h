@@ -0,0 +1,57 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "librop.h"
+
+// Machine-readable probe results for collectors. Every format carries, per
+// GPU: index, minor, PCI bus ID, name, ROP unit count, factor, count, status,
+// the expected count of the SKU (0 if unknown) and the verdict.
+//   json  one JSON object per line (JSON Lines)
+//   csv   a header line, then one line per GPU
+//   bin   a rop_record_header followed by `count` rop_record, host byte order
+
+enum rop_format
+{
+	ROP_FORMAT_TEXT = 0, // the human-readable output of each tool
+	ROP_FORMAT_JSON,
+	ROP_FORMAT_CSV,
+	ROP_FORMAT_BIN,
+};
+
+#define ROP_RECORD_MAGIC "ROPR"
+#define ROP_RECORD_VERSION 2
+
+struct rop_record_header
+{
+	char magic[4];        // ROP_RECORD_MAGIC, not NUL-terminated
+	uint16_t version;     // ROP_RECORD_VERSION
+	uint16_t count;       // records that follow
+	uint32_t record_size; // sizeof(struct rop_record), to skip unknown tails
+};
+
+struct rop_record
+{
+	uint16_t device_index;
+	uint16_t minor;
+	uint16_t status;  // enum rop_status
+	uint16_t verdict; // enum rop_verdict
+	char busId[16];
+	char name[ROP_GPU_NAME_LENGTH];
+	uint32_t ropUnitCount;
+	uint32_t ropOperationsFactor;
+	uint32_t ropOperationsCount;
+	uint32_t expectedCount;
+};
+
+bool rop_format_parse(const char* name, enum rop_format* format);
+
+// Formats results[0..count) into one buffer and hands it to a single write(),
+// instead of a stdio call per field. `header` selects whether the CSV header
+// line is included, e.g. only for the first batch of a --watch run.
+bool rop_write_results(int fd, enum rop_format format, const struct rop_session* session,
+                       const struct rop_result* results, int count, bool header);
+
+#endif
@@ -0,0 +1,273 @@
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "librop.h"
+
+// CPython extension `rop` (make python): the probe of src/ropmulti.c as
+// in-process calls. The module opens one RM session on first use and keeps
+// it, with every GPU's device and subdevice handles, until rop.close() or
+// interpreter exit, so a repeated rop.probe() costs one GR_GET_ROP_INFO
+// ioctl per GPU instead of a fork/exec and a full RM setup.
+//
+//   >>> import rop
+//   >>> rop.probe()
+//   [{'index': 0, 'minor': 0, 'bus_id': '0000:01:00.0', 'status': 'ok',
+//     'rop_unit_count': 12, 'rop_operations_factor': 8,
+//     'rop_operations_count': 96, ...}]
+//
+// The session is not thread safe, calls are serialized on `lock` and run
+// with the GIL released.
+
+static struct
+{
+	pthread_mutex_t lock;
+	bool open;
+	struct rop_session session;
+	// Expected counts and names do not change, only the count is re-read
+	bool judged[ROP_MAX_GPUS];
+	struct rop_result last[ROP_MAX_GPUS];
+} module = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+// Opens the module's session unless it is open already; call with `lock` held
+static bool ensure_session(void)
+{
+	if (module.open) {
+		return true;
+	}
+	memset(module.judged, 0, sizeof(module.judged));
+	module.open = rop_session_open(&module.session);
+	return module.open;
+}
+
+static void close_session(void)
+{
+	if (module.open) {
+		rop_session_close(&module.session);
+		module.open = false;
+	}
+}
+
+// Probes one GPU over the session's cached handles, judging and naming it
+// only the first time it answers; call with `lock` held
+static void probe_device(int device_index, unsigned flags, struct rop_result* result)
+{
+	struct rop_session* session = &module.session;
+	struct rop_result* last = &module.last[device_index];
+
+	if (!module.judged[device_index]) {
+		memset(last, 0, sizeof(*last));
+		last->device_index = device_index;
+	}
+	*result = *last;
+	result->status = rop_session_query(session, device_index, &result->rop);
+	if (result->status == ROP_OK && (flags & ROP_PROBE_GR_INFO)) {
+		result->status = rop_session_get_gr_info(session, device_index, &result->gr);
+	}
+	if (result->status != ROP_OK) {
+		return;
+	}
+	if (!module.judged[device_index]) {
+		if (rop_session_get_name(session, device_index, result->name, sizeof(result->name)) != ROP_OK) {
+			result->name[0] = '\0';
+		}
+		result->status = rop_session_judge(session, device_index, result);
+		if (result->status != ROP_OK) {
+			return;
+		}
+		module.judged[device_index] = true;
+	}
+	else {
+		result->verdict = rop_verdict_for(result->expectedCount, result->rop.ropOperationsCount);
+	}
+	*last = *result;
+}
+
+static PyObject* device_dict(const struct rop_device* device, int device_index)
+{
+	return Py_BuildValue("{s:i,s:i,s:s,s:I,s:I,s:I}",
+	                     "index", device_index,
+	                     "minor", device->minor,
+	                     "bus_id", device->busId,
+	                     "gpu_id", (unsigned)device->gpuId,
+	                     "vendor_id", (unsigned)device->vendorId,
+	                     "pci_device_id", (unsigned)device->pciDeviceId);
+}
+
+// Same keys as the JSON records of src/output.c
+static PyObject* result_dict(const struct rop_device* device, const struct rop_result* result, unsigned flags)
+{
+	PyObject* dict = Py_BuildValue("{s:i,s:i,s:s,s:s,s:s,s:I,s:I,s:I,s:I,s:s}",
+	                               "index", result->device_index,
+	                               "minor", device->minor,
+	                               "bus_id", device->busId,
+	                               "name", result->name,
+	                               "status", rop_status_string(result->status),
+	                               "rop_unit_count", (unsigned)result->rop.ropUnitCount,
+	                               "rop_operations_factor", (unsigned)result->rop.ropOperationsFactor,
+	                               "rop_operations_count", (unsigned)result->rop.ropOperationsCount,
+	                               "expected_rop_operations_count", (unsigned)result->expectedCount,
+	                               "verdict", rop_verdict_string(result->verdict));
+	if (dict == NULL || !(flags & ROP_PROBE_GR_INFO)) {
+		return dict;
+	}
+	PyObject* units = Py_BuildValue("{s:I,s:I,s:I,s:I,s:I,s:I}",
+	                                "gpc_count", (unsigned)result->gr.gpcCount,
+	                                "tpc_count", (unsigned)result->gr.tpcCount,
+	                                "sm_count", (unsigned)result->gr.smCount,
+	                                "core_count", (unsigned)result->gr.coreCount,
+	                                "fbp_count", (unsigned)result->gr.fbpCount,
+	                                "zcull_bank_count", (unsigned)result->gr.zcullBankCount);
+	if (units == NULL || PyDict_Update(dict, units) != 0) {
+		Py_XDECREF(units);
+		Py_DECREF(dict);
+		return NULL;
+	}
+	Py_DECREF(units);
+	return dict;
+}
+
+static PyObject* rop_py_probe(PyObject* self, PyObject* args, PyObject* kwargs)
+{
+	static char* keywords[] = { "gpus", "units", NULL };
+	const char* selectors = NULL;
+	int units = 0;
+	(void)self;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|zp:probe", keywords, &selectors, &units)) {
+		return NULL;
+	}
+	unsigned flags = ROP_PROBE_NAME | ROP_PROBE_VERDICT | (units ? ROP_PROBE_GR_INFO : 0);
+
+	struct rop_result results[ROP_MAX_GPUS];
+	struct rop_device devices[ROP_MAX_GPUS];
+	int count = 0;
+	bool opened;
+
+	Py_BEGIN_ALLOW_THREADS
+	pthread_mutex_lock(&module.lock);
+	opened = ensure_session();
+	if (opened) {
+		int device_indices[ROP_MAX_GPUS];
+		if (selectors != NULL) {
+			count = rop_select_devices(&module.session, selectors, device_indices);
+		}
+		else {
+			count = module.session.device_count;
+			for (int i = 0; i < count; ++i) {
+				device_indices[i] = i;
+			}
+		}
+		for (int i = 0; i < count; ++i) {
+			devices[i] = module.session.devices[device_indices[i]];
+			probe_device(device_indices[i], flags, &results[i]);
+		}
+	}
+	pthread_mutex_unlock(&module.lock);
+	Py_END_ALLOW_THREADS
+
+	if (!opened) {
+		PyErr_SetString(PyExc_OSError, "failed to open an NVIDIA RM session");
+		return NULL;
+	}
+	if (count < 0) {
+		PyErr_Format(PyExc_ValueError, "no NVIDIA device matches GPU selectors %s", selectors);
+		return NULL;
+	}
+
+	PyObject* list = PyList_New(count);
+	for (int i = 0; list != NULL && i < count; ++i) {
+		PyObject* dict = result_dict(&devices[i], &results[i], flags);
+		if (dict == NULL) {
+			Py_CLEAR(list);
+			break;
+		}
+		PyList_SET_ITEM(list, i, dict);
+	}
+	return list;
+}
+
+static PyObject* rop_py_devices(PyObject* self, PyObject* unused)
+{
+	struct rop_device devices[ROP_MAX_GPUS];
+	int count = 0;
+	bool opened;
+	(void)self;
+	(void)unused;
+
+	Py_BEGIN_ALLOW_THREADS
+	pthread_mutex_lock(&module.lock);
+	opened = ensure_session();
+	if (opened) {
+		count = module.session.device_count;
+		memcpy(devices, module.session.devices, sizeof(devices[0]) * (size_t)count);
+	}
+	pthread_mutex_unlock(&module.lock);
+	Py_END_ALLOW_THREADS
+
+	if (!opened) {
+		PyErr_SetString(PyExc_OSError, "failed to open an NVIDIA RM session");
+		return NULL;
+	}
+	PyObject* list = PyList_New(count);
+	for (int i = 0; list != NULL && i < count; ++i) {
+		PyObject* dict = device_dict(&devices[i], i);
+		if (dict == NULL) {
+			Py_CLEAR(list);
+			break;
+		}
+		PyList_SET_ITEM(list, i, dict);
+	}
+	return list;
+}
+
+static PyObject* rop_py_close(PyObject* self, PyObject* unused)
+{
+	(void)self;
+	(void)unused;
+	Py_BEGIN_ALLOW_THREADS
+	pthread_mutex_lock(&module.lock);
+	close_session();
+	pthread_mutex_unlock(&module.lock);
+	Py_END_ALLOW_THREADS
+	Py_RETURN_NONE;
+}
+
+static void rop_py_free(void* unused)
+{
+	(void)unused;
+	pthread_mutex_lock(&module.lock);
+	close_session();
+	pthread_mutex_unlock(&module.lock);
+}
+
+static PyMethodDef rop_methods[] = {
+	{ "probe", (PyCFunction)(void (*)(void))rop_py_probe, METH_VARARGS | METH_KEYWORDS,
+	  "probe(gpus=None, units=False) -> list of dict\n\n"
+	  "Reads the ROP count of every GPU, or of the GPUs selected by `gpus`\n"
+	  "(comma-separated indexes, nvidiaN minors, PCI bus IDs or UUIDs). With\n"
+	  "`units`, also the GR unit inventory. Per-GPU failures are reported in\n"
+	  "'status'; OSError if RM cannot be opened at all." },
+	{ "devices", rop_py_devices, METH_NOARGS,
+	  "devices() -> list of dict\n\nThe GPUs RM knows, without opening any of them." },
+	{ "close", rop_py_close, METH_NOARGS,
+	  "close()\n\nFrees the RM client and handles; the next call opens a new session." },
+	{ NULL, NULL, 0, NULL }
+};
+
+static struct PyModuleDef rop_module = {
+	PyModuleDef_HEAD_INIT,
+	.m_name = "rop",
+	.m_doc = "ROP counts of NVIDIA GPUs straight from the RM driver, see src/librop.h.",
+	.m_size = -1,
+	.m_methods = rop_methods,
+	.m_free = rop_py_free,
+};
+
+PyMODINIT_FUNC PyInit_rop(void)
+{
+	return PyModule_Create(&rop_module);
+}
@@ -0,0 +1,1010 @@
+#define _GNU_SOURCE // accept4
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <getopt.h>
+#include <poll.h>
+#include <time.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "librop.h"
+#include "main.h"
+#include "ropd.h"
+
+#define ROPD_MAX_CLIENTS 64
+#define ROPD_METRICS_SIZE 32768
+#define ROPD_HTTP_REQUEST_SIZE 2048
+#define ROPD_DEFAULT_INTERVAL 15
+
+struct ropd_state
+{
+	struct rop_session session;
+	int device_count;
+	pthread_mutex_t probe_lock; // serializes RM calls on the session
+	pthread_mutex_t cache_lock; // guards everything below, never held across an ioctl
+	struct ropd_record cache[ROP_MAX_GPUS];
+	NvU32 expected[ROP_MAX_GPUS];
+	uint64_t probe_errors[ROP_MAX_GPUS];
+	char metrics[ROPD_METRICS_SIZE]; // Prometheus text, re-rendered on every cache update
+	size_t metrics_length;
+	pthread_cond_t work_cond; // wakes the probe thread for queued work and on shutdown
+	bool work_stop;
+	bool probe_wanted[ROP_MAX_GPUS]; // queued for the probe thread
+	bool events_wanted;              // the RM event queue is readable
+	uint64_t batches_started;        // work queued now is done once batches_done
+	uint64_t batches_done;           // reaches batches_started + 1
+	int done_fd;                     // eventfd signalled after every batch
+	struct rop_board* board; // --board, NULL if not publishing
+	struct rop_events events; // --events, guarded by probe_lock
+	bool subscribed;
+};
+
+// One accepted connection, a socket client or an HTTP scraper
+struct ropd_client
+{
+	bool http;
+	bool waiting;   // on the probe thread, answered once batches_done reaches ticket
+	uint64_t ticket;
+	int first;      // GPUs [first, last) the request covers
+	int last;
+	char request[ROPD_HTTP_REQUEST_SIZE]; // HTTP request line and headers read so far
+	size_t request_length;
+	char* output;   // HTTP response, NULL until the request is read
+	size_t output_length;
+	size_t output_sent;
+};
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void handle_stop(int sig)
+{
+	(void)sig;
+	stop_requested = 1;
+}
+
+static void usage(const char* argv0)
+{
+	fprintf(stderr, "Usage: %s [--socket PATH] [--metrics [HOST:]PORT] [--interval SECONDS] [--board[=NAME]] [--events]\n", argv0);
+	fprintf(stderr, "       %s --client [--socket PATH | --board[=NAME]] [--device N] [--probe]\n", argv0);
+	fprintf(stderr, "  -s, --socket PATH  Unix socket path (default %s)\n", ROPD_DEFAULT_SOCKET);
+	fprintf(stderr, "  -m, --metrics [HOST:]PORT\n");
+	fprintf(stderr, "                     serve Prometheus metrics over HTTP at /metrics\n");
+	fprintf(stderr, "  -i, --interval SECONDS\n");
+	fprintf(stderr, "                     re-probe the GPUs in the background every SECONDS\n");
+	fprintf(stderr, "                     (default %d with --metrics, off otherwise)\n", ROPD_DEFAULT_INTERVAL);
+	fprintf(stderr, "  -b, --board[=NAME] publish results to shared memory /dev/shm/NAME (default %s),\n", ROP_BOARD_DEFAULT_NAME + 1);
+	fprintf(stderr, "                     or read them from there in client mode\n");
+	fprintf(stderr, "  -e, --events       subscribe to RM Xid/ECC events and re-probe a GPU as soon as\n");
+	fprintf(stderr, "                     one fires, instead of serving its stale result until the next refresh\n");
+	fprintf(stderr, "  -c, --client       query a running daemon instead of serving\n");
+	fprintf(stderr, "  -d, --device N     only report GPU N (client mode)\n");
+	fprintf(stderr, "  -p, --probe        ask the daemon to re-query the GPUs first (client mode)\n");
+}
+
+static uint64_t realtime_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void append_metrics(struct ropd_state* state, const char* format, ...)
+{
+	va_list args;
+	size_t space = sizeof(state->metrics) - state->metrics_length;
+	va_start(args, format);
+	int written = vsnprintf(state->metrics + state->metrics_length, space, format, args);
+	va_end(args);
+	if (written > 0) {
+		state->metrics_length += (size_t)written < space ? (size_t)written : space - 1;
+	}
+}
+
+// Renders the cache as Prometheus text exposition, called with cache_lock held
+static void render_metrics(struct ropd_state* state)
+{
+	static const struct
+	{
+		const char* name;
+		const char* type;
+		const char* help;
+	} families[] = {
+		{ "gpu_rop_units", "gauge", "ROP unit count reported by RM." },
+		{ "gpu_rop_operations_count", "gauge", "ROP operations count reported by RM." },
+		{ "gpu_rop_expected_operations_count", "gauge", "ROP operations count the SKU ships with, 0 if unknown." },
+		{ "gpu_rop_deficient", "gauge", "1 if the GPU has fewer ROPs than its SKU." },
+		{ "gpu_rop_probe_up", "gauge", "1 if the last probe of the GPU succeeded." },
+		{ "gpu_rop_probe_errors_total", "counter", "Failed probes of the GPU since ropd started." },
+		{ "gpu_rop_probe_timestamp_seconds", "gauge", "Time of the last probe of the GPU." },
+	};
+
+	state->metrics_length = 0;
+	for (size_t family = 0; family < sizeof(families) / sizeof(families[0]); ++family) {
+		append_metrics(state, "# HELP %s %s\n# TYPE %s %s\n", families[family].name, families[family].help,
+		               families[family].name, families[family].type);
+		for (int device_index = 0; device_index < state->device_count; ++device_index) {
+			const struct ropd_record* record = &state->cache[device_index];
+			const struct rop_device* device = &state->session.devices[device_index];
+			NvU32 expected = state->expected[device_index];
+			bool up = record->status == ROP_OK;
+			append_metrics(state, "%s{gpu=\"%d\",minor=\"%d\",bus_id=\"%s\"} ", families[family].name,
+			               device_index, device->minor, device->busId);
+			switch (family) {
+			case 0:
+				append_metrics(state, "%u\n", record->ropUnitCount);
+				break;
+			case 1:
+				append_metrics(state, "%u\n", record->ropOperationsCount);
+				break;
+			case 2:
+				append_metrics(state, "%u\n", expected);
+				break;
+			case 3:
+				append_metrics(state, "%d\n", up && rop_verdict_for(expected, record->ropOperationsCount) == ROP_VERDICT_DEFICIENT);
+				break;
+			case 4:
+				append_metrics(state, "%d\n", up);
+				break;
+			case 5:
+				append_metrics(state, "%llu\n", (unsigned long long)state->probe_errors[device_index]);
+				break;
+			case 6:
+				append_metrics(state, "%.3f\n", record->timestamp_ns / 1e9);
+				break;
+			}
+		}
+	}
+}
+
+// Copies the cache to the shared-memory board, called with cache_lock held
+// so that publishes never interleave
+static void publish_board(struct ropd_state* state)
+{
+	struct rop_board_entry entries[ROP_MAX_GPUS];
+	memset(entries, 0, sizeof(entries));
+	for (int device_index = 0; device_index < state->device_count; ++device_index) {
+		const struct ropd_record* record = &state->cache[device_index];
+		struct rop_board_entry* entry = &entries[device_index];
+		entry->status = record->status;
+		entry->rop.ropUnitCount = record->ropUnitCount;
+		entry->rop.ropOperationsFactor = record->ropOperationsFactor;
+		entry->rop.ropOperationsCount = record->ropOperationsCount;
+		entry->expectedCount = state->expected[device_index];
+		entry->verdict = record->status == ROP_OK ? rop_verdict_for(entry->expectedCount, record->ropOperationsCount) : ROP_VERDICT_UNKNOWN;
+		entry->timestamp_ns = record->timestamp_ns;
+		memcpy(entry->busId, state->session.devices[device_index].busId, sizeof(entry->busId));
+	}
+	rop_board_publish(state->board, entries, state->device_count);
+}
+
+// Queries GPUs [first, last) over the session's cached handles, then
+// refreshes their cache entries and the metrics in one short critical section
+static void probe_devices(struct ropd_state* state, int first, int last)
+{
+	struct ropd_record records[ROP_MAX_GPUS];
+	NvU32 expected[ROP_MAX_GPUS];
+
+	pthread_mutex_lock(&state->probe_lock);
+	for (int device_index = first; device_index < last; ++device_index) {
+		struct rop_result result = { .device_index = device_index };
+		enum rop_status status = rop_session_query(&state->session, device_index, &result.rop);
+		if (status == ROP_OK) {
+			status = rop_session_judge(&state->session, device_index, &result);
+		}
+
+		struct ropd_record* record = &records[device_index];
+		record->device_index = (uint16_t)device_index;
+		record->status = (uint16_t)status;
+		record->ropUnitCount = status == ROP_OK ? result.rop.ropUnitCount : 0;
+		record->ropOperationsFactor = status == ROP_OK ? result.rop.ropOperationsFactor : 0;
+		record->ropOperationsCount = status == ROP_OK ? result.rop.ropOperationsCount : 0;
+		record->timestamp_ns = realtime_ns();
+		expected[device_index] = result.expectedCount;
+	}
+	pthread_mutex_unlock(&state->probe_lock);
+
+	pthread_mutex_lock(&state->cache_lock);
+	for (int device_index = first; device_index < last; ++device_index) {
+		state->cache[device_index] = records[device_index];
+		if (records[device_index].status != ROP_OK) {
+			state->probe_errors[device_index]++;
+		}
+		else {
+			state->expected[device_index] = expected[device_index];
+		}
+	}
+	render_metrics(state);
+	if (state->board != NULL) {
+		publish_board(state);
+	}
+	pthread_mutex_unlock(&state->cache_lock);
+}
+
+// Builds the device/subdevice handle table once by attaching every enumerated GPU
+static bool attach_devices(struct ropd_state* state)
+{
+	state->device_count = state->session.device_count;
+	probe_devices(state, 0, state->device_count);
+	if (state->device_count == 0) {
+		fprintf(stderr, "No NVIDIA devices found.\n");
+		return false;
+	}
+	fprintf(stderr, "ropd: serving %d NVIDIA device(s).\n", state->device_count);
+	return true;
+}
+
+// Subscribes every GPU to RM events, GPUs that fail are only refreshed by polling
+static void subscribe_devices(struct ropd_state* state)
+{
+	pthread_mutex_lock(&state->probe_lock);
+	state->subscribed = rop_events_open(&state->events, &state->session);
+	for (int device_index = 0; state->subscribed && device_index < state->device_count; ++device_index) {
+		enum rop_status status = rop_events_subscribe(&state->events, &state->session, device_index);
+		if (status != ROP_OK) {
+			fprintf(stderr, "GPU %d: no RM events (%s)\n", device_index, rop_status_string(status));
+		}
+	}
+	pthread_mutex_unlock(&state->probe_lock);
+	if (!state->subscribed) {
+		fprintf(stderr, "Failed to open the RM event queue, results are only updated by polling\n");
+	}
+}
+
+// Drops the held handles of every GPU an event fired on and re-probes it, so
+// the cache never serves a result from before a reset or loss. Runs on the
+// probe thread like every other RM call after startup.
+static void handle_events(struct ropd_state* state)
+{
+	struct rop_event events[ROP_MAX_GPUS];
+
+	pthread_mutex_lock(&state->probe_lock);
+	int count = rop_events_read(&state->events, events, ROP_MAX_GPUS);
+	bool stale[ROP_MAX_GPUS] = { false };
+	for (int i = 0; i < count; ++i) {
+		int device_index = events[i].device_index;
+		// Only RC errors carry an Xid, ECC events report 0
+		if (events[i].xid != 0) {
+			fprintf(stderr, "GPU %d: %s (Xid %u), re-probing\n", device_index, rop_event_kind_string(events[i].kind), events[i].xid);
+		}
+		else {
+			fprintf(stderr, "GPU %d: %s, re-probing\n", device_index, rop_event_kind_string(events[i].kind));
+		}
+		if (!stale[device_index]) {
+			stale[device_index] = true;
+			rop_events_unsubscribe(&state->events, &state->session, device_index);
+			rop_gpu_detach(&state->session, &state->session.gpus[device_index]);
+		}
+	}
+	pthread_mutex_unlock(&state->probe_lock);
+
+	for (int device_index = 0; device_index < state->device_count; ++device_index) {
+		if (!stale[device_index]) {
+			continue;
+		}
+		probe_devices(state, device_index, device_index + 1);
+		// A GPU that did not come back is only refreshed by polling from now on
+		pthread_mutex_lock(&state->probe_lock);
+		if (state->session.gpus[device_index].nvidia_fd == -1 ||
+		    rop_events_subscribe(&state->events, &state->session, device_index) != ROP_OK) {
+			fprintf(stderr, "GPU %d: no further RM events\n", device_index);
+		}
+		pthread_mutex_unlock(&state->probe_lock);
+	}
+}
+
+static void advance_deadline(struct timespec* deadline, long long interval_ns)
+{
+	deadline->tv_sec += (deadline->tv_nsec + interval_ns) / 1000000000;
+	deadline->tv_nsec = (deadline->tv_nsec + interval_ns) % 1000000000;
+}
+
+static bool any_probe_wanted(const struct ropd_state* state)
+{
+	for (int device_index = 0; device_index < state->device_count; ++device_index) {
+		if (state->probe_wanted[device_index]) {
+			return true;
+		}
+	}
+	return false;
+}
+
+struct probe_args
+{
+	struct ropd_state* state;
+	double interval;
+};
+
+// Makes every RM call after startup: queued --probe requests, re-probes after
+// RM events and, with an interval, a refresh of every GPU. The poll thread
+// never waits on an ioctl, so scrapes and CACHED queries are answered from
+// the cache right away.
+static void* probe_thread(void* arg)
+{
+	struct probe_args* args = arg;
+	struct ropd_state* state = args->state;
+	long long interval_ns = (long long)(args->interval * 1e9);
+	struct timespec deadline;
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	advance_deadline(&deadline, interval_ns);
+
+	pthread_mutex_lock(&state->cache_lock);
+	while (!state->work_stop) {
+		while (!state->work_stop && !state->events_wanted && !any_probe_wanted(state)) {
+			if (interval_ns <= 0) {
+				pthread_cond_wait(&state->work_cond, &state->cache_lock);
+			}
+			else if (pthread_cond_timedwait(&state->work_cond, &state->cache_lock, &deadline) == ETIMEDOUT) {
+				memset(state->probe_wanted, true, sizeof(state->probe_wanted));
+				advance_deadline(&deadline, interval_ns);
+			}
+		}
+		if (state->work_stop) {
+			break;
+		}
+		bool wanted[ROP_MAX_GPUS];
+		memcpy(wanted, state->probe_wanted, sizeof(wanted));
+		memset(state->probe_wanted, false, sizeof(state->probe_wanted));
+		bool events = state->events_wanted;
+		state->events_wanted = false;
+		uint64_t batch = ++state->batches_started;
+		pthread_mutex_unlock(&state->cache_lock);
+
+		if (events) {
+			handle_events(state);
+		}
+		for (int first = 0; first < state->device_count; ++first) {
+			if (!wanted[first]) {
+				continue;
+			}
+			int last = first + 1;
+			while (last < state->device_count && wanted[last]) {
+				last++;
+			}
+			probe_devices(state, first, last);
+			first = last;
+		}
+
+		pthread_mutex_lock(&state->cache_lock);
+		state->batches_done = batch;
+		uint64_t one = 1;
+		if (write(state->done_fd, &one, sizeof(one)) != sizeof(one)) {
+			perror("Failed to signal the probe thread eventfd");
+		}
+	}
+	pthread_mutex_unlock(&state->cache_lock);
+	return NULL;
+}
+
+// Queues GPUs [first, last) for the probe thread, returns the batches_done
+// value their results are fresh at. Called with cache_lock held.
+static uint64_t queue_probe(struct ropd_state* state, int first, int last)
+{
+	for (int device_index = first; device_index < last; ++device_index) {
+		state->probe_wanted[device_index] = true;
+	}
+	pthread_cond_signal(&state->work_cond);
+	return state->batches_started + 1;
+}
+
+static size_t response_size(const struct ropd_response* response)
+{
+	return offsetof(struct ropd_response, records) + response->count * sizeof(struct ropd_record);
+}
+
+// Checks a request and resolves the GPUs [first, last) it covers, false with
+// response->error set if it is rejected
+static bool check_request(const struct ropd_state* state, const struct ropd_request* request, ssize_t length,
+                          struct ropd_response* response, int* first, int* last)
+{
+	memset(response, 0, offsetof(struct ropd_response, records));
+	response->version = ROPD_VERSION;
+
+	if (length != sizeof(*request) || request->version != ROPD_VERSION ||
+	    (request->op != ROPD_OP_CACHED && request->op != ROPD_OP_PROBE)) {
+		response->error = ROPD_ERR_BAD_REQUEST;
+		return false;
+	}
+
+	*first = 0;
+	*last = state->device_count;
+	if (request->device_index != ROPD_ALL_DEVICES) {
+		if (request->device_index >= state->device_count) {
+			response->error = ROPD_ERR_NO_DEVICE;
+			return false;
+		}
+		*first = request->device_index;
+		*last = *first + 1;
+	}
+	return true;
+}
+
+// Sends GPUs [first, last) from the cache. The reply is never waited for, a
+// client that does not read its replies is dropped.
+static bool send_response(struct ropd_state* state, int client_fd, int first, int last, struct ropd_response* response)
+{
+	pthread_mutex_lock(&state->cache_lock);
+	for (int device_index = first; device_index < last; ++device_index) {
+		response->records[response->count++] = state->cache[device_index];
+	}
+	pthread_mutex_unlock(&state->cache_lock);
+	return send(client_fd, response, response_size(response), MSG_NOSIGNAL | MSG_DONTWAIT) >= 0;
+}
+
+// Serves one message from a client, a PROBE is only queued and answered by
+// finish_client. Returns false when the client should be dropped.
+static bool serve_client(struct ropd_state* state, int client_fd, struct ropd_client* client)
+{
+	struct ropd_request request;
+	struct ropd_response response;
+
+	ssize_t length = recv(client_fd, &request, sizeof(request), 0);
+	if (length <= 0) {
+		return false;
+	}
+	if (!check_request(state, &request, length, &response, &client->first, &client->last)) {
+		return send(client_fd, &response, response_size(&response), MSG_NOSIGNAL | MSG_DONTWAIT) >= 0;
+	}
+	if (request.op == ROPD_OP_PROBE) {
+		pthread_mutex_lock(&state->cache_lock);
+		client->ticket = queue_probe(state, client->first, client->last);
+		pthread_mutex_unlock(&state->cache_lock);
+		client->waiting = true;
+		return true;
+	}
+	return send_response(state, client_fd, client->first, client->last, &response);
+}
+
+// Answers a client whose queued probe has finished
+static bool finish_client(struct ropd_state* state, int client_fd, struct ropd_client* client)
+{
+	struct ropd_response response;
+
+	memset(&response, 0, offsetof(struct ropd_response, records));
+	response.version = ROPD_VERSION;
+	client->waiting = false;
+	return send_response(state, client_fd, client->first, client->last, &response);
+}
+
+static int open_listener(const char* socket_path)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "Socket path too long: %s\n", socket_path);
+		return -1;
+	}
+	strcpy(addr.sun_path, socket_path);
+
+	int listen_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (listen_fd == -1) {
+		perror("Failed to create socket");
+		return -1;
+	}
+	unlink(socket_path);
+	if (bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(listen_fd, 16) != 0) {
+		fprintf(stderr, "Failed to listen on %s: %s\n", socket_path, strerror(errno));
+		close(listen_fd);
+		return -1;
+	}
+	return listen_fd;
+}
+
+// Listens for Prometheus scrapes on "[HOST:]PORT", all addresses without HOST
+static int open_metrics_listener(const char* spec)
+{
+	char host[256] = "";
+	const char* port = spec;
+	const char* colon = strrchr(spec, ':');
+	if (colon != NULL) {
+		snprintf(host, sizeof(host), "%.*s", (int)(colon - spec), spec);
+		port = colon + 1;
+	}
+
+	struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM, .ai_flags = AI_PASSIVE };
+	struct addrinfo* addresses;
+	int error = getaddrinfo(host[0] != '\0' ? host : NULL, port, &hints, &addresses);
+	if (error != 0) {
+		fprintf(stderr, "Invalid metrics address %s: %s\n", spec, gai_strerror(error));
+		return -1;
+	}
+
+	int listen_fd = socket(addresses->ai_family, addresses->ai_socktype | SOCK_CLOEXEC, 0);
+	int reuse = 1;
+	if (listen_fd == -1 || setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) != 0 ||
+	    bind(listen_fd, addresses->ai_addr, addresses->ai_addrlen) != 0 || listen(listen_fd, 16) != 0) {
+		fprintf(stderr, "Failed to listen on %s: %s\n", spec, strerror(errno));
+		if (listen_fd != -1) {
+			close(listen_fd);
+		}
+		listen_fd = -1;
+	}
+	freeaddrinfo(addresses);
+	return listen_fd;
+}
+
+// Sends as much of an HTTP response as the socket takes without blocking,
+// false once it is all out or the scraper went away
+static bool flush_http(int client_fd, struct ropd_client* client)
+{
+	while (client->output_sent < client->output_length) {
+		ssize_t sent = send(client_fd, client->output + client->output_sent, client->output_length - client->output_sent,
+		                    MSG_NOSIGNAL | MSG_DONTWAIT);
+		if (sent < 0) {
+			return errno == EAGAIN || errno == EWOULDBLOCK;
+		}
+		client->output_sent += (size_t)sent;
+	}
+	return false;
+}
+
+// Answers one HTTP request from the pre-rendered metrics once its header
+// is complete, the connection is closed afterwards (HTTP/1.0) so scrapers
+// never hold a poll slot for long. Returns false when the connection should
+// be closed.
+static bool serve_http(struct ropd_state* state, int client_fd, struct ropd_client* client)
+{
+	size_t space = sizeof(client->request) - client->request_length;
+	ssize_t length = recv(client_fd, client->request + client->request_length, space, MSG_DONTWAIT);
+	if (length < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+		return true;
+	}
+	if (length <= 0) {
+		return false;
+	}
+	client->request_length += (size_t)length;
+	bool complete = memmem(client->request, client->request_length, "\r\n\r\n", 4) != NULL;
+	if (!complete && client->request_length < sizeof(client->request)) {
+		return true; // wait for the rest of the header
+	}
+
+	const size_t size = ROPD_METRICS_SIZE + 256;
+	client->output = malloc(size);
+	if (client->output == NULL) {
+		return false;
+	}
+	if (!complete) {
+		client->output_length = (size_t)snprintf(client->output, size,
+		                                         "HTTP/1.0 431 Request Header Fields Too Large\r\nContent-Length: 0\r\n\r\n");
+	}
+	else if (strncmp(client->request, "GET /metrics ", 13) == 0 || strncmp(client->request, "GET /metrics?", 13) == 0) {
+		pthread_mutex_lock(&state->cache_lock);
+		client->output_length = (size_t)snprintf(client->output, size,
+		                                         "HTTP/1.0 200 OK\r\n"
+		                                         "Content-Type: text/plain; version=0.0.4\r\n"
+		                                         "Content-Length: %zu\r\n\r\n%s",
+		                                         state->metrics_length, state->metrics);
+		pthread_mutex_unlock(&state->cache_lock);
+	}
+	else {
+		client->output_length = (size_t)snprintf(client->output, size,
+		                                         "HTTP/1.0 404 Not Found\r\nContent-Length: 0\r\n\r\n");
+	}
+	client->output_sent = 0;
+	return flush_http(client_fd, client);
+}
+
+static void drop_client(struct pollfd* fds, struct ropd_client* clients, int slot, int last_slot)
+{
+	close(fds[slot].fd);
+	free(clients[slot].output);
+	fds[slot] = fds[last_slot];
+	clients[slot] = clients[last_slot];
+}
+
+static int run_daemon(const char* socket_path, const char* metrics_address, double interval, const char* board_name, bool events)
+{
+	enum { LISTEN_UNIX, LISTEN_METRICS, LISTEN_EVENTS, LISTEN_DONE, LISTENER_COUNT };
+	static struct ropd_state state;
+	struct pollfd fds[LISTENER_COUNT + ROPD_MAX_CLIENTS];
+	static struct ropd_client clients[LISTENER_COUNT + ROPD_MAX_CLIENTS];
+	int client_count = 0;
+	uint64_t events_ticket = 0; // the event fd is not polled while the probe thread reads it
+	int ret_code = 0;
+
+	pthread_mutex_init(&state.probe_lock, NULL);
+	pthread_mutex_init(&state.cache_lock, NULL);
+	pthread_condattr_t cond_attr;
+	pthread_condattr_init(&cond_attr);
+	pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&state.work_cond, &cond_attr);
+	pthread_condattr_destroy(&cond_attr);
+
+	state.done_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (state.done_fd == -1) {
+		perror("Failed to create the probe thread eventfd");
+		return 1;
+	}
+	if (!rop_session_open(&state.session)) {
+		close(state.done_fd);
+		return 1;
+	}
+	// Created before the first probe so it publishes right away
+	if (board_name != NULL) {
+		state.board = rop_board_create(board_name);
+		if (state.board == NULL) {
+			rop_session_close(&state.session);
+			close(state.done_fd);
+			return 1;
+		}
+	}
+	if (!attach_devices(&state)) {
+		if (state.board != NULL) {
+			rop_board_destroy(state.board, board_name);
+		}
+		rop_session_close(&state.session);
+		close(state.done_fd);
+		return 1;
+	}
+
+	int listen_fd = open_listener(socket_path);
+	if (listen_fd == -1) {
+		if (state.board != NULL) {
+			rop_board_destroy(state.board, board_name);
+		}
+		rop_session_close(&state.session);
+		close(state.done_fd);
+		return 1;
+	}
+	int metrics_fd = -1;
+	if (metrics_address != NULL) {
+		metrics_fd = open_metrics_listener(metrics_address);
+		if (metrics_fd == -1) {
+			close(listen_fd);
+			unlink(socket_path);
+			if (state.board != NULL) {
+				rop_board_destroy(state.board, board_name);
+			}
+			rop_session_close(&state.session);
+			close(state.done_fd);
+			return 1;
+		}
+	}
+
+	if (events) {
+		subscribe_devices(&state);
+	}
+
+	struct sigaction sa = { .sa_handler = handle_stop };
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	// The probe thread runs with the stop signals blocked, so they always
+	// interrupt the poll below
+	pthread_t prober;
+	struct probe_args probe_args = { .state = &state, .interval = interval };
+	sigset_t stop_signals, old_mask;
+	sigemptyset(&stop_signals);
+	sigaddset(&stop_signals, SIGINT);
+	sigaddset(&stop_signals, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &stop_signals, &old_mask);
+	bool probing = pthread_create(&prober, NULL, probe_thread, &probe_args) == 0;
+	pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+	if (!probing) {
+		fprintf(stderr, "Failed to start the probe thread\n");
+		ret_code = 1;
+	}
+
+	fds[LISTEN_UNIX].fd = listen_fd;
+	fds[LISTEN_UNIX].events = POLLIN;
+	fds[LISTEN_METRICS].fd = metrics_fd; // ignored by poll when -1
+	fds[LISTEN_METRICS].events = POLLIN;
+	fds[LISTEN_EVENTS].fd = state.subscribed ? rop_events_fd(&state.events) : -1;
+	fds[LISTEN_EVENTS].events = POLLIN;
+	fds[LISTEN_DONE].fd = state.done_fd;
+	fds[LISTEN_DONE].events = POLLIN;
+	while (probing && !stop_requested) {
+		if (poll(fds, LISTENER_COUNT + client_count, -1) == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			perror("poll failed");
+			break;
+		}
+
+		if (fds[LISTEN_DONE].revents & POLLIN) {
+			uint64_t batches;
+			if (read(state.done_fd, &batches, sizeof(batches)) != sizeof(batches)) {
+				perror("Failed to reset the probe thread eventfd");
+			}
+			pthread_mutex_lock(&state.cache_lock);
+			uint64_t done = state.batches_done;
+			pthread_mutex_unlock(&state.cache_lock);
+			for (int i = LISTENER_COUNT; i < LISTENER_COUNT + client_count; ++i) {
+				if (!clients[i].waiting || clients[i].ticket > done) {
+					continue;
+				}
+				if (finish_client(&state, fds[i].fd, &clients[i])) {
+					fds[i].events = POLLIN;
+					continue;
+				}
+				client_count--;
+				drop_client(fds, clients, i--, LISTENER_COUNT + client_count);
+			}
+			if (state.subscribed && fds[LISTEN_EVENTS].fd == -1 && events_ticket <= done) {
+				fds[LISTEN_EVENTS].fd = rop_events_fd(&state.events);
+			}
+		}
+
+		for (int i = LISTENER_COUNT; i < LISTENER_COUNT + client_count; ++i) {
+			struct ropd_client* client = &clients[i];
+			bool keep;
+			if (fds[i].revents == 0) {
+				continue;
+			}
+			if (client->http) {
+				keep = client->output == NULL ? serve_http(&state, fds[i].fd, client) : flush_http(fds[i].fd, client);
+				fds[i].events = client->output == NULL ? POLLIN : POLLOUT;
+			}
+			else if (client->waiting) {
+				keep = false; // hung up before its probe finished
+			}
+			else {
+				keep = (fds[i].revents & POLLIN) && serve_client(&state, fds[i].fd, client);
+				fds[i].events = client->waiting ? 0 : POLLIN;
+			}
+			if (!keep) {
+				client_count--;
+				drop_client(fds, clients, i--, LISTENER_COUNT + client_count);
+			}
+		}
+
+		if (fds[LISTEN_EVENTS].revents & POLLIN) {
+			pthread_mutex_lock(&state.cache_lock);
+			state.events_wanted = true;
+			events_ticket = state.batches_started + 1;
+			pthread_cond_signal(&state.work_cond);
+			pthread_mutex_unlock(&state.cache_lock);
+			fds[LISTEN_EVENTS].fd = -1;
+		}
+		for (int listener = LISTEN_UNIX; listener <= LISTEN_METRICS; ++listener) {
+			if (!(fds[listener].revents & POLLIN)) {
+				continue;
+			}
+			int client_fd = accept4(fds[listener].fd, NULL, NULL, SOCK_CLOEXEC);
+			if (client_fd == -1) {
+				continue;
+			}
+			if (client_count == ROPD_MAX_CLIENTS) {
+				close(client_fd);
+				continue;
+			}
+			int slot = LISTENER_COUNT + client_count++;
+			fds[slot].fd = client_fd;
+			fds[slot].events = POLLIN;
+			fds[slot].revents = 0;
+			clients[slot] = (struct ropd_client) { .http = listener == LISTEN_METRICS };
+		}
+	}
+
+	if (probing) {
+		pthread_mutex_lock(&state.cache_lock);
+		state.work_stop = true;
+		pthread_cond_signal(&state.work_cond);
+		pthread_mutex_unlock(&state.cache_lock);
+		pthread_join(prober, NULL);
+	}
+	for (int i = LISTENER_COUNT; i < LISTENER_COUNT + client_count; ++i) {
+		close(fds[i].fd);
+		free(clients[i].output);
+	}
+	if (metrics_fd != -1) {
+		close(metrics_fd);
+	}
+	close(listen_fd);
+	unlink(socket_path);
+	if (state.board != NULL) {
+		rop_board_destroy(state.board, board_name);
+	}
+	if (state.subscribed) {
+		rop_events_close(&state.events, &state.session);
+	}
+	rop_session_close(&state.session);
+	close(state.done_fd);
+	return ret_code;
+}
+
+static void print_record(const struct ropd_record* record)
+{
+	printf("GPU %u ROP unit count: %u\n", record->device_index, record->ropUnitCount);
+	printf("GPU %u ROP operations factor: %u\n", record->device_index, record->ropOperationsFactor);
+	printf("GPU %u ROP operations count: %u\n", record->device_index, record->ropOperationsCount);
+}
+
+static int run_client(const char* socket_path, int device_index, bool probe)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	struct ropd_request request = {
+		.version = ROPD_VERSION,
+		.op = probe ? ROPD_OP_PROBE : ROPD_OP_CACHED,
+		.device_index = device_index < 0 ? ROPD_ALL_DEVICES : (uint16_t)device_index
+	};
+	struct ropd_response response;
+
+	if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "Socket path too long: %s\n", socket_path);
+		return 1;
+	}
+	strcpy(addr.sun_path, socket_path);
+
+	int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (fd == -1 || connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+		fprintf(stderr, "Failed to connect to %s: %s\n", socket_path, strerror(errno));
+		if (fd != -1) {
+			close(fd);
+		}
+		return 1;
+	}
+
+	ssize_t length = -1;
+	if (send(fd, &request, sizeof(request), MSG_NOSIGNAL) == sizeof(request)) {
+		length = recv(fd, &response, sizeof(response), 0);
+	}
+	close(fd);
+	if (length < (ssize_t)offsetof(struct ropd_response, records) || (size_t)length != response_size(&response)) {
+		fprintf(stderr, "Invalid response from %s\n", socket_path);
+		return 1;
+	}
+	if (response.error == ROPD_ERR_NO_DEVICE) {
+		fprintf(stderr, "GPU %d: no such device\n", device_index);
+		return 1;
+	}
+	if (response.error != ROPD_ERR_NONE) {
+		fprintf(stderr, "Request rejected by ropd (error %u)\n", response.error);
+		return 1;
+	}
+
+	int ret_code = 0;
+	for (int i = 0; i < response.count; ++i) {
+		const struct ropd_record* record = &response.records[i];
+		if (record->status != ROP_OK) {
+			fprintf(stderr, "GPU %u: %s\n", record->device_index, rop_status_string(record->status));
+			ret_code = 1;
+			continue;
+		}
+		print_record(record);
+	}
+	return ret_code;
+}
+
+// Reads a snapshot straight from the shared-memory board, without a round
+// trip to the daemon
+static int run_board_client(const char* board_name, int device_index)
+{
+	const struct rop_board* board = rop_board_open(board_name);
+	if (board == NULL) {
+		return 1;
+	}
+	struct rop_board snapshot;
+	bool consistent = rop_board_read(board, &snapshot);
+	rop_board_close(board);
+	if (!consistent) {
+		fprintf(stderr, "%s: writer stuck mid-update\n", board_name);
+		return 1;
+	}
+	if (snapshot.writer_pid == 0) {
+		fprintf(stderr, "%s: ropd has shut down, results may be stale\n", board_name);
+	}
+	if (device_index >= (int)snapshot.device_count) {
+		fprintf(stderr, "GPU %d: no such device\n", device_index);
+		return 1;
+	}
+
+	int first = device_index < 0 ? 0 : device_index;
+	int last = device_index < 0 ? (int)snapshot.device_count : device_index + 1;
+	int ret_code = 0;
+	for (int i = first; i < last; ++i) {
+		const struct rop_board_entry* entry = &snapshot.entries[i];
+		if (entry->status != ROP_OK) {
+			fprintf(stderr, "GPU %d: %s\n", i, rop_status_string(entry->status));
+			ret_code = ret_code == 0 ? 1 : ret_code;
+			continue;
+		}
+		struct ropd_record record = {
+			.device_index = (uint16_t)i,
+			.ropUnitCount = entry->rop.ropUnitCount,
+			.ropOperationsFactor = entry->rop.ropOperationsFactor,
+			.ropOperationsCount = entry->rop.ropOperationsCount
+		};
+		print_record(&record);
+		if (entry->verdict != ROP_VERDICT_UNKNOWN) {
+			printf("GPU %d ROP verdict: %s (expected %u)\n", i, rop_verdict_string(entry->verdict), entry->expectedCount);
+		}
+		if (entry->verdict == ROP_VERDICT_DEFICIENT) {
+			ret_code = 2;
+		}
+	}
+	return ret_code;
+}
+
+int ropd_main(int argc, char** argv)
+{
+	static const struct option options[] = {
+		{ "socket", required_argument, NULL, 's' },
+		{ "client", no_argument, NULL, 'c' },
+		{ "device", required_argument, NULL, 'd' },
+		{ "probe", no_argument, NULL, 'p' },
+		{ "metrics", required_argument, NULL, 'm' },
+		{ "interval", required_argument, NULL, 'i' },
+		{ "board", optional_argument, NULL, 'b' },
+		{ "events", no_argument, NULL, 'e' },
+		{ "help", no_argument, NULL, 'h' },
+		{ NULL, 0, NULL, 0 }
+	};
+	const char* socket_path = ROPD_DEFAULT_SOCKET;
+	bool client = false;
+	bool probe = false;
+	int device_index = -1;
+	const char* metrics_address = NULL;
+	double interval = -1;
+	const char* board_name = NULL;
+	bool events = false;
+	char* end;
+	int opt;
+
+	while ((opt = getopt_long(argc, argv, "s:cd:pm:i:b::eh", options, NULL)) != -1) {
+		switch (opt) {
+		case 's':
+			socket_path = optarg;
+			break;
+		case 'c':
+			client = true;
+			break;
+		case 'd':
+			device_index = atoi(optarg);
+			if (device_index < 0 || device_index >= ROP_MAX_GPUS) {
+				fprintf(stderr, "Invalid --device value: %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 'p':
+			probe = true;
+			break;
+		case 'm':
+			metrics_address = optarg;
+			break;
+		case 'i':
+			interval = strtod(optarg, &end);
+			if (*end != '\0' || !(interval >= 0 && interval <= 86400)) {
+				fprintf(stderr, "Invalid --interval value: %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 'b':
+			board_name = optarg != NULL ? optarg : ROP_BOARD_DEFAULT_NAME;
+			break;
+		case 'e':
+			events = true;
+			break;
+		case 'h':
+			usage(argv[0]);
+			return 0;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (client && board_name != NULL) {
+		if (probe) {
+			fprintf(stderr, "--probe needs the socket, the board only holds published results\n");
+			return 1;
+		}
+		return run_board_client(board_name, device_index);
+	}
+	if (client) {
+		return run_client(socket_path, device_index, probe);
+	}
+	if (interval < 0) {
+		interval = metrics_address != NULL ? ROPD_DEFAULT_INTERVAL : 0;
+	}
+	return run_daemon(socket_path, metrics_address, interval, board_name, events);
+}
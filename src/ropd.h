@@ -0,0 +1,53 @@
+#ifndef ROPD_H
+#define ROPD_H
+
+#include <stdint.h>
+
+// Wire protocol of ropd. Both directions use SOCK_SEQPACKET on a Unix socket,
+// one request message answered by exactly one response message. All fields
+// are in host byte order since both ends are on the same machine.
+
+#define ROPD_DEFAULT_SOCKET "/run/ropd.sock"
+#define ROPD_VERSION 1
+#define ROPD_ALL_DEVICES 0xFFFF
+#define ROPD_MAX_RECORDS 32
+
+enum ropd_op
+{
+	ROPD_OP_CACHED = 1, // answer from the daemon's last probe results
+	ROPD_OP_PROBE = 2,  // re-query GR_GET_ROP_INFO on the open handles first
+};
+
+enum ropd_error
+{
+	ROPD_ERR_NONE = 0,
+	ROPD_ERR_BAD_REQUEST,
+	ROPD_ERR_NO_DEVICE,
+};
+
+struct ropd_request
+{
+	uint8_t version;
+	uint8_t op;
+	uint16_t device_index; // ROPD_ALL_DEVICES for every GPU
+};
+
+struct ropd_record
+{
+	uint16_t device_index;
+	uint16_t status;       // enum rop_status
+	uint32_t ropUnitCount;
+	uint32_t ropOperationsFactor;
+	uint32_t ropOperationsCount;
+	uint64_t timestamp_ns; // CLOCK_REALTIME of the probe
+};
+
+struct ropd_response
+{
+	uint8_t version;
+	uint8_t error;  // enum ropd_error
+	uint16_t count; // number of valid records
+	struct ropd_record records[ROPD_MAX_RECORDS];
+};
+
+#endif
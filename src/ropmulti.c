@@ -1,353 +1,568 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
-#include <unistd.h> // For close()
-#include <errno.h>  // For errno
-
-#include <fcntl.h>
-#include <sys/ioctl.h>
-
-// --- Keep all original struct definitions and macros ---
-#define NV_ALIGN_BYTES(size) __attribute__ ((aligned (size)))
-#define NV_DECLARE_ALIGNED(TYPE_VAR, ALIGN) TYPE_VAR __attribute__ ((aligned (ALIGN)))
-
-typedef unsigned __INT32_TYPE__ NvV32;
-typedef unsigned __INT32_TYPE__ NvU32;
-typedef NvU32 NvHandle;
-typedef void* NvP64;
-typedef uint64_t           NvU64;
-
-#define NV_IOCTL_MAGIC      'F'
-#define NV_IOCTL_BASE       200
-#define NV_ESC_REGISTER_FD           (NV_IOCTL_BASE + 1)
-#define NV_ESC_RM_CONTROL                           0x2A
-#define NV_ESC_RM_ALLOC                             0x2B
+#include <unistd.h>
+#include <signal.h>
+#include <getopt.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+
+#include "librop.h"
+#include "main.h"
+#include "output.h"
+#include "timing.h"
+#include "trace.h"
+
+static void usage(const char* argv0)
+{
+    fprintf(stderr, "Usage: %s [--jobs N] [--units] [--watch SECONDS] [--format FMT] [--expected FILE]\n"
+                    "       [--timeout MS] [--timing [--repeat N]] [--trace FILE] [--numa] [--avoid-cpus LIST]\n"
+                    "       [--no-wake] [--gpu LIST] [--mig]\n", argv0);
+    fprintf(stderr, "  -g, --gpu LIST         only probe these GPUs, by index, minor (nvidiaN), PCI bus ID\n");
+    fprintf(stderr, "                         or UUID, e.g. 0,nvidia3,0000:41:00.0; others are not opened\n");
+    fprintf(stderr, "  -j, --jobs N           probe up to N GPUs in parallel (default 1)\n");
+    fprintf(stderr, "  -u, --units            also report GPC/TPC/SM/core/FBP/ZCULL counts\n");
+    fprintf(stderr, "  -m, --mig              also report the ROPs, GPCs, TPCs and SMs each MIG GPU and\n");
+    fprintf(stderr, "                         compute instance received (text format, needs root)\n");
+    fprintf(stderr, "  -w, --watch SECONDS    keep the handles open and re-sample every SECONDS,\n");
+    fprintf(stderr, "                         printing only GPUs whose result changed\n");
+    fprintf(stderr, "  -f, --format FMT       text (default), json, csv or bin, see src/output.h\n");
+    fprintf(stderr, "  -e, --expected FILE    override expected ROP counts, see src/librop.h\n");
+    fprintf(stderr, "  -t, --timeout MS       give up on GPUs not probed within MS milliseconds,\n");
+    fprintf(stderr, "                         each GPU is probed on its own thread\n");
+    fprintf(stderr, "      --numa             probe each GPU from a thread on its own NUMA node\n");
+    fprintf(stderr, "      --avoid-cpus LIST  never probe from these CPUs, e.g. 0-7,64-71\n");
+    fprintf(stderr, "      --timing           report per-phase and per-GPU RM call latencies on stderr\n");
+    fprintf(stderr, "      --repeat N         with --timing, probe N times on fresh sessions and\n");
+    fprintf(stderr, "                         report min/median/p99 (default 1)\n");
+    fprintf(stderr, "      --trace FILE       write every RM ioctl to FILE as Chrome trace JSON\n");
+    fprintf(stderr, "      --no-cache         probe the driver even if this boot's results are cached\n");
+    fprintf(stderr, "      --no-wake          leave runtime-suspended GPUs asleep, reporting their cached\n");
+    fprintf(stderr, "                         result if any\n");
+    fprintf(stderr, "Exits with 2 if a GPU has fewer ROPs than its SKU or a MIG instance has fewer GPCs\n"
+                    "or SMs than configured, 1 if a GPU could not be probed.\n");
+}
 
-#define NV01_DEVICE_0      (0x80U)
-#define NV20_SUBDEVICE_0      (0x2080U)
+// Prints one result in the original text format
+static void print_result(const struct rop_session* session, const struct rop_result* result, unsigned flags)
+{
+    int device_index = result->device_index;
+    printf("--- Processing GPU %d /dev/nvidia%d ---\n", device_index, session->devices[device_index].minor);
 
-#define CMD_SUBDEVICE_CTRL_GR_GET_ROP_INFO 0x20801213
+    if (result->status != ROP_OK) {
+        fprintf(stderr, "GPU %d: Skipping due to %s.\n", device_index, rop_status_string(result->status));
+        return;
+    }
 
-typedef struct
-{
-    NvHandle hRoot;
-    NvHandle hObjectParent;
-    NvHandle hObjectNew;
-    NvV32    hClass;
-    NvP64    pAllocParms NV_ALIGN_BYTES(8);
-    NvU32    paramsSize;
-    NvV32    status;
-} NVOS21_PARAMETERS;
-
-/* New struct with rights requested */
-typedef struct
-{
-    NvHandle hRoot;                               // [IN] client handle
-    NvHandle hObjectParent;                       // [IN] parent handle of new object
-    NvHandle hObjectNew;                          // [INOUT] new object handle, 0 to generate
-    NvV32    hClass;                              // [in] class num of new object
-    NvP64    pAllocParms NV_ALIGN_BYTES(8);       // [IN] class-specific alloc parameters
-    NvP64    pRightsRequested NV_ALIGN_BYTES(8);  // [IN] RS_ACCESS_MASK to request rights, or NULL
-    NvU32    paramsSize;                          // [IN] Size of alloc params
-    NvU32    flags;                               // [IN] flags for FINN serialization
-    NvV32    status;                              // [OUT] status
-} NVOS64_PARAMETERS;
-
-typedef struct
-{
-    NvHandle hClient;
-    NvHandle hObject;
-    NvV32    cmd;
-    NvU32    flags;
-    NvP64    params NV_ALIGN_BYTES(8);
-    NvU32    paramsSize;
-    NvV32    status;
-} NVOS54_PARAMETERS;
-
-typedef struct
-{
-    NvU32    deviceId; // <--- This will be used to specify the GPU index
-    NvHandle hClientShare;
-    NvHandle hTargetClient;
-    NvHandle hTargetDevice;
-    NvV32    flags;
-    NV_DECLARE_ALIGNED(NvU64 vaSpaceSize, 8);
-    NV_DECLARE_ALIGNED(NvU64 vaStartInternal, 8);
-    NV_DECLARE_ALIGNED(NvU64 vaLimitInternal, 8);
-    NvV32    vaMode;
-} NV0080_ALLOC_PARAMETERS;
-
-typedef struct
-{
-    NvU32 subDeviceId; // Usually 0 for the primary subdevice
-} NV2080_ALLOC_PARAMETERS;
+    // --- Print Results (same format as original, prefixed with GPU index) ---
+    printf("GPU %d ROP unit count: %d\n", device_index, result->rop.ropUnitCount);
+    printf("GPU %d ROP operations factor: %d\n", device_index, result->rop.ropOperationsFactor);
+    printf("GPU %d ROP operations count: %d\n", device_index, result->rop.ropOperationsCount);
+    if (result->verdict != ROP_VERDICT_UNKNOWN)
+        printf("GPU %d ROP verdict: %s (expected %u)\n", device_index, rop_verdict_string(result->verdict), result->expectedCount);
+
+    if (flags & ROP_PROBE_GR_INFO) {
+        printf("GPU %d GPC count: %u\n", device_index, result->gr.gpcCount);
+        printf("GPU %d TPC count: %u\n", device_index, result->gr.tpcCount);
+        printf("GPU %d SM count: %u\n", device_index, result->gr.smCount);
+        printf("GPU %d CUDA core count: %u\n", device_index, result->gr.coreCount);
+        printf("GPU %d FBP count: %u\n", device_index, result->gr.fbpCount);
+        printf("GPU %d ZCULL bank count: %u\n", device_index, result->gr.zcullBankCount);
+    }
+}
 
-typedef struct
+// Reports results in the requested format and returns the exit code: 2 if
+// any GPU is deficient, else 1 if any GPU failed to probe, else 0
+static int report(const struct rop_session* session, const struct rop_result* results, int count,
+                  enum rop_format format, unsigned flags, bool header)
 {
-    NvU32 ropUnitCount;
-    NvU32 ropOperationsFactor;
-    NvU32 ropOperationsCount;
-} NV2080_CTRL_GR_GET_ROP_INFO_PARAMS;
+    int ret_code = 0;
+    for (int i = 0; i < count; ++i) {
+        if (results[i].verdict == ROP_VERDICT_DEFICIENT)
+            ret_code = 2;
+        else if (results[i].status != ROP_OK && results[i].status != ROP_ERR_SUSPENDED && ret_code == 0)
+            ret_code = 1;
+    }
 
+    if (format != ROP_FORMAT_TEXT) {
+        if (!rop_write_results(STDOUT_FILENO, format, session, results, count, header) && ret_code == 0)
+            ret_code = 1;
+        return ret_code;
+    }
 
-// --- Core Functions (mostly unchanged, except open_nvidia_device) ---
+    for (int i = 0; i < count; ++i)
+        print_result(session, &results[i], flags); // keeps reporting the other GPUs after a failure
+    fflush(stdout);
+    return ret_code;
+}
 
-static bool open_nvidiactl(int* const nvidiactl_fd)
+// Prints one MIG instance's scoped ROP info and units; returns 2 if it has
+// fewer GPCs or SMs than it was configured with, 1 if it could not be queried
+static int print_mig_scope(const char* label, NvU32 gpcCount, NvU32 smCount, const struct rop_mig_scope* scoped)
 {
-    *nvidiactl_fd = openat(AT_FDCWD, "/dev/nvidiactl", O_RDWR);
-    if (*nvidiactl_fd == -1) {
-        perror("Failed to open /dev/nvidiactl");
-        return false;
+    if (scoped->status != ROP_OK) {
+        fprintf(stderr, "%s: Skipping due to %s.\n", label, rop_status_string(scoped->status));
+        return 1;
     }
-    return true;
+    printf("%s ROP unit count: %u\n", label, scoped->rop.ropUnitCount);
+    printf("%s ROP operations factor: %u\n", label, scoped->rop.ropOperationsFactor);
+    printf("%s ROP operations count: %u\n", label, scoped->rop.ropOperationsCount);
+    printf("%s GPC count: %u (configured %u)\n", label, scoped->gr.gpcCount, gpcCount);
+    printf("%s TPC count: %u\n", label, scoped->gr.tpcCount);
+    printf("%s SM count: %u (configured %u)\n", label, scoped->gr.smCount, smCount);
+    if (!rop_mig_reduced(gpcCount, smCount, scoped))
+        return 0;
+    printf("%s verdict: REDUCED\n", label);
+    return 2;
 }
 
-// Modified function to open a specific nvidia device by index
-static bool open_nvidia_device(int nvidiactl_fd, int device_index, int* const nvidia_fd)
+// Reports what each GPU and compute instance of the probed GPUs received,
+// GPUs with MIG mode off print nothing; returns like report()
+static int report_mig(struct rop_session* session, const struct rop_result* results, int count)
 {
-    char device_path[32]; // Should be enough for /dev/nvidiaXXX
-    snprintf(device_path, sizeof(device_path), "/dev/nvidia%d", device_index);
-
-    *nvidia_fd = openat(AT_FDCWD, device_path, O_RDWR|O_CLOEXEC);
-    if (*nvidia_fd == -1) {
-        // If the device doesn't exist, it's not necessarily an error,
-        // it might just mean we've enumerated all devices.
-        // Only print error for other failure reasons.
-        if (errno != ENOENT) {
-            fprintf(stderr, "Failed to open %s: %s\n", device_path, strerror(errno));
-        }
-        return false; // Indicate failure (could be ENOENT or other error)
-    }
+    struct rop_mig_instance instances[ROP_MAX_MIG_INSTANCES];
+    int ret_code = 0;
 
-    // Register the control fd with the specific device fd
-    if (ioctl(*nvidia_fd, _IOC(_IOC_READ|_IOC_WRITE, NV_IOCTL_MAGIC, NV_ESC_REGISTER_FD, sizeof(nvidiactl_fd)), &nvidiactl_fd) != 0) {
-        perror("ioctl NV_ESC_REGISTER_FD failed");
-        close(*nvidia_fd); // Close the fd on failure
-        *nvidia_fd = -1;
-        return false;
+    for (int i = 0; i < count; ++i) {
+        int device_index = results[i].device_index;
+        int instance_count;
+        if (results[i].status != ROP_OK)
+            continue;
+        if (rop_session_get_mig_instances(session, device_index, instances, &instance_count) != ROP_OK) {
+            fprintf(stderr, "GPU %d: Skipping MIG instances.\n", device_index);
+            ret_code = ret_code == 0 ? 1 : ret_code;
+            continue;
+        }
+        for (int j = 0; j < instance_count; ++j) {
+            const struct rop_mig_instance* instance = &instances[j];
+            char label[48];
+            snprintf(label, sizeof(label), "GPU %d GI %u", device_index, instance->swizzId);
+            int code = print_mig_scope(label, instance->gpcCount, instance->smCount, &instance->scoped);
+            for (int k = 0; k < instance->compute_count; ++k) {
+                const struct rop_mig_compute* compute = &instance->compute[k];
+                snprintf(label, sizeof(label), "GPU %d GI %u CI %u", device_index, instance->swizzId, compute->id);
+                int compute_code = print_mig_scope(label, compute->gpcCount, compute->smCount, &compute->scoped);
+                code = code > compute_code ? code : compute_code;
+            }
+            ret_code = ret_code > code ? ret_code : code;
+        }
     }
-    return true;
+    fflush(stdout);
+    return ret_code;
 }
 
+// Fills device_indices with the GPUs named by `selectors`, every GPU if
+// NULL, and returns how many there are; -1 on a selector matching no GPU
+static int select_devices(const struct rop_session* session, const char* selectors, int* device_indices)
+{
+    if (selectors != NULL)
+        return rop_select_devices(session, selectors, device_indices);
+    for (int i = 0; i < session->device_count; ++i)
+        device_indices[i] = i;
+    return session->device_count;
+}
 
-static bool alloc_client(const int nvidiactl_fd, NvHandle* const hClient)
+// Probes one device at a time over the session's cached handles
+static void probe_serial(struct rop_session* session, const int* device_indices, int count, unsigned flags, struct rop_result* results)
 {
-    NVOS21_PARAMETERS request;
-    memset(&request, 0, sizeof(request));
-    // Set hObjectNew to 0 to let RM assign the handle
-    request.hObjectNew = 0;
-
-    if (ioctl(nvidiactl_fd, _IOC(_IOC_READ|_IOC_WRITE, NV_IOCTL_MAGIC, NV_ESC_RM_ALLOC, sizeof(request)), &request) != 0) {
-        perror("ioctl NV_ESC_RM_ALLOC (client) failed");
-        return false;
-    }
-    if (request.status != 0) {
-        fprintf(stderr, "Failed to allocate client, RM status: 0x%x\n", request.status);
-        return false;
+    for (int i = 0; i < count; ++i) {
+        int device_index = device_indices[i];
+        struct rop_result* result = &results[i];
+        result->device_index = device_index;
+        result->status = rop_session_query(session, device_index, &result->rop);
+        if (result->status == ROP_OK && (flags & ROP_PROBE_GR_INFO))
+            result->status = rop_session_get_gr_info(session, device_index, &result->gr);
+        if (result->status == ROP_OK && (flags & ROP_PROBE_VERDICT))
+            result->status = rop_session_judge(session, device_index, result);
+        if (result->status == ROP_OK && (flags & ROP_PROBE_NAME) &&
+            rop_session_get_name(session, device_index, result->name, sizeof(result->name)) != ROP_OK)
+            result->name[0] = '\0';
     }
-    *hClient = request.hObjectNew;
-    return true;
 }
 
-// Modified to accept device_index
-static bool alloc_device(const int nvidiactl_fd, const NvHandle hClient, int device_index, NvHandle* const hDevice)
+// Probes device_indices[0..count) the way the options ask for, storing the
+// outcome of device_indices[i] in results[i], and returns the number of
+// devices that timed out. With a timeout every device gets its own thread.
+// Thread placement needs the attach-per-probe path even with one job.
+static int probe(struct rop_session* session, const int* device_indices, int count, int jobs, bool placed,
+                 unsigned timeout_ms, unsigned flags, struct rop_result* results)
 {
-    NV0080_ALLOC_PARAMETERS allocParams;
-    memset(&allocParams, 0, sizeof(allocParams));
-    // *** Set the deviceId to the target GPU index ***
-    allocParams.deviceId = (NvU32)device_index;
-
-    NVOS64_PARAMETERS request = {
-        .hRoot = hClient,
-        .hObjectParent = hClient,
-        .hObjectNew = 0, // Let RM assign the handle
-        .hClass = NV01_DEVICE_0,
-        .pAllocParms = &allocParams,
-        .pRightsRequested = NULL,
-        // *** Set the correct size of the parameters ***
-        .paramsSize = sizeof(NV0080_ALLOC_PARAMETERS),
-        .flags = 0,
-        .status = 0
-    };
-
-    if (ioctl(nvidiactl_fd, _IOC(_IOC_READ|_IOC_WRITE, NV_IOCTL_MAGIC, NV_ESC_RM_ALLOC, sizeof(NVOS64_PARAMETERS)), &request) != 0) {
-         perror("ioctl NV_ESC_RM_ALLOC (device) failed");
-         return false;
-    }
-     if (request.status != 0) {
-        fprintf(stderr, "GPU %d: Failed to allocate device, RM status: 0x%x\n", device_index, request.status);
-        return false;
-    }
-    *hDevice = request.hObjectNew; // Store the assigned handle
-    return true;
+    if (timeout_ms > 0)
+        return rop_probe_deadline(session, device_indices, count, timeout_ms, flags, results);
+    if (jobs > 1 || placed)
+        rop_probe_parallel(session, device_indices, count, jobs, flags, results);
+    else
+        probe_serial(session, device_indices, count, flags, results);
+    return 0;
 }
 
-// No change needed here, uses parent handle
-static bool alloc_subdevice(const int nvidiactl_fd, const NvHandle hClient, const NvHandle hParentDevice, NvHandle* const hSubDevice)
+static bool same_result(const struct rop_result* a, const struct rop_result* b)
 {
-    NV2080_ALLOC_PARAMETERS allocParams;
-    memset(&allocParams, 0, sizeof(allocParams));
-    // Typically, we want the first (or only) subdevice, which is index 0.
-    allocParams.subDeviceId = 0;
-
-    NVOS64_PARAMETERS request = {
-        .hRoot = hClient,
-        .hObjectParent = hParentDevice, // Parent is the device handle
-        .hObjectNew = 0, // Let RM assign the handle
-        .hClass = NV20_SUBDEVICE_0,
-        .pAllocParms = &allocParams,
-        .pRightsRequested = 0,
-        // *** Set the correct size of the parameters ***
-        .paramsSize = sizeof(NV2080_ALLOC_PARAMETERS),
-        .flags = 0,
-        .status = 0
-    };
-    if (ioctl(nvidiactl_fd, _IOC(_IOC_READ|_IOC_WRITE, NV_IOCTL_MAGIC, NV_ESC_RM_ALLOC, sizeof(NVOS64_PARAMETERS)), &request) != 0) {
-        perror("ioctl NV_ESC_RM_ALLOC (subdevice) failed");
-        return false;
-    }
-    if (request.status != 0) {
-        // Note: This error message won't inherently know the GPU index unless passed down
-        fprintf(stderr, "Failed to allocate subdevice (parent handle 0x%x), RM status: 0x%x\n", hParentDevice, request.status);
-        return false;
-    }
-    *hSubDevice = request.hObjectNew; // Store the assigned handle
-    return true;
+    return a->status == b->status &&
+           a->rop.ropUnitCount == b->rop.ropUnitCount &&
+           a->rop.ropOperationsFactor == b->rop.ropOperationsFactor &&
+           a->rop.ropOperationsCount == b->rop.ropOperationsCount;
 }
 
-// No change needed here, uses handles
-static bool get_rop_count(const int nvidiactl_fd, const NvHandle hClient, const NvHandle hSubdevice, NV2080_CTRL_GR_GET_ROP_INFO_PARAMS* ropParams)
+// Re-samples the GPUs of initial[0..count) on each timer tick until
+// SIGINT/SIGTERM. The session keeps the client, device and subdevice handles,
+// so a tick costs one GR_GET_ROP_INFO ioctl per GPU; a GPU that failed to
+// attach is retried.
+static int watch(struct rop_session* session, const struct rop_result* initial, int count, double interval, enum rop_format format)
 {
-    NVOS54_PARAMETERS request = {
-        .hClient = hClient,
-        .hObject = hSubdevice,
-        .cmd = CMD_SUBDEVICE_CTRL_GR_GET_ROP_INFO,
-        .flags = 0,
-        .params = ropParams,
-        .paramsSize = sizeof(NV2080_CTRL_GR_GET_ROP_INFO_PARAMS),
-        .status = 0
+    struct rop_result last[ROP_MAX_GPUS];
+    memcpy(last, initial, sizeof(last[0]) * (size_t)count);
+
+    sigset_t stop_signals;
+    sigemptyset(&stop_signals);
+    sigaddset(&stop_signals, SIGINT);
+    sigaddset(&stop_signals, SIGTERM);
+    sigprocmask(SIG_BLOCK, &stop_signals, NULL);
+
+    long long interval_ns = (long long)(interval * 1e9);
+    struct itimerspec period = {
+        .it_interval = { .tv_sec = interval_ns / 1000000000, .tv_nsec = interval_ns % 1000000000 },
+        .it_value = { .tv_sec = interval_ns / 1000000000, .tv_nsec = interval_ns % 1000000000 }
     };
-    if (ioctl(nvidiactl_fd, _IOC(_IOC_READ|_IOC_WRITE, NV_IOCTL_MAGIC, NV_ESC_RM_CONTROL, sizeof(NVOS54_PARAMETERS)), &request) != 0) {
-        perror("ioctl NV_ESC_RM_CONTROL (get_rop_count) failed");
-        return false;
+    int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    int signal_fd = signalfd(-1, &stop_signals, SFD_CLOEXEC);
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event timer_event = { .events = EPOLLIN, .data.fd = timer_fd };
+    struct epoll_event signal_event = { .events = EPOLLIN, .data.fd = signal_fd };
+    if (timer_fd == -1 || signal_fd == -1 || epoll_fd == -1 ||
+        timerfd_settime(timer_fd, 0, &period, NULL) != 0 ||
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, timer_fd, &timer_event) != 0 ||
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, signal_fd, &signal_event) != 0) {
+        perror("Failed to set up the watch timer");
+        if (timer_fd != -1)
+            close(timer_fd);
+        if (signal_fd != -1)
+            close(signal_fd);
+        if (epoll_fd != -1)
+            close(epoll_fd);
+        return 1;
     }
-    if (request.status != 0) {
-        fprintf(stderr, "Failed to get ROP count (subdevice handle 0x%x), RM status: 0x%x\n", hSubdevice, request.status);
-        return false;
+
+    bool stop = false;
+    while (!stop) {
+        struct epoll_event event;
+        if (epoll_wait(epoll_fd, &event, 1, -1) != 1)
+            continue; // EINTR, e.g. SIGSTOP/SIGCONT
+
+        if (event.data.fd == signal_fd) {
+            // Consume the signal so it is not delivered once unblocked
+            struct signalfd_siginfo info;
+            stop = read(signal_fd, &info, sizeof(info)) == sizeof(info);
+            continue;
+        }
+
+        uint64_t expirations;
+        if (read(timer_fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+            continue;
+
+        struct rop_result changed[ROP_MAX_GPUS];
+        int changed_count = 0;
+        for (int i = 0; i < count; ++i) {
+            int device_index = last[i].device_index;
+            struct rop_result sample = last[i]; // keeps the name and units
+            sample.status = rop_session_query(session, device_index, &sample.rop);
+            // The SKU does not change, only the count is re-judged, unless the
+            // GPU could not be judged before
+            if (sample.status == ROP_OK && last[i].status != ROP_OK)
+                sample.status = rop_session_judge(session, device_index, &sample);
+            else if (sample.status == ROP_OK)
+                sample.verdict = rop_verdict_for(sample.expectedCount, sample.rop.ropOperationsCount);
+            if (same_result(&sample, &last[i]))
+                continue;
+            last[i] = sample;
+            changed[changed_count++] = sample;
+        }
+        if (changed_count > 0)
+            report(session, changed, changed_count, format, 0, false);
     }
-    return true;
+
+    close(epoll_fd);
+    close(signal_fd);
+    close(timer_fd);
+    sigprocmask(SIG_UNBLOCK, &stop_signals, NULL);
+    return 0;
 }
 
-int main()
+int ropmulti_main(int argc, char** argv)
 {
-    int ret_code = 0;
-    int nvidiactl_fd = -1;
-    NvHandle hClient = 0;
-    int device_count = 0;
+    static const struct option options[] = {
+        { "gpu", required_argument, NULL, 'g' },
+        { "jobs", required_argument, NULL, 'j' },
+        { "units", no_argument, NULL, 'u' },
+        { "mig", no_argument, NULL, 'm' },
+        { "watch", required_argument, NULL, 'w' },
+        { "format", required_argument, NULL, 'f' },
+        { "expected", required_argument, NULL, 'e' },
+        { "timeout", required_argument, NULL, 't' },
+        { "timing", no_argument, NULL, 'T' },
+        { "repeat", required_argument, NULL, 'R' },
+        { "trace", required_argument, NULL, 'X' },
+        { "numa", no_argument, NULL, 'N' },
+        { "avoid-cpus", required_argument, NULL, 'A' },
+        { "no-cache", no_argument, NULL, 'C' },
+        { "no-wake", no_argument, NULL, 'W' },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+    int jobs = 1;
+    unsigned flags = ROP_PROBE_VERDICT;
+    double interval = 0;
+    enum rop_format format = ROP_FORMAT_TEXT;
+    bool use_cache = true;
+    bool no_wake = false;
+    bool mig = false;
+    const char* gpu_selectors = NULL;
+    unsigned long timeout_ms = 0;
+    int timed_out = 0;
+    bool timing_report = false;
+    long repeat = 1;
+    const char* trace_path = NULL;
+    bool numa_local = false;
+    const char* avoid_cpus = NULL;
+    struct rop_trace trace;
+    char* end;
+    int opt;
+
+    while ((opt = getopt_long(argc, argv, "g:j:umw:f:e:t:h", options, NULL)) != -1) {
+        switch (opt) {
+        case 'g':
+            gpu_selectors = optarg;
+            break;
+        case 'j':
+            jobs = atoi(optarg);
+            if (jobs < 1) {
+                fprintf(stderr, "Invalid --jobs value: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'u':
+            flags |= ROP_PROBE_GR_INFO;
+            break;
+        case 'm':
+            mig = true;
+            break;
+        case 'w':
+            interval = strtod(optarg, &end);
+            if (*end != '\0' || !(interval >= 0.001 && interval <= 86400)) {
+                fprintf(stderr, "Invalid --watch value: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'f':
+            if (!rop_format_parse(optarg, &format)) {
+                fprintf(stderr, "Invalid --format value: %s\n", optarg);
+                return 1;
+            }
+            // Records carry the marketing name, one more ioctl per GPU
+            if (format != ROP_FORMAT_TEXT)
+                flags |= ROP_PROBE_NAME;
+            break;
+        case 'e':
+            if (!rop_expected_load(optarg))
+                return 1;
+            break;
+        case 't':
+            timeout_ms = strtoul(optarg, &end, 10);
+            if (*end != '\0' || timeout_ms < 1 || timeout_ms > 3600000) {
+                fprintf(stderr, "Invalid --timeout value: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'T':
+            timing_report = true;
+            break;
+        case 'R':
+            repeat = strtol(optarg, &end, 10);
+            if (*end != '\0' || repeat < 1 || repeat > ROP_TIMING_MAX_RUNS) {
+                fprintf(stderr, "Invalid --repeat value: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'X':
+            trace_path = optarg;
+            break;
+        case 'N':
+            numa_local = true;
+            break;
+        case 'A':
+            avoid_cpus = optarg;
+            break;
+        case 'C':
+            use_cache = false;
+            break;
+        case 'W':
+            no_wake = true;
+            break;
+        case 'h':
+            usage(argv[0]);
+            return 0;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
 
-    if (!open_nvidiactl(&nvidiactl_fd)) {
-        // Error already printed by open_nvidiactl
+    // A watched GPU that hangs would stall every later tick anyway
+    if (timeout_ms > 0 && interval > 0) {
+        fprintf(stderr, "--timeout cannot be combined with --watch\n");
         return 1;
     }
 
-    if (!alloc_client(nvidiactl_fd, &hClient)) {
-        // Error already printed by alloc_client
-        close(nvidiactl_fd);
+    // Instances are listed on the live session, one round after the probe
+    if (mig && (format != ROP_FORMAT_TEXT || interval > 0 || timeout_ms > 0)) {
+        fprintf(stderr, "--mig needs the text format and cannot be combined with --watch or --timeout\n");
         return 1;
     }
 
-    // Loop through potential device indices
-    for (int device_index = 0; ; ++device_index) {
-        int nvidia_fd = -1;
-        NvHandle hDevice = 0;
-        NvHandle hSubDevice = 0;
-
-        // --- Try to open the device ---
-        if (!open_nvidia_device(nvidiactl_fd, device_index, &nvidia_fd)) {
-            // If opening device 0 failed with ENOENT, no GPUs found
-            // If opening later devices failed with ENOENT, we're done enumerating
-            if (errno == ENOENT) {
-                if (device_index == 0) {
-                    fprintf(stderr, "No NVIDIA devices found (/dev/nvidia0 missing).\n");
-                    ret_code = 1;
-                } else {
-                    printf("Found %d NVIDIA device(s).\n", device_count);
-                }
-                break; // Exit the loop
-            } else {
-                // Another error occurred during open (e.g., permissions)
-                // Error message printed by open_nvidia_device
-                ret_code = 1;
-                break; // Exit the loop
-            }
-        }
+    bool placed = numa_local || avoid_cpus != NULL;
+    if (placed && !rop_probe_set_affinity(numa_local, avoid_cpus))
+        return 1;
+    if (timing_report && interval > 0) {
+        fprintf(stderr, "--timing cannot be combined with --watch\n");
+        return 1;
+    }
+    if (repeat > 1 && !timing_report) {
+        fprintf(stderr, "--repeat needs --timing\n");
+        return 1;
+    }
 
-        printf("--- Processing GPU %d /dev/nvidia%d ---\n", device_index, device_index);
-        device_count++; // Increment count of successfully opened devices
+    struct rop_session session;
+    struct rop_result results[ROP_MAX_GPUS] = { 0 };
+    int selected[ROP_MAX_GPUS];
+    int selected_count = 0;
+    static struct rop_timing timing;
+    struct rop_timing_runs runs;
+    int ret_code = 0;
 
-        // --- Allocate Device Handle ---
-        if (!alloc_device(nvidiactl_fd, hClient, device_index, &hDevice)) {
-            fprintf(stderr, "GPU %d: Skipping due to device allocation failure.\n", device_index);
-            close(nvidia_fd); // Close the specific device fd
-            ret_code = 1;     // Mark as failure but continue to try next GPU
-            continue;
+    // Every run opens a fresh session so that each phase is measured; only
+    // the last one is reported. A cached result would measure nothing.
+    if (timing_report) {
+        if (!rop_timing_runs_init(&runs, (int)repeat))
+            return 1;
+        rop_timing_enable(&timing);
+        use_cache = false;
+    }
+    // The buffer is preallocated and written out at exit, nothing is written
+    // while probing
+    if (trace_path != NULL) {
+        if (!rop_trace_start(&trace, ROP_TRACE_DEFAULT_EVENTS))
+            return 1;
+        use_cache = false;
+    }
+    for (long run = 1; run < repeat; ++run) {
+        memset(&timing, 0, sizeof(timing));
+        if (!rop_session_open(&session)) {
+            ret_code = 1;
+            break;
         }
-
-        // --- Allocate SubDevice Handle ---
-        if (!alloc_subdevice(nvidiactl_fd, hClient, hDevice, &hSubDevice)) {
-            fprintf(stderr, "GPU %d: Skipping due to subdevice allocation failure.\n", device_index);
-            // NOTE: We should ideally free hDevice here using RmFree if this were
-            // a long-running process. For this tool, we rely on process exit.
-            close(nvidia_fd);
+        selected_count = select_devices(&session, gpu_selectors, selected);
+        if (selected_count < 0) {
+            rop_session_close(&session);
             ret_code = 1;
-            continue;
+            break;
         }
-
-        // --- Get ROP Info ---
-        NV2080_CTRL_GR_GET_ROP_INFO_PARAMS ropParams;
-        memset(&ropParams, 0, sizeof(ropParams));
-        if (!get_rop_count(nvidiactl_fd, hClient, hSubDevice, &ropParams)) {
-            fprintf(stderr, "GPU %d: Skipping due to ROP count retrieval failure.\n", device_index);
-            // NOTE: Ideally free hDevice, hSubDevice here.
-            close(nvidia_fd);
+        // A timed-out run is the last one, reported below like a timed-out
+        // final run: the session's client is still in use
+        timed_out = probe(&session, selected, selected_count, jobs, placed, (unsigned)timeout_ms, flags, results);
+        if (timed_out > 0)
+            break;
+        rop_session_close(&session);
+        rop_timing_runs_add(&runs, &timing, session.device_count);
+    }
+    if (timed_out == 0)
+        memset(&timing, 0, sizeof(timing));
+    bool probed = timed_out > 0;
+
+    // A cache hit for every selected GPU answers without opening
+    // /dev/nvidiactl; --watch needs live samples on open handles, --mig the
+    // driver's current partitions. UUIDs are only known to RM.
+    if (interval > 0 || mig || probed)
+        use_cache = false;
+    bool cached = false;
+    uint32_t hits = 0;
+    struct rop_result cached_results[ROP_MAX_GPUS]; // by device index
+    if (ret_code == 0 && use_cache)
+        hits = rop_cache_load(&session, flags, cached_results);
+    if (hits != 0 && (gpu_selectors == NULL || !rop_select_needs_session(gpu_selectors))) {
+        selected_count = select_devices(&session, gpu_selectors, selected);
+        if (selected_count < 0)
             ret_code = 1;
-            continue;
+        cached = selected_count >= 0;
+        for (int i = 0; i < selected_count; ++i) {
+            cached = cached && (hits & (1u << selected[i]));
+            results[i] = cached_results[selected[i]];
         }
-
-        // --- Print Results (same format as original, prefixed with GPU index) ---
-        printf("GPU %d ROP unit count: %d\n", device_index, ropParams.ropUnitCount);
-        printf("GPU %d ROP operations factor: %d\n", device_index, ropParams.ropOperationsFactor);
-        printf("GPU %d ROP operations count: %d\n", device_index, ropParams.ropOperationsCount);
-
-        // --- Cleanup for this device ---
-        // NOTE: Handles (hDevice, hSubDevice) are not explicitly freed here,
-        // relying on process termination, similar to the original code.
-        // If this caused issues, NVOS00_PARAMETERS with RmFree ioctl would be needed.
-        close(nvidia_fd); // Close the /dev/nvidiaX file descriptor
-    } // End of device loop
-
-    // --- Final Cleanup ---
-    // NOTE: hClient is also not explicitly freed.
-    if (nvidiactl_fd != -1) {
-        close(nvidiactl_fd);
     }
+    // A failed open or selection already printed its error and goes straight
+    // to the cleanup below, which still writes the trace
+    bool opened = ret_code == 0 && (cached || probed || rop_session_open(&session));
+
+    // The device table comes from RM, nothing was opened to build it
+    if (!opened) {
+        ret_code = 1;
+    } else if (session.device_count == 0) {
+        fprintf(stderr, "No NVIDIA devices found.\n");
+        ret_code = 1;
+    } else if (!cached && !probed && (selected_count = select_devices(&session, gpu_selectors, selected)) < 0) {
+        ret_code = 1;
+    } else {
+        if (!cached && !probed) {
+            session.no_wake = no_wake;
+            timed_out = probe(&session, selected, selected_count, jobs, placed, (unsigned)timeout_ms, flags, results);
+            // probe() overwrote every result, suspended GPUs fall back to the cache
+            for (int i = 0; i < selected_count; ++i) {
+                int device_index = selected[i];
+                if (results[i].status != ROP_ERR_SUSPENDED || !(hits & (1u << device_index)))
+                    continue;
+                fprintf(stderr, "GPU %d: runtime-suspended, reporting this boot's cached result.\n", device_index);
+                results[i] = cached_results[device_index];
+            }
+            if (use_cache)
+                rop_cache_store(&session, flags, results, selected_count);
+        }
+
+        ret_code = report(&session, results, selected_count, format, flags, true);
+        if (mig) {
+            int mig_code = report_mig(&session, results, selected_count);
+            ret_code = ret_code > mig_code ? ret_code : mig_code;
+        }
+        if (format == ROP_FORMAT_TEXT)
+            printf("Found %d NVIDIA device(s).\n", session.device_count);
 
-    // If no devices were found at all, return error code 1
-    if (device_count == 0 && ret_code == 0) {
-       // This condition might be hit if /dev/nvidia0 exists but fails alloc_device,
-       // and no subsequent devices are found. Check if ret_code was already set.
-       if(access("/dev/nvidia0", F_OK) != -1) {
-           // If /dev/nvidia0 exists but we didn't process it, something went wrong earlier.
-           // Error message should have been printed. Ensure error code is set.
-           if (ret_code == 0) ret_code = 1;
-       } else {
-           // This case should have been caught by the ENOENT check inside the loop.
-           fprintf(stderr, "No NVIDIA devices processed.\n");
-           if (ret_code == 0) ret_code = 1;
-       }
+        if (interval > 0) {
+            fflush(stdout);
+            ret_code = watch(&session, results, selected_count, interval, format);
+        }
     }
 
+    // Threads stuck in the driver still use the client, process exit reclaims it
+    if (opened && timed_out == 0) {
+        // Frees the cached device/subdevice handles and the client
+        rop_session_close(&session);
+    }
 
+    if (timing_report) {
+        rop_timing_enable(NULL);
+        if (opened) {
+            rop_timing_runs_add(&runs, &timing, session.device_count);
+            fflush(stdout);
+            rop_timing_runs_print(stderr, &runs);
+        }
+        rop_timing_runs_free(&runs);
+    }
+    if (trace_path != NULL && !rop_trace_finish(&trace, trace_path) && ret_code == 0)
+        ret_code = 1;
+    if (timed_out > 0) {
+        fflush(stdout);
+        _exit(ret_code);
+    }
     return ret_code;
 }
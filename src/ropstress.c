@@ -0,0 +1,345 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "librop.h"
+#include "fakerm.h"
+#include "main.h"
+
+// ropstress: a load generator for choosing a safe health-check rate. N
+// threads issue GR_GET_ROP_INFO (or, with --cycle, a full attach, query and
+// free cycle) at a paced rate and record the latency of every call. With
+// --victim an extra thread stands in for a co-running workload's RM calls:
+// its latency is measured alone first and then under the probe load, so
+// the difference is the interference the probe rate causes.
+
+#define STRESS_MAX_THREADS 256
+
+// Log-linear latency histogram: exact below 16 ns, then 16 linear steps per
+// power of two, so any percentile is within 1/16 of the true value
+#define HISTOGRAM_SUB 16
+#define HISTOGRAM_BUCKETS (61 * HISTOGRAM_SUB)
+
+struct histogram
+{
+	uint64_t buckets[HISTOGRAM_BUCKETS];
+	uint64_t count;
+	uint64_t errors;
+	uint64_t min_ns;
+	uint64_t max_ns;
+};
+
+struct stress_thread
+{
+	pthread_t thread;
+	const struct rop_session* session;
+	int device_index;
+	bool cycle;       // attach, query and free per call rather than query held handles
+	double rate;      // calls per second, 0 for back to back
+	uint64_t end_ns;  // CLOCK_MONOTONIC
+	struct histogram histogram;
+};
+
+static void usage(const char* argv0)
+{
+	fprintf(stderr, "Usage: %s [--threads N] [--rate HZ] [--duration SECONDS] [--cycle] [--victim HZ]\n", argv0);
+	fprintf(stderr, "  -t, --threads N         probe threads, spread over the GPUs (default 1)\n");
+	fprintf(stderr, "  -r, --rate HZ           calls per second over all threads, 0 for unpaced (default 0)\n");
+	fprintf(stderr, "  -d, --duration SECONDS  length of the run (default 5)\n");
+	fprintf(stderr, "  -c, --cycle             full attach/alloc/query/free cycles instead of\n");
+	fprintf(stderr, "                          GR_GET_ROP_INFO on held handles\n");
+	fprintf(stderr, "  -v, --victim HZ         also time a workload-like thread querying GPU 0 at HZ,\n");
+	fprintf(stderr, "                          first alone, then under the probe load\n");
+	fprintf(stderr, "Runs against the driver, or the simulated RM when ROP_FAKE_RM is set (see\n");
+	fprintf(stderr, "lock_us and gpu_lock_us in src/fakerm.h for modeled lock contention).\n");
+}
+
+static uint64_t monotonic_ns(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000 + (uint64_t)now.tv_nsec;
+}
+
+static int bucket_of(uint64_t ns)
+{
+	if (ns < HISTOGRAM_SUB) {
+		return (int)ns;
+	}
+	int log2 = 63 - __builtin_clzll(ns);
+	int bucket = (log2 - 3) * HISTOGRAM_SUB + (int)((ns >> (log2 - 4)) & (HISTOGRAM_SUB - 1));
+	return bucket < HISTOGRAM_BUCKETS ? bucket : HISTOGRAM_BUCKETS - 1;
+}
+
+// Lower bound of a bucket
+static uint64_t bucket_ns(int bucket)
+{
+	if (bucket < HISTOGRAM_SUB) {
+		return (uint64_t)bucket;
+	}
+	int log2 = bucket / HISTOGRAM_SUB + 3;
+	return (uint64_t)(HISTOGRAM_SUB + bucket % HISTOGRAM_SUB) << (log2 - 4);
+}
+
+static void histogram_add(struct histogram* histogram, uint64_t ns, bool ok)
+{
+	if (!ok) {
+		histogram->errors++;
+		return;
+	}
+	histogram->buckets[bucket_of(ns)]++;
+	histogram->min_ns = histogram->count == 0 || ns < histogram->min_ns ? ns : histogram->min_ns;
+	histogram->max_ns = ns > histogram->max_ns ? ns : histogram->max_ns;
+	histogram->count++;
+}
+
+static void histogram_merge(struct histogram* into, const struct histogram* from)
+{
+	for (int i = 0; i < HISTOGRAM_BUCKETS; ++i) {
+		into->buckets[i] += from->buckets[i];
+	}
+	if (from->count > 0) {
+		into->min_ns = into->count == 0 || from->min_ns < into->min_ns ? from->min_ns : into->min_ns;
+		into->max_ns = from->max_ns > into->max_ns ? from->max_ns : into->max_ns;
+	}
+	into->count += from->count;
+	into->errors += from->errors;
+}
+
+static uint64_t histogram_percentile(const struct histogram* histogram, double p)
+{
+	uint64_t rank = (uint64_t)(p * (double)histogram->count + 0.999999);
+	uint64_t seen = 0;
+	rank = rank < 1 ? 1 : rank;
+	for (int i = 0; i < HISTOGRAM_BUCKETS; ++i) {
+		seen += histogram->buckets[i];
+		if (seen >= rank) {
+			uint64_t ns = bucket_ns(i);
+			return ns < histogram->min_ns ? histogram->min_ns : ns > histogram->max_ns ? histogram->max_ns : ns;
+		}
+	}
+	return histogram->max_ns;
+}
+
+static void sleep_until(uint64_t ns)
+{
+	struct timespec deadline = { .tv_sec = (time_t)(ns / 1000000000), .tv_nsec = (long)(ns % 1000000000) };
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR) {
+	}
+}
+
+static void* stress_worker(void* arg)
+{
+	struct stress_thread* self = arg;
+	struct rop_gpu gpu;
+	NV2080_CTRL_GR_GET_ROP_INFO_PARAMS rop;
+	uint64_t period_ns = self->rate > 0 ? (uint64_t)(1e9 / self->rate) : 0;
+	uint64_t next_ns = monotonic_ns();
+
+	if (!self->cycle && rop_gpu_attach(self->session, self->device_index, &gpu) != ROP_OK) {
+		self->histogram.errors++;
+		return NULL;
+	}
+	for (;;) {
+		if (period_ns > 0) {
+			// Open loop: a late call goes out right away, but missed slots are not made up
+			sleep_until(next_ns);
+			uint64_t now = monotonic_ns();
+			next_ns = next_ns + period_ns > now ? next_ns + period_ns : now + period_ns;
+		}
+		uint64_t start = monotonic_ns();
+		if (start >= self->end_ns) {
+			break;
+		}
+		bool ok;
+		if (self->cycle) {
+			ok = rop_gpu_attach(self->session, self->device_index, &gpu) == ROP_OK &&
+			     rop_gpu_query(self->session, &gpu, &rop) == ROP_OK;
+			rop_gpu_detach(self->session, &gpu);
+		}
+		else {
+			ok = rop_gpu_query(self->session, &gpu, &rop) == ROP_OK;
+		}
+		histogram_add(&self->histogram, monotonic_ns() - start, ok);
+	}
+	if (!self->cycle) {
+		rop_gpu_detach(self->session, &gpu);
+	}
+	return NULL;
+}
+
+static void print_row(const char* label, const struct histogram* histogram, double seconds)
+{
+	printf("%-16s %9llu %7llu %10.1f %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f\n", label,
+	       (unsigned long long)histogram->count, (unsigned long long)histogram->errors, histogram->count / seconds,
+	       histogram->min_ns / 1e3, histogram_percentile(histogram, 0.5) / 1e3, histogram_percentile(histogram, 0.9) / 1e3,
+	       histogram_percentile(histogram, 0.99) / 1e3, histogram_percentile(histogram, 0.999) / 1e3, histogram->max_ns / 1e3);
+}
+
+// Runs `count` threads plus the optional victim for `seconds` and merges
+// the probe threads' histograms into *probes
+static bool run_phase(struct stress_thread* threads, int count, struct stress_thread* victim, double seconds,
+                      struct histogram* probes)
+{
+	uint64_t end_ns = monotonic_ns() + (uint64_t)(seconds * 1e9);
+	int started = 0;
+	bool ok = true;
+
+	if (victim != NULL) {
+		victim->end_ns = end_ns;
+		if (pthread_create(&victim->thread, NULL, stress_worker, victim) != 0) {
+			perror("Failed to start the victim thread");
+			return false;
+		}
+	}
+	for (; started < count; ++started) {
+		threads[started].end_ns = end_ns;
+		if (pthread_create(&threads[started].thread, NULL, stress_worker, &threads[started]) != 0) {
+			perror("Failed to start a probe thread");
+			ok = false;
+			break;
+		}
+	}
+	for (int i = 0; i < started; ++i) {
+		pthread_join(threads[i].thread, NULL);
+		histogram_merge(probes, &threads[i].histogram);
+	}
+	if (victim != NULL) {
+		pthread_join(victim->thread, NULL);
+	}
+	return ok;
+}
+
+int ropstress_main(int argc, char** argv)
+{
+	static const struct option options[] = {
+		{ "threads", required_argument, NULL, 't' },
+		{ "rate", required_argument, NULL, 'r' },
+		{ "duration", required_argument, NULL, 'd' },
+		{ "cycle", no_argument, NULL, 'c' },
+		{ "victim", required_argument, NULL, 'v' },
+		{ "help", no_argument, NULL, 'h' },
+		{ NULL, 0, NULL, 0 }
+	};
+	int thread_count = 1;
+	double rate = 0;
+	double duration = 5;
+	bool cycle = false;
+	double victim_rate = 0;
+	char* end;
+	int opt;
+
+	while ((opt = getopt_long(argc, argv, "t:r:d:cv:h", options, NULL)) != -1) {
+		switch (opt) {
+		case 't':
+			thread_count = atoi(optarg);
+			if (thread_count < 1 || thread_count > STRESS_MAX_THREADS) {
+				fprintf(stderr, "Invalid --threads value: %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 'r':
+			rate = strtod(optarg, &end);
+			if (*end != '\0' || !(rate >= 0 && rate <= 1e7)) {
+				fprintf(stderr, "Invalid --rate value: %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 'd':
+			duration = strtod(optarg, &end);
+			if (*end != '\0' || !(duration > 0 && duration <= 86400)) {
+				fprintf(stderr, "Invalid --duration value: %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 'c':
+			cycle = true;
+			break;
+		case 'v':
+			victim_rate = strtod(optarg, &end);
+			if (*end != '\0' || !(victim_rate > 0 && victim_rate <= 1e6)) {
+				fprintf(stderr, "Invalid --victim value: %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 'h':
+			usage(argv[0]);
+			return 0;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	static struct stress_thread threads[STRESS_MAX_THREADS];
+	static struct stress_thread victim;
+	static struct histogram probes;
+	static struct histogram victim_idle;
+	struct rop_session session;
+	int ret_code = 0;
+
+	if (!rop_session_open(&session)) {
+		return 1;
+	}
+	if (session.device_count == 0) {
+		fprintf(stderr, "No NVIDIA devices found.\n");
+		rop_session_close(&session);
+		return 1;
+	}
+	for (int i = 0; i < thread_count; ++i) {
+		threads[i] = (struct stress_thread) {
+			.session = &session,
+			.device_index = i % session.device_count,
+			.cycle = cycle,
+			.rate = rate / thread_count
+		};
+	}
+	victim = (struct stress_thread) { .session = &session, .device_index = 0, .rate = victim_rate };
+
+	printf("ropstress: %d thread(s) over %d GPU(s), %s, ", thread_count, session.device_count,
+	       cycle ? "attach/query/free cycles" : "GR_GET_ROP_INFO");
+	if (rate > 0) {
+		printf("%.0f calls/s target, ", rate);
+	}
+	else {
+		printf("unpaced, ");
+	}
+	printf("%.1f s, %s backend\n", duration, session.backend->name);
+
+	if (victim_rate > 0) {
+		if (!run_phase(threads, 0, &victim, duration, &probes)) {
+			ret_code = 1;
+		}
+		victim_idle = victim.histogram;
+		memset(&victim.histogram, 0, sizeof(victim.histogram));
+	}
+	if (!run_phase(threads, thread_count, victim_rate > 0 ? &victim : NULL, duration, &probes)) {
+		ret_code = 1;
+	}
+
+	printf("%-16s %9s %7s %10s %9s %9s %9s %9s %9s %9s\n", "latency (us)", "calls", "errors", "calls/s",
+	       "min", "p50", "p90", "p99", "p99.9", "max");
+	print_row("probe", &probes, duration);
+	if (victim_rate > 0) {
+		print_row("victim idle", &victim_idle, duration);
+		print_row("victim loaded", &victim.histogram, duration);
+	}
+	if (strcmp(session.backend->name, "fake") == 0) {
+		struct fakerm_stats stats;
+		fakerm_get_stats(session.backend, &stats);
+		printf("simulated RM: %lu ioctls, %.3f ms waited for its locks over %lu holds\n",
+		       stats.ioctls, stats.lock_wait_ns / 1e6, stats.lock_holds);
+	}
+	if (probes.errors > 0 || victim.histogram.errors > 0) {
+		ret_code = 1;
+	}
+
+	rop_session_close(&session);
+	return ret_code;
+}
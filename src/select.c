@@ -0,0 +1,139 @@
+#include <ctype.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "librop.h"
+
+#define ROP_SELECTOR_LENGTH 64
+
+static bool is_uuid(const char* selector)
+{
+	return strncasecmp(selector, "GPU-", 4) == 0;
+}
+
+// Parses a non-negative decimal number spanning the whole string
+static bool parse_index(const char* text, int* value)
+{
+	char* end;
+	if (!isdigit((unsigned char)text[0])) {
+		return false;
+	}
+	errno = 0;
+	long parsed = strtol(text, &end, 10);
+	if (*end != '\0' || errno != 0 || parsed > 0xFFFF) {
+		return false;
+	}
+	*value = (int)parsed;
+	return true;
+}
+
+// Parses [domain:]bus:slot.function in hex
+static bool parse_bus_id(const char* text, NvU32* domain, unsigned* bus, unsigned* slot, unsigned* function)
+{
+	int length = 0;
+	*domain = 0;
+	if (sscanf(text, "%x:%x:%x.%x%n", domain, bus, slot, function, &length) == 4 && text[length] == '\0') {
+		return true;
+	}
+	length = 0;
+	*domain = 0;
+	return sscanf(text, "%x:%x.%x%n", bus, slot, function, &length) == 3 && text[length] == '\0';
+}
+
+// Returns the mask of devices matching one selector, 0 if none
+static uint32_t match(const struct rop_session* session, const char* selector)
+{
+	int value;
+	if (parse_index(selector, &value)) {
+		return value < session->device_count ? 1u << value : 0;
+	}
+
+	const char* minor = selector;
+	if (strncmp(minor, "/dev/", 5) == 0) {
+		minor += 5;
+	}
+	if (strncmp(minor, "nvidia", 6) == 0 && parse_index(minor + 6, &value)) {
+		for (int i = 0; i < session->device_count; ++i) {
+			if (session->devices[i].minor == value) {
+				return 1u << i;
+			}
+		}
+		return 0;
+	}
+
+	NvU32 domain;
+	unsigned bus, slot, function;
+	if (parse_bus_id(selector, &domain, &bus, &slot, &function)) {
+		for (int i = 0; i < session->device_count; ++i) {
+			const struct rop_device* device = &session->devices[i];
+			if (device->domain == domain && device->bus == bus && device->slot == slot && device->function == function) {
+				return 1u << i;
+			}
+		}
+		return 0;
+	}
+
+	if (is_uuid(selector)) {
+		for (int i = 0; i < session->device_count; ++i) {
+			char uuid[ROP_GPU_UUID_LENGTH];
+			if (rop_session_get_uuid(session, i, uuid, sizeof(uuid)) == ROP_OK && strcasecmp(uuid, selector) == 0) {
+				return 1u << i;
+			}
+		}
+	}
+	return 0;
+}
+
+int rop_select_devices(const struct rop_session* session, const char* selectors, int* device_indices)
+{
+	uint32_t selected = 0;
+	const char* next = selectors;
+	while (*next != '\0') {
+		char selector[ROP_SELECTOR_LENGTH];
+		size_t length = strcspn(next, ",");
+		if (length == 0 || length >= sizeof(selector)) {
+			fprintf(stderr, "Invalid GPU selector list: %s\n", selectors);
+			return -1;
+		}
+		memcpy(selector, next, length);
+		selector[length] = '\0';
+		next += length + (next[length] == ',');
+
+		uint32_t matched = match(session, selector);
+		if (matched == 0) {
+			fprintf(stderr, "No NVIDIA device matches GPU selector %s\n", selector);
+			return -1;
+		}
+		selected |= matched;
+	}
+
+	int count = 0;
+	for (int i = 0; i < session->device_count; ++i) {
+		if (selected & (1u << i)) {
+			device_indices[count++] = i;
+		}
+	}
+	if (count == 0) {
+		fprintf(stderr, "Invalid GPU selector list: %s\n", selectors);
+		return -1;
+	}
+	return count;
+}
+
+bool rop_select_needs_session(const char* selectors)
+{
+	for (const char* selector = selectors; selector != NULL; selector = strchr(selector, ',')) {
+		if (*selector == ',') {
+			selector++;
+		}
+		if (is_uuid(selector)) {
+			return true;
+		}
+	}
+	return false;
+}
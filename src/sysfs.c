@@ -0,0 +1,55 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "librop.h"
+
+#include "sysfs.h"
+
+static const char* sysfs_root(void)
+{
+	const char* root = getenv("ROP_SYSFS_ROOT");
+	return root != NULL && root[0] != '\0' ? root : "/sys";
+}
+
+bool sysfs_read_pci_attribute(const struct rop_device* device, const char* attribute, char* value, size_t size)
+{
+	char path[256];
+	snprintf(path, sizeof(path), "%s/bus/pci/devices/%s/%s", sysfs_root(), device->busId, attribute);
+	FILE* file = fopen(path, "re");
+	if (file == NULL) {
+		return false;
+	}
+	bool ok = fgets(value, (int)size, file) != NULL;
+	fclose(file);
+	if (ok) {
+		value[strcspn(value, "\n")] = '\0';
+	}
+	return ok;
+}
+
+int rop_device_numa_node(const struct rop_device* device)
+{
+	char value[32];
+	if (!sysfs_read_pci_attribute(device, "numa_node", value, sizeof(value))) {
+		return -1;
+	}
+	return atoi(value);
+}
+
+enum rop_power_state rop_device_power_state(const struct rop_device* device)
+{
+	char value[32];
+	if (!sysfs_read_pci_attribute(device, "power/runtime_status", value, sizeof(value))) {
+		return ROP_POWER_UNKNOWN;
+	}
+	// "suspending" is on its way down, opening the node now would bring it back
+	if (strcmp(value, "suspended") == 0 || strcmp(value, "suspending") == 0) {
+		return ROP_POWER_SUSPENDED;
+	}
+	if (strcmp(value, "active") == 0 || strcmp(value, "resuming") == 0) {
+		return ROP_POWER_ACTIVE;
+	}
+	return ROP_POWER_UNKNOWN; // "unsupported", runtime PM is off for the device
+}
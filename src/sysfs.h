@@ -0,0 +1,16 @@
+#ifndef SYSFS_H
+#define SYSFS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "librop.h"
+
+// Internal to librop: attributes of a GPU's PCI device in sysfs, under
+// $ROP_SYSFS_ROOT (default /sys) so tests can point it at a fake tree.
+
+// Reads the first line of /sys/bus/pci/devices/<busId>/<attribute>,
+// without the newline
+bool sysfs_read_pci_attribute(const struct rop_device* device, const char* attribute, char* value, size_t size);
+
+#endif
@@ -0,0 +1,159 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "timing.h"
+
+#define HISTOGRAM_BUCKETS 32
+
+bool rop_timing_runs_init(struct rop_timing_runs* runs, int capacity)
+{
+	memset(runs, 0, sizeof(*runs));
+	runs->capacity = capacity;
+	runs->phase_ns = calloc((size_t)capacity * ROP_PHASE_COUNT, sizeof(uint64_t));
+	runs->gpu_ns = calloc((size_t)capacity * ROP_MAX_GPUS, sizeof(uint64_t));
+	runs->total_ns = calloc((size_t)capacity, sizeof(uint64_t));
+	if (runs->phase_ns == NULL || runs->gpu_ns == NULL || runs->total_ns == NULL) {
+		perror("Failed to allocate timing samples");
+		rop_timing_runs_free(runs);
+		return false;
+	}
+	return true;
+}
+
+void rop_timing_runs_add(struct rop_timing_runs* runs, const struct rop_timing* timing, int device_count)
+{
+	if (runs->count >= runs->capacity) {
+		return;
+	}
+	uint64_t* phase_ns = &runs->phase_ns[(size_t)runs->count * ROP_PHASE_COUNT];
+	uint64_t* gpu_ns = &runs->gpu_ns[(size_t)runs->count * ROP_MAX_GPUS];
+	uint64_t total = 0;
+
+	for (int phase = 0; phase < ROP_PHASE_COUNT; ++phase) {
+		phase_ns[phase] = timing->session[phase].ns;
+		total += timing->session[phase].ns;
+	}
+	for (int i = 0; i < device_count && i < ROP_MAX_GPUS; ++i) {
+		for (int phase = 0; phase < ROP_PHASE_COUNT; ++phase) {
+			phase_ns[phase] += timing->gpus[i][phase].ns;
+			gpu_ns[i] += timing->gpus[i][phase].ns;
+		}
+		total += gpu_ns[i];
+	}
+	// With parallel probing this is CPU-side time summed over threads, not wall time
+	runs->total_ns[runs->count] = total;
+	runs->device_count = device_count;
+	runs->last = *timing;
+	runs->count++;
+}
+
+void rop_timing_runs_free(struct rop_timing_runs* runs)
+{
+	free(runs->phase_ns);
+	free(runs->gpu_ns);
+	free(runs->total_ns);
+	runs->phase_ns = runs->gpu_ns = runs->total_ns = NULL;
+	runs->count = runs->capacity = 0;
+}
+
+static int compare_u64(const void* a, const void* b)
+{
+	uint64_t x = *(const uint64_t*)a;
+	uint64_t y = *(const uint64_t*)b;
+	return (x > y) - (x < y);
+}
+
+// Nearest-rank percentile of `count` samples spaced `stride` apart, in ms
+static double percentile_ms(const uint64_t* samples, int count, size_t stride, uint64_t* scratch, double p)
+{
+	for (int i = 0; i < count; ++i) {
+		scratch[i] = samples[(size_t)i * stride];
+	}
+	qsort(scratch, (size_t)count, sizeof(*scratch), compare_u64);
+	int rank = (int)(p * count + 0.999999);
+	rank = rank < 1 ? 1 : rank > count ? count : rank;
+	return (double)scratch[rank - 1] / 1e6;
+}
+
+static void print_row(FILE* stream, const char* label, unsigned calls, unsigned ioctls,
+                      const uint64_t* samples, int count, size_t stride, uint64_t* scratch)
+{
+	fprintf(stream, "%-16s %6u %6u %10.3f %10.3f %10.3f\n", label, calls, ioctls,
+	        percentile_ms(samples, count, stride, scratch, 0),
+	        percentile_ms(samples, count, stride, scratch, 0.5),
+	        percentile_ms(samples, count, stride, scratch, 0.99));
+}
+
+void rop_timing_runs_print(FILE* stream, const struct rop_timing_runs* runs)
+{
+	if (runs->count == 0) {
+		return;
+	}
+	uint64_t* scratch = malloc((size_t)runs->count * sizeof(uint64_t));
+	if (scratch == NULL) {
+		perror("Failed to allocate timing scratch");
+		return;
+	}
+	const struct rop_timing* last = &runs->last;
+	unsigned total_calls = 0;
+	unsigned total_ioctls = 0;
+
+	fprintf(stream, "Timing over %d run(s), ms per run:\n", runs->count);
+	fprintf(stream, "%-16s %6s %6s %10s %10s %10s\n", "phase", "calls", "ioctls", "min", "median", "p99");
+	for (int phase = 0; phase < ROP_PHASE_COUNT; ++phase) {
+		unsigned calls = last->session[phase].calls;
+		unsigned ioctls = last->session[phase].ioctls;
+		for (int i = 0; i < runs->device_count; ++i) {
+			calls += last->gpus[i][phase].calls;
+			ioctls += last->gpus[i][phase].ioctls;
+		}
+		if (calls == 0) {
+			continue;
+		}
+		print_row(stream, rop_phase_string(phase), calls, ioctls, &runs->phase_ns[phase], runs->count, ROP_PHASE_COUNT, scratch);
+		total_calls += calls;
+		total_ioctls += ioctls;
+	}
+	print_row(stream, "total", total_calls, total_ioctls, runs->total_ns, runs->count, 1, scratch);
+
+	for (int i = 0; i < runs->device_count; ++i) {
+		char label[16];
+		unsigned calls = 0;
+		unsigned ioctls = 0;
+		for (int phase = 0; phase < ROP_PHASE_COUNT; ++phase) {
+			calls += last->gpus[i][phase].calls;
+			ioctls += last->gpus[i][phase].ioctls;
+		}
+		snprintf(label, sizeof(label), "GPU %d", i);
+		print_row(stream, label, calls, ioctls, &runs->gpu_ns[i], runs->count, ROP_MAX_GPUS, scratch);
+	}
+	free(scratch);
+
+	if (runs->count < 2) {
+		return;
+	}
+	// Bucket b > 0 holds totals in [2^b, 2^(b+1)) microseconds, bucket 0 below 2
+	int histogram[HISTOGRAM_BUCKETS] = { 0 };
+	int first = HISTOGRAM_BUCKETS;
+	int last_bucket = 0;
+	int peak = 0;
+	for (int run = 0; run < runs->count; ++run) {
+		uint64_t us = runs->total_ns[run] / 1000;
+		int bucket = 0;
+		while (us > 1 && bucket < HISTOGRAM_BUCKETS - 1) {
+			us >>= 1;
+			bucket++;
+		}
+		histogram[bucket]++;
+		first = bucket < first ? bucket : first;
+		last_bucket = bucket > last_bucket ? bucket : last_bucket;
+		peak = histogram[bucket] > peak ? histogram[bucket] : peak;
+	}
+	fprintf(stream, "Run total histogram (us):\n");
+	for (int bucket = first; bucket <= last_bucket; ++bucket) {
+		int width = histogram[bucket] * 40 / peak;
+		fprintf(stream, "%10llu .. %-10llu %6d %.*s\n", bucket == 0 ? 0ULL : 1ULL << bucket, (1ULL << (bucket + 1)) - 1, histogram[bucket],
+		        width, "########################################");
+	}
+}
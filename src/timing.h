@@ -0,0 +1,33 @@
+#ifndef TIMING_H
+#define TIMING_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "librop.h"
+
+// --timing report. Each probe run leaves a struct rop_timing (see librop.h);
+// the runs are collected here and summarized per phase and per GPU with
+// min/median/p99 across runs, the calls and ioctls a run costs, and a
+// log2 histogram of the whole-run time.
+
+#define ROP_TIMING_MAX_RUNS 10000
+
+struct rop_timing_runs
+{
+	int count;
+	int capacity;
+	int device_count;
+	uint64_t* phase_ns; // [run * ROP_PHASE_COUNT + phase], summed over the session and GPUs
+	uint64_t* gpu_ns;   // [run * ROP_MAX_GPUS + device_index], all phases of the GPU
+	uint64_t* total_ns; // [run]
+	struct rop_timing last; // calls and ioctls are reported from the last run
+};
+
+bool rop_timing_runs_init(struct rop_timing_runs* runs, int capacity);
+void rop_timing_runs_add(struct rop_timing_runs* runs, const struct rop_timing* timing, int device_count);
+void rop_timing_runs_print(FILE* stream, const struct rop_timing_runs* runs);
+void rop_timing_runs_free(struct rop_timing_runs* runs);
+
+#endif
@@ -0,0 +1,133 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+bool rop_trace_start(struct rop_trace* trace, uint32_t capacity)
+{
+	trace->events = malloc((size_t)capacity * sizeof(*trace->events));
+	if (trace->events == NULL) {
+		perror("Failed to allocate the trace buffer");
+		return false;
+	}
+	// Touch every page now rather than fault them in between ioctls
+	memset(trace->events, 0, (size_t)capacity * sizeof(*trace->events));
+	trace->capacity = capacity;
+	trace->count = 0;
+	rop_trace_enable(trace);
+	return true;
+}
+
+static const char* escape_name(int escape)
+{
+	switch (escape) {
+	case NV_ESC_CARD_INFO:
+		return "CARD_INFO";
+	case NV_ESC_REGISTER_FD:
+		return "REGISTER_FD";
+	case NV_ESC_RM_ALLOC:
+		return "RM_ALLOC";
+	case NV_ESC_RM_CONTROL:
+		return "RM_CONTROL";
+	case NV_ESC_RM_FREE:
+		return "RM_FREE";
+	case NV_ESC_ALLOC_OS_EVENT:
+		return "ALLOC_OS_EVENT";
+	case NV_ESC_FREE_OS_EVENT:
+		return "FREE_OS_EVENT";
+	case NV_ESC_RM_GET_EVENT_DATA:
+		return "RM_GET_EVENT_DATA";
+	}
+	return "ioctl";
+}
+
+static const char* code_name(int escape, NvU32 code)
+{
+	if (escape == NV_ESC_RM_ALLOC) {
+		switch (code) {
+		case NV01_ROOT:
+			return "NV01_ROOT";
+		case NV01_DEVICE_0:
+			return "NV01_DEVICE_0";
+		case NV20_SUBDEVICE_0:
+			return "NV20_SUBDEVICE_0";
+		case NV01_EVENT_OS_EVENT:
+			return "NV01_EVENT_OS_EVENT";
+		case AMPERE_SMC_PARTITION_REF:
+			return "AMPERE_SMC_PARTITION_REF";
+		case AMPERE_SMC_EXEC_PARTITION_REF:
+			return "AMPERE_SMC_EXEC_PARTITION_REF";
+		}
+	}
+	else if (escape == NV_ESC_RM_CONTROL) {
+		switch (code) {
+		case NV0000_CTRL_CMD_GPU_GET_ID_INFO_V2:
+			return "GPU_GET_ID_INFO_V2";
+		case NV0000_CTRL_CMD_GPU_GET_PROBED_IDS:
+			return "GPU_GET_PROBED_IDS";
+		case NV0000_CTRL_CMD_GPU_GET_UUID_FROM_GPU_ID:
+			return "GPU_GET_UUID_FROM_GPU_ID";
+		case NV2080_CTRL_CMD_GPU_GET_NAME_STRING:
+			return "GPU_GET_NAME_STRING";
+		case NV2080_CTRL_CMD_BUS_GET_PCI_INFO:
+			return "BUS_GET_PCI_INFO";
+		case CMD_SUBDEVICE_CTRL_GR_GET_ROP_INFO:
+			return "GR_GET_ROP_INFO";
+		case NV2080_CTRL_CMD_GR_GET_INFO:
+			return "GR_GET_INFO";
+		case NV2080_CTRL_CMD_EVENT_SET_NOTIFICATION:
+			return "EVENT_SET_NOTIFICATION";
+		case NV2080_CTRL_CMD_GPU_GET_PARTITIONS:
+			return "GPU_GET_PARTITIONS";
+		case NVC637_CTRL_CMD_EXEC_PARTITIONS_GET:
+			return "EXEC_PARTITIONS_GET";
+		}
+	}
+	return NULL;
+}
+
+bool rop_trace_finish(struct rop_trace* trace, const char* path)
+{
+	rop_trace_enable(NULL);
+	uint32_t count = trace->count < trace->capacity ? trace->count : trace->capacity;
+	FILE* file = fopen(path, "w");
+	if (file == NULL) {
+		perror(path);
+		free(trace->events);
+		trace->events = NULL;
+		return false;
+	}
+
+	// Timestamps are microseconds relative to the first ioctl
+	uint64_t origin = count > 0 ? trace->events[0].start_ns : 0;
+	for (uint32_t i = 1; i < count; ++i) {
+		origin = trace->events[i].start_ns < origin ? trace->events[i].start_ns : origin;
+	}
+
+	int pid = (int)getpid();
+	fprintf(file, "{\"displayTimeUnit\":\"ns\",\"otherData\":{\"dropped\":%u},\"traceEvents\":[\n", trace->count - count);
+	for (uint32_t i = 0; i < count; ++i) {
+		const struct rop_trace_event* event = &trace->events[i];
+		const char* code = code_name(event->escape, event->code);
+		fprintf(file, "%s{\"name\":\"%s%s%s\",\"cat\":\"rm\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,"
+		        "\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"handle\":\"0x%x\",\"code\":\"0x%x\",\"status\":\"0x%x\",\"errno\":%d}}",
+		        i > 0 ? ",\n" : "", escape_name(event->escape), code != NULL ? " " : "", code != NULL ? code : "",
+		        pid, event->tid, (double)(event->start_ns - origin) / 1e3, (double)event->duration_ns / 1e3,
+		        event->handle, event->code, event->status, event->result);
+	}
+	fprintf(file, "\n]}\n");
+
+	bool ok = !ferror(file);
+	if (fclose(file) != 0 || !ok) {
+		perror(path);
+		ok = false;
+	}
+	if (trace->count > trace->capacity) {
+		fprintf(stderr, "Trace buffer full, %u ioctl(s) not recorded\n", trace->count - trace->capacity);
+	}
+	free(trace->events);
+	trace->events = NULL;
+	return ok;
+}
@@ -0,0 +1,22 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "librop.h"
+
+// --trace FILE: the RM ioctls of a run in the Chrome trace-event format,
+// viewable in Perfetto (ui.perfetto.dev) or chrome://tracing. Each ioctl is a
+// complete ("X") event on its thread's track, with the handle, class or
+// control cmd, RM status and errno in its args.
+
+#define ROP_TRACE_DEFAULT_EVENTS 65536
+
+// Preallocates (and prefaults) room for `capacity` events and enables tracing
+bool rop_trace_start(struct rop_trace* trace, uint32_t capacity);
+
+// Disables tracing, writes the recorded events to `path` and frees the buffer
+bool rop_trace_finish(struct rop_trace* trace, const char* path);
+
+#endif
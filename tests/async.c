@@ -0,0 +1,55 @@
+// Drives the asynchronous probe API the way an event loop would, see
+// rop_async_* in src/librop.h. Built and run against the simulated RM by
+// tests/check.sh: submits one probe per GPU, polls the eventfd and prints
+// each collected submission.
+#include <stdio.h>
+#include <poll.h>
+
+#include "../src/librop.h"
+
+int main(void)
+{
+	struct rop_session session;
+	if (!rop_session_open(&session)) {
+		return 1;
+	}
+	struct rop_async* async = rop_async_create(&session, 2);
+	if (async == NULL) {
+		perror("rop_async_create");
+		rop_session_close(&session);
+		return 1;
+	}
+
+	int submitted = 0;
+	for (int device_index = 0; device_index < session.device_count; ++device_index) {
+		if (rop_async_submit(async, &device_index, 1, ROP_PROBE_VERDICT) < 0) {
+			perror("rop_async_submit");
+			break;
+		}
+		submitted++;
+	}
+
+	int ret_code = submitted == session.device_count ? 0 : 1;
+	struct pollfd fd = { .fd = rop_async_fd(async), .events = POLLIN };
+	while (submitted > 0 && poll(&fd, 1, 10000) == 1) {
+		int ticket;
+		int count;
+		struct rop_result results[ROP_MAX_GPUS];
+		while ((count = rop_async_collect(async, &ticket, results)) >= 0) {
+			for (int i = 0; i < count; ++i) {
+				printf("ticket %d: GPU %d %s, ROP operations count %u\n", ticket, results[i].device_index,
+				       rop_status_string(results[i].status), results[i].rop.ropOperationsCount);
+				ret_code = results[i].status == ROP_OK ? ret_code : 1;
+			}
+			submitted--;
+		}
+	}
+	if (submitted > 0) {
+		fprintf(stderr, "%d submission(s) never completed\n", submitted);
+		ret_code = 1;
+	}
+
+	rop_async_destroy(async);
+	rop_session_close(&session);
+	return ret_code;
+}
@@ -0,0 +1,306 @@
+#!/bin/sh
+# Runs the tools against the simulated RM (see src/fakerm.h) and checks their
+# output and exit codes for the failure modes they exist to report.
+# Run by `make check` after the build, or as tests/check.sh [BINDIR].
+
+bin=${1:-bin}
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+export ROP_CACHE_DIR="$work"
+failed=0
+passed=0
+
+now_ms()
+{
+	echo $(($(date +%s%N) / 1000000))
+}
+
+# run SPEC COMMAND [ARGS...]: runs COMMAND under ROP_FAKE_RM=SPEC, a hung
+# probe is killed after 20 s
+run()
+{
+	spec=$1
+	shift
+	started=$(now_ms)
+	out=$(ROP_FAKE_RM="$spec" timeout 20 "$@" 2>&1)
+	code=$?
+	elapsed_ms=$(($(now_ms) - started))
+}
+
+# check NAME CODE [TEXT...]: the last run exited with CODE and printed every TEXT
+check()
+{
+	name=$1
+	expected=$2
+	shift 2
+	ok=true
+	if [ "$code" -ne "$expected" ]; then
+		echo "FAIL $name: exit code $code, expected $expected"
+		ok=false
+	fi
+	for text in "$@"; do
+		if ! printf '%s\n' "$out" | grep -qF -- "$text"; then
+			echo "FAIL $name: no \"$text\" in the output"
+			ok=false
+		fi
+	done
+	if $ok; then
+		echo "ok   $name"
+		passed=$((passed + 1))
+	else
+		printf '%s\n' "$out" | sed 's/^/     | /'
+		failed=$((failed + 1))
+	fi
+}
+
+# fail NAME WHY: a check that is not about the output
+fail()
+{
+	echo "FAIL $1: $2"
+	failed=$((failed + 1))
+}
+
+# start_ropd SPEC [ARGS...]: runs ropd on $work/ropd.sock in the background,
+# logging to $work/ropd.log, and waits for its socket
+start_ropd()
+{
+	spec=$1
+	shift
+	rm -f "$work/ropd.sock"
+	ROP_FAKE_RM="$spec" "$bin/ropd" --socket "$work/ropd.sock" "$@" 2>"$work/ropd.log" &
+	daemon=$!
+	for _ in 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 17 18 19 20; do
+		[ -S "$work/ropd.sock" ] && return
+		sleep 0.1
+	done
+}
+
+# stop_ropd: stops it with SIGTERM, its exit code and log become the last run
+stop_ropd()
+{
+	kill "$daemon"
+	wait "$daemon"
+	code=$?
+	out=$(cat "$work/ropd.log")
+}
+
+# The RM ABI constants, a mismatch fails to compile
+out=$(gcc -fsyntax-only "$(dirname "$0")/nvrm_constants.c" 2>&1)
+code=$?
+check "nvrm.h constants match the SDK" 0
+
+run "gpus=2" "$bin/ropmulti"
+check "healthy GPUs" 0 "GPU 1 ROP operations count: 96" "Found 2 NVIDIA device(s)."
+
+run "gpus=1,units=11" "$bin/rop"
+check "rop reports the fake's ROP info" 2 "ROP unit count: 11" "ROP operations count: 88" \
+      "ROP verdict: DEFICIENT (expected 96)"
+
+run "gpus=2,gpu1.lost=1" "$bin/ropmulti"
+check "lost GPU" 1 "GPU 1: Skipping due to device allocation failure." "GPU 0 ROP operations count: 96"
+
+run "gpus=1,gpcs=5,tpcs=35,sm_per_tpc=2,cores=8960,fbps=8,zcull_banks=4" "$bin/ropmulti" --units
+check "GR unit inventory" 0 "GPU 0 GPC count: 5" "GPU 0 TPC count: 35" "GPU 0 SM count: 70" \
+      "GPU 0 CUDA core count: 8960" "GPU 0 FBP count: 8" "GPU 0 ZCULL bank count: 4"
+
+run "gpus=3,gpu1.minor=5,gpu2.hidden=1" "$bin/ropmulti"
+check "enumeration by probed IDs" 0 "--- Processing GPU 1 /dev/nvidia5 ---" "Found 2 NVIDIA device(s)."
+
+run "gpus=2,gpu1.pci_device=0x2b85" "$bin/ropnvml"
+check "ropnvml names the GPUs from RM" 0 "Name: NVIDIA GeForce RTX 5070 Ti" "Name: NVIDIA GeForce RTX 5090"
+
+# Unchanged GPUs are not printed again on later ticks
+out=$(ROP_FAKE_RM="gpus=2" timeout --preserve-status -s TERM 1 "$bin/ropmulti" --watch 0.2 2>&1)
+code=$?
+check "--watch stops on SIGTERM" 0 "GPU 1 ROP operations count: 96"
+if [ "$(printf '%s\n' "$out" | grep -c "GPU 0 ROP unit count")" -ne 1 ]; then
+	fail "--watch prints only changes" "GPU 0 was printed more than once"
+fi
+
+run "gpus=2,gpu1.lost=1" "$bin/ropmulti" --format json
+check "--format json" 1 '{"index":0,"minor":0,"bus_id":"0000:01:00.0","name":"NVIDIA GeForce RTX 5070 Ti","rop_unit_count":12' \
+      '"status":"device allocation failure"'
+
+run "gpus=2" "$bin/ropmulti" --format csv
+check "--format csv" 0 "index,minor,bus_id,name,rop_unit_count,rop_operations_factor,rop_operations_count,status" \
+      '1,1,0000:02:00.0,"NVIDIA GeForce RTX 5070 Ti",12,8,96,ok'
+
+run "gpus=2,gpu0.units=11" "$bin/ropmulti"
+check "deficient GPU" 2 "GPU 0 ROP verdict: DEFICIENT (expected 96)" "GPU 1 ROP verdict: PASS (expected 96)"
+
+printf '10de:2c05:12345678 88 # this board ships with fewer\n' >"$work/expected"
+run "gpus=2,units=11,gpu1.subsystem=0x12345678" "$bin/ropmulti" --expected "$work/expected"
+check "--expected board override" 2 "GPU 0 ROP verdict: DEFICIENT (expected 96)" "GPU 1 ROP verdict: PASS (expected 88)"
+
+# GPU 1 hangs for 5 s, GPU 2 is busy for its first two calls
+run "gpus=3,gpu1.latency_us=5000000,gpu2.busy=2" "$bin/ropmulti" --timeout 500 --no-cache
+check "--timeout skips a hung GPU" 1 "GPU 1: Skipping due to timeout." "GPU 0 ROP operations count: 96" \
+      "GPU 2 ROP operations count: 96"
+if [ "$elapsed_ms" -ge 4000 ]; then
+	fail "--timeout does not wait for the hung GPU" "took $elapsed_ms ms"
+fi
+
+run "gpus=2,gpu1.busy=2" "$bin/ropmulti" --no-cache
+check "busy GPU is retried" 0 "GPU 1 ROP operations count: 96"
+
+run "gpus=2" "$bin/ropmulti" --timing --repeat 3
+check "--timing --repeat" 0 "Timing over 3 run(s)" "GPU 1 ROP operations count: 96"
+
+# The first run times out, it is the one reported
+run "gpus=2,gpu1.latency_us=5000000" "$bin/ropmulti" --timing --repeat 3 --timeout 300
+check "--repeat stops at a timed-out run" 1 "GPU 1: Skipping due to timeout." "Timing over 1 run(s)"
+if [ "$elapsed_ms" -ge 4000 ]; then
+	fail "--repeat does not wait for the hung GPU" "took $elapsed_ms ms"
+fi
+
+run "gpus=2" "$bin/ropmulti" --trace "$work/trace.json" --timing --repeat 2
+check "--trace" 0 "GPU 1 ROP operations count: 96" "Timing over 2 run(s)"
+if ! grep -qF '"name":"RM_CONTROL GR_GET_ROP_INFO"' "$work/trace.json" 2>/dev/null; then
+	fail "--trace records the controls" "no GR_GET_ROP_INFO control in $work/trace.json"
+fi
+
+# GPU 0 is on node 0 with CPU 0; excluding every CPU leaves the probe unpinned
+mkdir -p "$work/sys/bus/pci/devices/0000:01:00.0"
+echo 0 >"$work/sys/bus/pci/devices/0000:01:00.0/numa_node"
+echo 0 >"$work/sys/bus/pci/devices/0000:01:00.0/local_cpulist"
+export ROP_SYSFS_ROOT="$work/sys"
+run "gpus=2" "$bin/ropmulti" --numa --avoid-cpus 0-4095 --no-cache
+check "--numa --avoid-cpus" 0 "GPU 0 ROP operations count: 96" "GPU 1 ROP operations count: 96"
+run "gpus=2" "$bin/ropmulti" --avoid-cpus 3-1
+check "--avoid-cpus rejects a bad list" 1 "Invalid CPU list: 3-1"
+
+mkdir -p "$work/sys/bus/pci/devices/0000:02:00.0/power"
+echo suspended >"$work/sys/bus/pci/devices/0000:02:00.0/power/runtime_status"
+run "gpus=2" "$bin/ropmulti" --no-wake --no-cache
+check "--no-wake skips a suspended GPU" 0 "GPU 1: Skipping due to runtime suspend." "GPU 0 ROP operations count: 96"
+unset ROP_SYSFS_ROOT
+
+run "gpus=2" "$bin/ropstress" --threads 2 --duration 1
+check "ropstress" 0 "ropstress: 2 thread(s) over 2 GPU(s)" "probe "
+
+run "gpus=3" "$bin/ropmulti" --gpu 1,nvidia2 --no-cache
+check "--gpu by index and minor" 0 "GPU 1 ROP operations count: 96" "GPU 2 ROP operations count: 96"
+if printf '%s\n' "$out" | grep -q "GPU 0"; then
+	fail "--gpu leaves other GPUs alone" "GPU 0 was probed"
+fi
+run "gpus=3" "$bin/ropmulti" --gpu GPU-fa4e0000-0000-4000-8000-000000000002 --no-cache
+check "--gpu by UUID" 0 "--- Processing GPU 2 /dev/nvidia2 ---"
+
+# A selector matching nothing fails the first --repeat run, the trace is still written
+rm -f "$work/trace.json"
+run "gpus=3" "$bin/ropmulti" --gpu 7 --timing --repeat 2 --trace "$work/trace.json"
+check "--gpu rejects an unknown GPU" 1 "No NVIDIA device matches GPU selector 7"
+[ -s "$work/trace.json" ] || fail "--trace is written after a failed selection" "no $work/trace.json"
+
+# Only once `make python` has built the module
+if command -v python3 >/dev/null && ls "$bin"/rop.*.so >/dev/null 2>&1; then
+	run "gpus=2,gpu1.units=11" env PYTHONPATH="$bin" python3 -c '
+import rop
+for gpu in rop.probe(gpus="1"):
+    print(gpu["index"], gpu["rop_operations_count"], gpu["status"], gpu["verdict"])
+print(len(rop.devices()))
+rop.close()
+'
+	check "python module" 0 "1 88 ok DEFICIENT" "2"
+fi
+
+# Only where bin/ holds the static library
+if [ -f "$bin/librop.a" ]; then
+	out=$(gcc -o "$work/async" "$(dirname "$0")/async.c" "$bin/librop.a" -pthread 2>&1)
+	code=$?
+	check "tests/async.c builds" 0
+	run "gpus=3,gpu1.latency_us=100000,gpu2.units=11" "$work/async"
+	check "async probe API" 0 "ticket 0: GPU 0 ok, ROP operations count 96" \
+	      "ticket 1: GPU 1 ok, ROP operations count 96" "ticket 2: GPU 2 ok, ROP operations count 88"
+fi
+
+# GI 2 of GPU 0 came up with 2 of its 3 GPCs
+run "gpus=2,gpu0.mig=2,gpu0.mig_ci=2,gpu0.gi2.gpcs=2" "$bin/ropmulti" --mig
+check "--mig reports a reduced GPU instance" 2 "GPU 0 GI 2 GPC count: 2 (configured 3)" "GPU 0 GI 2 verdict: REDUCED" \
+      "GPU 0 GI 1 CI 1 ROP operations count: 16" "GPU 0 GI 1 GPC count: 3 (configured 3)"
+
+# The second run answers from the cache without paying the 0.1 s per ioctl
+run "gpus=2,latency_us=100000" "$bin/ropmulti"
+check "cache miss probes live" 0 "GPU 1 ROP operations count: 96"
+[ -f "$work/results.cache" ] || fail "cache is written" "no $work/results.cache"
+run "gpus=2,latency_us=100000" "$bin/ropmulti"
+check "cache hit" 0 "GPU 1 ROP operations count: 96"
+if [ "$elapsed_ms" -ge 100 ]; then
+	fail "cache hit skips the driver" "took $elapsed_ms ms"
+fi
+run "gpus=2,latency_us=100000" "$bin/ropmulti" --no-cache
+if [ "$elapsed_ms" -lt 100 ]; then
+	fail "--no-cache probes live" "took $elapsed_ms ms"
+fi
+
+start_ropd "gpus=2,gpu1.units=10"
+run "" "$bin/ropd" --client --socket "$work/ropd.sock"
+check "ropd serves cached results" 0 "GPU 0 ROP operations count: 96" "GPU 1 ROP operations count: 80"
+run "" "$bin/ropd" --client --probe --socket "$work/ropd.sock" --device 1
+check "ropd --probe" 0 "GPU 1 ROP operations count: 80"
+run "" "$bin/ropd" --client --socket "$work/ropd.sock" --device 2
+check "ropd rejects an unknown GPU" 1 "GPU 2: no such device"
+stop_ropd
+check "ropd exits cleanly" 0
+
+start_ropd "gpus=2,gpu1.units=10" --board="rop-check-$$"
+run "" "$bin/ropd" --client --board="rop-check-$$"
+check "ropd --board" 2 "GPU 0 ROP operations count: 96" "GPU 1 ROP operations count: 80" \
+      "GPU 1 ROP verdict: DEFICIENT (expected 96)"
+stop_ropd
+check "ropd --board exits cleanly" 0
+[ -e "/dev/shm/rop-check-$$" ] && fail "ropd --board removes the board" "/dev/shm/rop-check-$$ is left"
+
+# GPU 1 falls off the bus 0.3 s in, ropd re-probes it on the event
+start_ropd "gpus=2,gpu1.xid=79,gpu1.xid_ms=300" --events
+sleep 1
+run "" "$bin/ropd" --client --socket "$work/ropd.sock"
+check "ropd --events re-probes a lost GPU" 1 "GPU 1: device allocation failure" "GPU 0 ROP operations count: 96"
+stop_ropd
+check "ropd --events logs the Xid" 0 "GPU 1: GPU lost (Xid 79), re-probing"
+
+# GPU 1 takes 0.2 s per ioctl, a --probe of it must not hold up cached queries
+start_ropd "gpus=2,gpu1.latency_us=200000"
+"$bin/ropd" --client --probe --socket "$work/ropd.sock" --device 1 >/dev/null 2>&1 &
+prober=$!
+sleep 0.1
+run "" "$bin/ropd" --client --socket "$work/ropd.sock" --device 0
+check "ropd answers cached queries during a probe" 0 "GPU 0 ROP operations count: 96"
+if [ "$elapsed_ms" -ge 150 ]; then
+	fail "ropd answers cached queries during a probe" "took $elapsed_ms ms"
+fi
+wait "$prober" || fail "ropd --probe of a slow GPU" "exit code $?"
+stop_ropd
+
+# A request split over two segments is answered once its blank line arrives
+port=$((20000 + $$ % 20000))
+start_ropd "gpus=2,gpu1.units=10" --metrics "127.0.0.1:$port"
+if command -v curl >/dev/null; then
+	out=$(curl -s "http://127.0.0.1:$port/metrics")
+	code=$?
+	check "ropd --metrics" 0 'gpu_rop_operations_count{gpu="1"' 'gpu_rop_deficient{gpu="1"'
+fi
+if command -v python3 >/dev/null; then
+	out=$(python3 -c '
+import socket, sys, time
+s = socket.create_connection(("127.0.0.1", int(sys.argv[1])))
+s.sendall(b"GET /metrics HTTP/1.0\r\n")
+time.sleep(0.2)
+s.sendall(b"Host: localhost\r\n\r\n")
+sys.stdout.write(s.makefile("rb").read().decode())
+' "$port" 2>&1)
+	code=$?
+	check "ropd buffers a split HTTP request" 0 "HTTP/1.0 200 OK" "gpu_rop_units"
+	out=$(python3 -c '
+import socket, sys
+s = socket.create_connection(("127.0.0.1", int(sys.argv[1])))
+s.sendall(b"GET /metrics HTTP/1.0\r\n" + b"X: " + b"a" * 4096 + b"\r\n\r\n")
+sys.stdout.write(s.makefile("rb").read(64).decode())
+' "$port" 2>&1)
+	code=$?
+	check "ropd rejects an oversized HTTP request" 0 "HTTP/1.0 431"
+fi
+stop_ropd
+
+echo "$passed passed, $failed failed"
+[ "$failed" -eq 0 ]
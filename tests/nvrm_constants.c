@@ -0,0 +1,106 @@
+// Pins the RM ABI values in src/nvrm.h to the ones in NVIDIA's
+// open-gpu-kernel-modules headers (the file each group comes from is named
+// above it). Only compiled, `make check` fails on the first mismatch.
+#include "../src/nvrm.h"
+
+#define SDK(name, value) _Static_assert((name) == (value), #name " differs from the SDK value " #value)
+
+// kernel-open/common/inc/nv-ioctl-numbers.h, nv_escape.h
+SDK(NV_IOCTL_MAGIC, 'F');
+SDK(NV_IOCTL_BASE, 200);
+SDK(NV_ESC_CARD_INFO, 200);
+SDK(NV_ESC_REGISTER_FD, 201);
+SDK(NV_ESC_ALLOC_OS_EVENT, 206);
+SDK(NV_ESC_FREE_OS_EVENT, 207);
+SDK(NV_ESC_RM_FREE, 0x29);
+SDK(NV_ESC_RM_CONTROL, 0x2A);
+SDK(NV_ESC_RM_ALLOC, 0x2B);
+SDK(NV_ESC_RM_GET_EVENT_DATA, 0x52);
+
+// src/common/sdk/nvidia/inc/nvstatuscodes.h
+SDK(NV_OK, 0x00000000);
+SDK(NV_ERR_BUSY_RETRY, 0x00000003);
+SDK(NV_ERR_GPU_IS_LOST, 0x0000000F);
+SDK(NV_ERR_INSUFFICIENT_RESOURCES, 0x0000001A);
+SDK(NV_ERR_INVALID_ARGUMENT, 0x0000001F);
+SDK(NV_ERR_INVALID_CLASS, 0x00000022);
+SDK(NV_ERR_INVALID_CLIENT, 0x00000023);
+SDK(NV_ERR_INVALID_OBJECT_HANDLE, 0x00000033);
+SDK(NV_ERR_INVALID_OBJECT_PARENT, 0x00000036);
+SDK(NV_ERR_INVALID_PARAM_STRUCT, 0x00000039);
+SDK(NV_ERR_INVALID_STATE, 0x00000040);
+SDK(NV_ERR_NOT_SUPPORTED, 0x00000056);
+SDK(NV_ERR_OBJECT_NOT_FOUND, 0x00000057);
+SDK(NV_ERR_GENERIC, 0x0000FFFF);
+
+// src/common/sdk/nvidia/inc/class/cl0000.h, cl0080.h, cl2080.h
+SDK(NV01_ROOT, 0x0);
+SDK(NV01_DEVICE_0, 0x80);
+SDK(NV20_SUBDEVICE_0, 0x2080);
+
+// class/cl0079.h, cl2080_notification.h and nverror.h
+SDK(NV01_EVENT_OS_EVENT, 0x79);
+SDK(NV2080_NOTIFIERS_ECC_DBE, 81);
+SDK(NV2080_NOTIFIERS_RC_ERROR, 128);
+SDK(ROBUST_CHANNEL_GPU_HAS_FALLEN_OFF_THE_BUS, 79);
+SDK(ROBUST_CHANNEL_GPU_RECOVERY_ACTION_CHANGED, 154);
+
+// ctrl/ctrl0000/ctrl0000gpu.h
+SDK(NV0000_CTRL_CMD_GPU_GET_ID_INFO_V2, 0x205);
+SDK(NV0000_CTRL_CMD_GPU_GET_PROBED_IDS, 0x214);
+SDK(NV0000_CTRL_GPU_MAX_PROBED_GPUS, 32);
+SDK(NV0000_CTRL_GPU_INVALID_ID, 0xFFFFFFFF);
+SDK(NV0000_CTRL_CMD_GPU_GET_UUID_FROM_GPU_ID, 0x275);
+SDK(NV0000_CTRL_CMD_GPU_GET_UUID_FROM_GPU_ID_FLAGS_FORMAT_ASCII, 0);
+SDK(NV0000_GPU_MAX_GID_LENGTH, 0x100);
+
+// ctrl/ctrl2080/ctrl2080gpu.h
+SDK(NV2080_CTRL_CMD_GPU_GET_NAME_STRING, 0x20800110);
+SDK(NV2080_CTRL_GPU_GET_NAME_STRING_FLAGS_TYPE_ASCII, 0);
+SDK(NV2080_GPU_MAX_NAME_STRING_LENGTH, 0x40);
+SDK(NV2080_CTRL_CMD_GPU_GET_PARTITIONS, 0x20800175);
+SDK(NV2080_CTRL_GPU_MAX_PARTITIONS, 8);
+SDK(NV2080_CTRL_GPU_MAX_SMC_IDS, 8);
+
+// class/clc637.h, clc638.h and ctrl/ctrlc637.h
+SDK(AMPERE_SMC_PARTITION_REF, 0xC637);
+SDK(AMPERE_SMC_EXEC_PARTITION_REF, 0xC638);
+SDK(NVC637_CTRL_CMD_EXEC_PARTITIONS_GET, 0xC6370103);
+SDK(NVC637_CTRL_MAX_EXEC_PARTITIONS, 8);
+
+// ctrl/ctrl2080/ctrl2080bus.h
+SDK(NV2080_CTRL_CMD_BUS_GET_PCI_INFO, 0x20801801);
+
+// ctrl/ctrl2080/ctrl2080event.h
+SDK(NV2080_CTRL_CMD_EVENT_SET_NOTIFICATION, 0x20800301);
+SDK(NV2080_CTRL_EVENT_SET_NOTIFICATION_ACTION_DISABLE, 0);
+SDK(NV2080_CTRL_EVENT_SET_NOTIFICATION_ACTION_SINGLE, 1);
+SDK(NV2080_CTRL_EVENT_SET_NOTIFICATION_ACTION_REPEAT, 2);
+
+// ctrl/ctrl2080/ctrl2080gr.h
+SDK(CMD_SUBDEVICE_CTRL_GR_GET_ROP_INFO, 0x20801213);
+SDK(NV2080_CTRL_CMD_GR_GET_INFO, 0x20801201);
+SDK(NV2080_CTRL_GR_INFO_INDEX_SHADER_PIPE_COUNT, 0x07);
+SDK(NV2080_CTRL_GR_INFO_INDEX_LITTER_NUM_GPCS, 0x14);
+SDK(NV2080_CTRL_GR_INFO_INDEX_LITTER_NUM_FBPS, 0x15);
+SDK(NV2080_CTRL_GR_INFO_INDEX_LITTER_NUM_ZCULL_BANKS, 0x16);
+SDK(NV2080_CTRL_GR_INFO_INDEX_GPU_CORE_COUNT, 0x1D);
+SDK(NV2080_CTRL_GR_INFO_INDEX_LITTER_NUM_SM_PER_TPC, 0x20);
+
+// The ioctl argument sizes the driver checks against its own structs
+SDK(sizeof(NVOS00_PARAMETERS), 16);
+SDK(sizeof(NVOS21_PARAMETERS), 32);
+SDK(sizeof(NVOS64_PARAMETERS), 48);
+SDK(sizeof(NVOS54_PARAMETERS), 32);
+SDK(sizeof(NVOS41_PARAMETERS), 16);
+SDK(sizeof(nv_ioctl_alloc_os_event_t), 16);
+SDK(sizeof(NvUnixEvent), 16);
+SDK(sizeof(NV0005_ALLOC_PARAMETERS), 24);
+SDK(sizeof(NV2080_ALLOC_PARAMETERS), 4);
+SDK(sizeof(NVC637_ALLOCATION_PARAMETERS), 4);
+SDK(sizeof(NVC638_ALLOCATION_PARAMETERS), 4);
+SDK(sizeof(NV0000_CTRL_GPU_GET_UUID_FROM_GPU_ID_PARAMS), 268);
+SDK(sizeof(NV2080_CTRL_EVENT_SET_NOTIFICATION_PARAMS), 20);
+SDK(sizeof(NV2080_CTRL_GR_GET_ROP_INFO_PARAMS), 12);
+SDK(sizeof(NV2080_CTRL_GR_INFO), 8);
+SDK(sizeof(NV2080_CTRL_GR_GET_INFO_PARAMS), 32);